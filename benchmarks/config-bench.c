@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+/*
+ * Micro-benchmark of audio policy configuration handling: XML parsing,
+ * configuration copy and free, default profile set creation and the
+ * string conversion helpers used by the parser.
+ *
+ * config-bench [-n rounds] [-o output] <audio policy configuration>...
+ *
+ * For each operation wall time (min / avg / max), allocation count and peak
+ * heap use above the level before the operation are written as JSON. Heap
+ * is accounted by wrapping the glibc allocator in this executable, so
+ * allocations done by libdroid-util, PulseAudio and expat are all included.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/error.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+#include <droid/conversion.h>
+#include <droid/droid-config.h>
+#include <droid/droid-util.h>
+#include <droid/utils.h>
+#include "config-parser-xml.h"
+
+#define DEFAULT_ROUNDS              (100)
+#define CONVERSION_ROUNDS_FACTOR    (100)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+/* Parser may load included files from multiple threads. */
+static struct {
+    uint64_t count;
+    size_t in_use;
+    size_t peak;
+} heap;
+
+static void heap_account(void *ptr) {
+    size_t in_use, peak;
+
+    if (!ptr)
+        return;
+
+    __atomic_add_fetch(&heap.count, 1, __ATOMIC_RELAXED);
+    in_use = __atomic_add_fetch(&heap.in_use, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&heap.peak, __ATOMIC_RELAXED);
+    while (in_use > peak &&
+           !__atomic_compare_exchange_n(&heap.peak, &peak, in_use, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void heap_unaccount(void *ptr) {
+    if (ptr)
+        __atomic_sub_fetch(&heap.in_use, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    heap_account(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    void *ptr = __libc_calloc(nmemb, size);
+    heap_account(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    void *r;
+
+    heap_unaccount(ptr);
+    if ((r = __libc_realloc(ptr, size)))
+        heap_account(r);
+    else if (size)
+        /* Failed, original is still there. */
+        heap_account(ptr);
+
+    return r;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    void *ptr = __libc_memalign(alignment, size);
+    heap_account(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    void *ptr;
+
+    if (!(ptr = memalign(alignment, size)))
+        return ENOMEM;
+
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void *ptr) {
+    heap_unaccount(ptr);
+    __libc_free(ptr);
+}
+
+struct measurement {
+    const char *name;
+    unsigned rounds;
+    pa_usec_t min;
+    pa_usec_t max;
+    pa_usec_t total;
+    uint64_t allocations;
+    size_t peak;
+
+    /* Current round */
+    pa_usec_t start;
+    uint64_t count_start;
+    size_t in_use_start;
+};
+
+static void measurement_begin(struct measurement *m) {
+    m->count_start = __atomic_load_n(&heap.count, __ATOMIC_RELAXED);
+    m->in_use_start = __atomic_load_n(&heap.in_use, __ATOMIC_RELAXED);
+    __atomic_store_n(&heap.peak, m->in_use_start, __ATOMIC_RELAXED);
+    m->start = pa_rtclock_now();
+}
+
+static void measurement_end(struct measurement *m) {
+    pa_usec_t elapsed = pa_rtclock_now() - m->start;
+    size_t peak;
+
+    if (m->rounds == 0 || elapsed < m->min)
+        m->min = elapsed;
+    if (elapsed > m->max)
+        m->max = elapsed;
+    m->total += elapsed;
+    m->rounds++;
+
+    /* Allocations are the same each round, peak may differ with threads. */
+    m->allocations = __atomic_load_n(&heap.count, __ATOMIC_RELAXED) - m->count_start;
+    peak = __atomic_load_n(&heap.peak, __ATOMIC_RELAXED) - m->in_use_start;
+    if (peak > m->peak)
+        m->peak = peak;
+}
+
+static void measurement_to_json(const struct measurement *m, pa_strbuf *buf) {
+    dm_json_append_string(buf, m->name);
+    pa_strbuf_printf(buf, ":{\"rounds\":%u,\"min_usec\":%llu,\"avg_usec\":%llu,\"max_usec\":%llu,"
+                          "\"allocations\":%llu,\"peak_bytes\":%zu}",
+                     m->rounds,
+                     (unsigned long long) m->min,
+                     (unsigned long long) (m->rounds ? m->total / m->rounds : 0),
+                     (unsigned long long) m->max,
+                     (unsigned long long) m->allocations,
+                     m->peak);
+
+    printf("  %-22s %8llu %8llu %8llu usec %8llu allocations %10zu bytes peak\n",
+           m->name,
+           (unsigned long long) m->min,
+           (unsigned long long) (m->rounds ? m->total / m->rounds : 0),
+           (unsigned long long) m->max,
+           (unsigned long long) m->allocations,
+           m->peak);
+}
+
+static bool bench_file(const char *filename, unsigned rounds, pa_strbuf *buf) {
+    struct measurement parse = { .name = "parse" };
+    struct measurement dup = { .name = "dup" };
+    struct measurement config_free = { .name = "free" };
+    struct measurement profile_set = { .name = "profile_set" };
+    struct measurement profile_set_free = { .name = "profile_set_free" };
+    dm_config_device *config = NULL;
+    dm_config_device *copy;
+    dm_config_module *module;
+    pa_droid_profile_set *ps;
+    unsigned i;
+
+    for (i = 0; i < rounds; i++) {
+        if (config)
+            dm_config_free(config);
+
+        measurement_begin(&parse);
+        config = pa_parse_droid_audio_config_xml(filename);
+        measurement_end(&parse);
+
+        if (!config) {
+            fprintf(stderr, "Failed to parse %s\n", filename);
+            return false;
+        }
+    }
+
+    if (!(module = dm_config_find_module(config, "primary"))) {
+        fprintf(stderr, "No primary module in %s\n", filename);
+        dm_config_free(config);
+        return false;
+    }
+
+    for (i = 0; i < rounds; i++) {
+        measurement_begin(&dup);
+        copy = dm_config_dup(config);
+        measurement_end(&dup);
+
+        measurement_begin(&config_free);
+        dm_config_free(copy);
+        measurement_end(&config_free);
+
+        measurement_begin(&profile_set);
+        ps = pa_droid_profile_set_default_new(module);
+        measurement_end(&profile_set);
+
+        measurement_begin(&profile_set_free);
+        pa_droid_profile_set_free(ps);
+        measurement_end(&profile_set_free);
+    }
+
+    dm_config_free(config);
+
+    printf("%s\n", filename);
+    pa_strbuf_puts(buf, "{\"file\":");
+    dm_json_append_string(buf, filename);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&parse, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&dup, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&config_free, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&profile_set, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&profile_set_free, buf);
+    pa_strbuf_putc(buf, '}');
+
+    return true;
+}
+
+/* Strings as seen in vendor configurations. */
+#define OUTPUT_DEVICES  "AUDIO_DEVICE_OUT_EARPIECE|AUDIO_DEVICE_OUT_SPEAKER|AUDIO_DEVICE_OUT_WIRED_HEADSET|" \
+                        "AUDIO_DEVICE_OUT_WIRED_HEADPHONE|AUDIO_DEVICE_OUT_BLUETOOTH_SCO|" \
+                        "AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET|AUDIO_DEVICE_OUT_USB_HEADSET"
+#define INPUT_DEVICES   "AUDIO_DEVICE_IN_BUILTIN_MIC|AUDIO_DEVICE_IN_BACK_MIC|AUDIO_DEVICE_IN_WIRED_HEADSET|" \
+                        "AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET|AUDIO_DEVICE_IN_VOICE_CALL"
+#define SAMPLING_RATES  "8000,11025,12000,16000,22050,24000,32000,44100,48000,88200,96000,176400,192000"
+#define FORMATS         "AUDIO_FORMAT_PCM_16_BIT|AUDIO_FORMAT_PCM_24_BIT_PACKED|AUDIO_FORMAT_PCM_32_BIT"
+#define OUTPUT_CHANNELS "AUDIO_CHANNEL_OUT_MONO,AUDIO_CHANNEL_OUT_STEREO,AUDIO_CHANNEL_OUT_5POINT1"
+#define INPUT_CHANNELS  "AUDIO_CHANNEL_IN_MONO,AUDIO_CHANNEL_IN_STEREO,AUDIO_CHANNEL_IN_FRONT_BACK"
+#define OUTPUT_FLAGS    "AUDIO_OUTPUT_FLAG_DIRECT|AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD|AUDIO_OUTPUT_FLAG_NON_BLOCKING"
+#define INPUT_FLAGS     "AUDIO_INPUT_FLAG_FAST|AUDIO_INPUT_FLAG_RAW"
+
+static void bench_conversions(unsigned rounds, pa_strbuf *buf) {
+    struct measurement list = { .name = "list" };
+    struct measurement sampling_rates = { .name = "sampling_rates" };
+    struct measurement formats = { .name = "formats" };
+    struct measurement output_channels = { .name = "output_channels" };
+    struct measurement input_channels = { .name = "input_channels" };
+    struct measurement output_devices = { .name = "output_devices" };
+    struct measurement input_devices = { .name = "input_devices" };
+    struct measurement output_flags = { .name = "output_flags" };
+    struct measurement input_flags = { .name = "input_flags" };
+    uint32_t rates[AUDIO_MAX_SAMPLING_RATES];
+    audio_channel_mask_t masks[AUDIO_MAX_CHANNEL_MASKS];
+    char devices_str[sizeof(OUTPUT_DEVICES)];
+    audio_devices_t devices;
+    audio_format_t format;
+    audio_output_flags_t out_flags;
+    uint32_t value;
+    unsigned i;
+
+    for (i = 0; i < rounds; i++) {
+        measurement_begin(&list);
+        pa_conversion_parse_list(CONV_STRING_OUTPUT_DEVICE, "|", OUTPUT_DEVICES, &value, NULL);
+        measurement_end(&list);
+
+        measurement_begin(&sampling_rates);
+        pa_conversion_parse_sampling_rates(__FILE__, __LINE__, SAMPLING_RATES, rates);
+        measurement_end(&sampling_rates);
+
+        measurement_begin(&formats);
+        pa_conversion_parse_formats(__FILE__, __LINE__, FORMATS, &format);
+        measurement_end(&formats);
+
+        measurement_begin(&output_channels);
+        pa_conversion_parse_output_channels(__FILE__, __LINE__, OUTPUT_CHANNELS, masks);
+        measurement_end(&output_channels);
+
+        measurement_begin(&input_channels);
+        pa_conversion_parse_input_channels(__FILE__, __LINE__, INPUT_CHANNELS, masks);
+        measurement_end(&input_channels);
+
+        /* Device parsers take modifiable string. */
+        memcpy(devices_str, OUTPUT_DEVICES, sizeof(OUTPUT_DEVICES));
+        measurement_begin(&output_devices);
+        pa_conversion_parse_output_devices(__FILE__, __LINE__, devices_str, true, &devices);
+        measurement_end(&output_devices);
+
+        memcpy(devices_str, INPUT_DEVICES, sizeof(INPUT_DEVICES));
+        measurement_begin(&input_devices);
+        pa_conversion_parse_input_devices(__FILE__, __LINE__, devices_str, true, &devices);
+        measurement_end(&input_devices);
+
+        measurement_begin(&output_flags);
+        pa_conversion_parse_output_flags(__FILE__, __LINE__, OUTPUT_FLAGS, &out_flags);
+        measurement_end(&output_flags);
+
+        measurement_begin(&input_flags);
+        pa_conversion_parse_input_flags(__FILE__, __LINE__, INPUT_FLAGS, &value);
+        measurement_end(&input_flags);
+    }
+
+    printf("conversions\n");
+    pa_strbuf_putc(buf, '{');
+    measurement_to_json(&list, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&sampling_rates, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&formats, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&output_channels, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&input_channels, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&output_devices, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&input_devices, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&output_flags, buf);
+    pa_strbuf_putc(buf, ',');
+    measurement_to_json(&input_flags, buf);
+    pa_strbuf_putc(buf, '}');
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n rounds] [-o output] <audio policy configuration>...\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = "config.json";
+    unsigned rounds = DEFAULT_ROUNDS;
+    pa_strbuf *buf;
+    char *json;
+    FILE *f;
+    int ret = EXIT_FAILURE;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+        switch (opt) {
+            case 'n':
+                if (pa_atou(optarg, &rounds) < 0 || rounds == 0) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Parser and profile set creation log details, keep only problems. */
+    pa_log_set_level(PA_LOG_WARN);
+
+    printf("%-24s %8s %8s %8s\n", "", "min", "avg", "max");
+
+    buf = pa_strbuf_new();
+    pa_strbuf_printf(buf, "{\"benchmark\":\"config\",\"rounds\":%u,\"files\":[", rounds);
+    for (i = optind; i < argc; i++) {
+        if (i > optind)
+            pa_strbuf_putc(buf, ',');
+        if (!bench_file(argv[i], rounds, buf))
+            goto fail;
+    }
+    pa_strbuf_printf(buf, "],\"conversion_rounds\":%u,\"conversions\":", rounds * CONVERSION_ROUNDS_FACTOR);
+    bench_conversions(rounds * CONVERSION_ROUNDS_FACTOR, buf);
+    pa_strbuf_puts(buf, "}\n");
+
+    if (!(f = fopen(output, "w"))) {
+        fprintf(stderr, "Failed to open %s: %s\n", output, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    json = pa_strbuf_to_string(buf);
+    fputs(json, f);
+    pa_xfree(json);
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", output, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    printf("Results written to %s\n", output);
+    ret = EXIT_SUCCESS;
+
+fail:
+    pa_strbuf_free(buf);
+
+    return ret;
+}
@@ -0,0 +1,84 @@
+# Helpers for running module-droid-card against the mock audio HAL in a
+# private, headless PulseAudio daemon. Sourced by the benchmark scripts.
+#
+# Environment:
+#   PULSEAUDIO    pulseaudio binary
+#   PACTL         pactl binary
+#   PACAT         pacat binary, for clients
+#   MODULE_DIR    directory of the built droid modules
+#   PA_MODULE_DIR directory of PulseAudio's own modules
+
+PULSE_TMP=
+PULSE_PID=
+PULSE_CARD=
+PULSE_CLIENTS=
+
+# pulse_start <module-droid-card arguments>
+pulse_start() {
+    PULSE_TMP=$(mktemp -d) || exit 1
+
+    export HOME="$PULSE_TMP"
+    export XDG_RUNTIME_DIR="$PULSE_TMP"
+    export PULSE_RUNTIME_PATH="$PULSE_TMP"
+    export PULSE_STATE_PATH="$PULSE_TMP"
+    export PULSE_SERVER="unix:$PULSE_TMP/native"
+
+    cat > "$PULSE_TMP/default.pa" <<EOF
+load-module module-native-protocol-unix socket=$PULSE_TMP/native auth-anonymous=1
+load-module module-droid-card $1
+EOF
+
+    "$PULSEAUDIO" -n --daemonize=no --use-pid-file=no --system=no \
+        --exit-idle-time=-1 \
+        --dl-search-path="$MODULE_DIR:$PA_MODULE_DIR" \
+        --log-target=file:"$PULSE_TMP/pulse.log" \
+        -F "$PULSE_TMP/default.pa" &
+    PULSE_PID=$!
+
+    i=0
+    until "$PACTL" info > /dev/null 2>&1; do
+        i=$((i + 1))
+        if [ $i -gt 100 ] || ! kill -0 $PULSE_PID 2> /dev/null; then
+            echo "PulseAudio failed to start, log follows:" >&2
+            cat "$PULSE_TMP/pulse.log" >&2
+            pulse_stop
+            exit 1
+        fi
+        sleep 0.1
+    done
+
+    PULSE_CARD=$("$PACTL" list short cards | cut -f 2 | head -n 1)
+    if [ -z "$PULSE_CARD" ]; then
+        echo "No droid card, log follows:" >&2
+        cat "$PULSE_TMP/pulse.log" >&2
+        pulse_stop
+        exit 1
+    fi
+}
+
+# pulse_message <message>
+pulse_message() {
+    "$PACTL" send-message "/card/$PULSE_CARD/droid" "$1"
+}
+
+# pulse_client <command...>, run client in background until pulse_stop
+pulse_client() {
+    "$@" &
+    PULSE_CLIENTS="$PULSE_CLIENTS $!"
+}
+
+pulse_stop() {
+    for pid in $PULSE_CLIENTS; do
+        kill "$pid" 2> /dev/null
+    done
+    PULSE_CLIENTS=
+
+    if [ -n "$PULSE_PID" ]; then
+        kill "$PULSE_PID" 2> /dev/null
+        wait "$PULSE_PID" 2> /dev/null
+    fi
+
+    [ -n "$PULSE_TMP" ] && rm -rf "$PULSE_TMP"
+    PULSE_PID=
+    PULSE_TMP=
+}
@@ -0,0 +1,86 @@
+#!/bin/sh
+#
+# IO loop benchmark: run playback and capture clients against droid sinks and
+# sources backed by the mock audio HAL and write IO statistics as JSON.
+#
+# io-loop.sh [-p playback clients] [-c capture clients] [-d seconds]
+#            [-l client latency ms] [-m mock_hal settings] [-o output]
+#            <audio policy configuration>
+#
+# Playback clients are spread over all droid sinks (primary, deep buffer, low
+# latency...). Clients play 44.1kHz stereo so that resampling to the HAL rate
+# is part of the measurement. Output has the statistics from card message
+# "stats" and end-to-end latency of each client as reported by PulseAudio
+# (client buffer plus sink or source latency).
+
+set -u
+
+PLAYBACK=4
+CAPTURE=1
+DURATION=30
+LATENCY_MS=40
+MOCK_HAL="period_ms=20"
+OUTPUT=io-loop.json
+
+while getopts "p:c:d:l:m:o:" opt; do
+    case $opt in
+        p) PLAYBACK=$OPTARG ;;
+        c) CAPTURE=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        l) LATENCY_MS=$OPTARG ;;
+        m) MOCK_HAL=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 [-p n] [-c n] [-d seconds] [-l ms] [-m settings] [-o output] <config>" >&2
+    exit 1
+fi
+CONFIG=$1
+
+. "$(dirname "$0")/headless-pulse.sh"
+
+trap pulse_stop EXIT
+trap 'exit 1' INT TERM
+
+pulse_start "config=$CONFIG mock_hal=\"$MOCK_HAL\""
+
+SINKS=$("$PACTL" list short sinks | cut -f 2 | grep '^sink\.')
+SOURCES=$("$PACTL" list short sources | cut -f 2 | grep '^source\.')
+N_SINKS=$(echo "$SINKS" | wc -l)
+
+i=0
+while [ $i -lt "$PLAYBACK" ]; do
+    sink=$(echo "$SINKS" | sed -n "$((i % N_SINKS + 1))p")
+    pulse_client "$PACAT" --playback --raw --device="$sink" --format=s16le --rate=44100 --channels=2 \
+        --latency-msec="$LATENCY_MS" --client-name="io-loop playback $i" /dev/zero
+    i=$((i + 1))
+done
+
+source=$(echo "$SOURCES" | head -n 1)
+i=0
+while [ $i -lt "$CAPTURE" ]; do
+    pulse_client "$PACAT" --record --raw --device="$source" --format=s16le --rate=44100 --channels=2 \
+        --latency-msec="$LATENCY_MS" --client-name="io-loop capture $i" /dev/null
+    i=$((i + 1))
+done
+
+# Let streams settle before measuring.
+sleep 2
+pulse_message stats-reset > /dev/null
+sleep "$DURATION"
+
+STATS=$(pulse_message stats)
+PLAYBACK_LATENCY=$("$PACTL" list sink-inputs | \
+    awk '/Buffer Latency:/ { b = $3 } /Sink Latency:/ { printf "%s%d", sep, b + $3; sep = "," }')
+CAPTURE_LATENCY=$("$PACTL" list source-outputs | \
+    awk '/Buffer Latency:/ { b = $3 } /Source Latency:/ { printf "%s%d", sep, b + $3; sep = "," }')
+
+cat > "$OUTPUT" <<EOF
+{"benchmark":"io-loop","playback_clients":$PLAYBACK,"capture_clients":$CAPTURE,"duration_sec":$DURATION,"client_latency_msec":$LATENCY_MS,"mock_hal":"$MOCK_HAL","playback_latency_usec":[$PLAYBACK_LATENCY],"capture_latency_usec":[$CAPTURE_LATENCY],"streams":$STATS}
+EOF
+
+echo "Results written to $OUTPUT"
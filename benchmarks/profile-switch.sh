@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# Profile switch benchmark: switch card profile through the call related
+# virtual profiles while clients are playing and recording and write the
+# profile and route switch timings as JSON.
+#
+# profile-switch.sh [-r rounds] [-p playback clients] [-c capture clients]
+#                   [-m mock_hal settings] [-o output]
+#                   <audio policy configuration>
+#
+# Each round switches default -> voicecall -> default -> communication ->
+# default -> ringtone -> default. Mock HAL delays default to values close to
+# real HALs so that the timings resemble call setup on a device. Output has
+# card message "profile-switches" of each round, as the card keeps only the
+# latest changes, and "route-switches" at the end.
+
+set -u
+
+ROUNDS=5
+PLAYBACK=1
+CAPTURE=1
+MOCK_HAL="open_delay_ms=30 patch_delay_ms=10 mode_delay_ms=80"
+OUTPUT=profile-switch.json
+PROFILES="voicecall default communication default ringtone default"
+
+while getopts "r:p:c:m:o:" opt; do
+    case $opt in
+        r) ROUNDS=$OPTARG ;;
+        p) PLAYBACK=$OPTARG ;;
+        c) CAPTURE=$OPTARG ;;
+        m) MOCK_HAL=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 [-r rounds] [-p n] [-c n] [-m settings] [-o output] <config>" >&2
+    exit 1
+fi
+CONFIG=$1
+
+. "$(dirname "$0")/headless-pulse.sh"
+
+trap pulse_stop EXIT
+trap 'exit 1' INT TERM
+
+pulse_start "config=$CONFIG mock_hal=\"$MOCK_HAL\""
+
+# Clients follow the default sink and source, which are moved on switch.
+i=0
+while [ $i -lt "$PLAYBACK" ]; do
+    pulse_client "$PACAT" --playback --raw --format=s16le --rate=48000 --channels=2 \
+        --client-name="profile-switch playback $i" /dev/zero
+    i=$((i + 1))
+done
+
+i=0
+while [ $i -lt "$CAPTURE" ]; do
+    pulse_client "$PACAT" --record --raw --format=s16le --rate=48000 --channels=1 \
+        --client-name="profile-switch capture $i" /dev/null
+    i=$((i + 1))
+done
+
+sleep 1
+
+SWITCHES=
+FAILED=0
+i=0
+while [ $i -lt "$ROUNDS" ]; do
+    pulse_message profile-switches-reset > /dev/null
+    for p in $PROFILES; do
+        if ! "$PACTL" set-card-profile "$PULSE_CARD" "$p"; then
+            echo "Switching to profile $p failed" >&2
+            FAILED=$((FAILED + 1))
+        fi
+    done
+    [ -n "$SWITCHES" ] && SWITCHES="$SWITCHES,"
+    SWITCHES="$SWITCHES$(pulse_message profile-switches)"
+    i=$((i + 1))
+done
+
+ROUTES=$(pulse_message route-switches)
+
+cat > "$OUTPUT" <<EOF2
+{"benchmark":"profile-switch","rounds":$ROUNDS,"playback_clients":$PLAYBACK,"capture_clients":$CAPTURE,"mock_hal":"$MOCK_HAL","failed":$FAILED,"profile_switches":[$SWITCHES],"route_switches":$ROUTES}
+EOF2
+
+echo "Results written to $OUTPUT"
+
+[ $FAILED -eq 0 ]
@@ -78,6 +78,11 @@ usermod -G input -a pulse || :
 %dir %{_includedir}/pulsecore/modules/droid
 %{_includedir}/pulsecore/modules/droid/conversion.h
 %{_includedir}/pulsecore/modules/droid/droid-config.h
+%{_includedir}/pulsecore/modules/droid/droid-hal-api.h
+%{_includedir}/pulsecore/modules/droid/droid-hal-stats.h
+%{_includedir}/pulsecore/modules/droid/droid-parameters.h
+%{_includedir}/pulsecore/modules/droid/droid-stream-stats.h
+%{_includedir}/pulsecore/modules/droid/droid-trace.h
 %{_includedir}/pulsecore/modules/droid/droid-util.h
 %{_includedir}/pulsecore/modules/droid/sllist.h
 %{_includedir}/pulsecore/modules/droid/utils.h
@@ -28,12 +28,18 @@
 
 #include <stdarg.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include <expat.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/strbuf.h>
+#include <pulsecore/thread.h>
 
 #include "droid/conversion.h"
 #include "droid/sllist.h"
@@ -931,24 +937,35 @@ done:
     return parsed;
 }
 
+/* Read the file straight into expat's own parse buffer, avoiding the
+ * intermediate copy a stdio read loop would need. Regular files are
+ * normally consumed with a single read and a single XML_ParseBuffer call. */
 static bool parse_file(struct parser_data *data, const struct element_parser *root, const char *filename) {
-    char buf[BUFSIZ];
-    FILE *f = NULL;
+    struct stat st;
+    size_t chunk;
+    int fd = -1;
     XML_Parser parser = NULL;
     bool done;
     bool ret = true;
+    pa_usec_t begin;
 
     pa_assert(data);
     pa_assert(filename);
 
-    f = fopen(filename, "r");
+    begin = pa_rtclock_now();
 
-    if (!f) {
+    if ((fd = pa_open_cloexec(filename, O_RDONLY, 0)) < 0) {
         pa_log_info("Failed to open file (%s): %s", filename, pa_cstrerror(errno));
         ret = false;
         goto done;
     }
 
+    /* Files with unknown size (st_size of 0) are read in BUFSIZ chunks. */
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size < INT_MAX)
+        chunk = (size_t) st.st_size;
+    else
+        chunk = BUFSIZ;
+
     parser = XML_ParserCreate(NULL);
     data->parser = parser;
     data->fn = filename;
@@ -964,9 +981,23 @@ static bool parse_file(struct parser_data *data, const struct element_parser *ro
     pa_log_debug("Read %s ...", data->fn);
 
     do {
-        size_t len = fread(buf, 1, sizeof(buf), f);
-        done = len < sizeof(buf);
-        if (XML_Parse(parser, buf, (int) len, done) == XML_STATUS_ERROR) {
+        void *buf;
+        ssize_t len;
+
+        if (!(buf = XML_GetBuffer(parser, (int) chunk))) {
+            pa_log("Failed to allocate parse buffer for %s", filename);
+            ret = false;
+            goto done;
+        }
+
+        if ((len = pa_loop_read(fd, buf, chunk, NULL)) < 0) {
+            pa_log("Failed to read file (%s): %s", filename, pa_cstrerror(errno));
+            ret = false;
+            goto done;
+        }
+
+        done = (size_t) len < chunk;
+        if (XML_ParseBuffer(parser, (int) len, done) == XML_STATUS_ERROR) {
             unsigned long lineno = XML_GetCurrentLineNumber(parser);
             pa_log("%" XML_FMT_STR " at line %lu\n",
                    XML_ErrorString(XML_GetErrorCode(parser)),
@@ -976,12 +1007,14 @@ static bool parse_file(struct parser_data *data, const struct element_parser *ro
         }
     } while (!done);
 
+    pa_log_debug("Parsed %s in %llu us.", filename, (unsigned long long) (pa_rtclock_now() - begin));
+
 done:
     if (parser)
         XML_ParserFree(parser);
 
-    if (f)
-        fclose(f);
+    if (fd >= 0)
+        pa_close(fd);
 
     return ret;
 }
@@ -1216,36 +1249,161 @@ static char *build_path(const char *base_file, const char *filename) {
     return fn;
 }
 
-dm_config_device *pa_parse_droid_audio_config_xml(const char *filename) {
-    dm_config_device *config = NULL;
+struct include_job {
+    const char *base_filename;
+    struct includes **includes;
+    unsigned n_includes;
     struct parser_data data;
+    pa_thread *thread;
+    bool ret;
+};
+
+static void include_job_run(void *userdata) {
+    struct include_job *job = userdata;
+    unsigned i;
+
+    job->ret = true;
+
+    for (i = 0; i < job->n_includes; i++) {
+        char *fn = NULL;
+
+        job->data.current_include = job->includes[i];
+
+        if (job->data.current_include->href[0] != '/')
+            fn = build_path(job->base_filename, job->data.current_include->href);
+
+        job->ret = parse_file(&job->data, &element_parse_modules, fn ? fn : job->data.current_include->href);
+
+        pa_assert(!job->data.current_module);
+        pa_xfree(fn);
+
+        if (!job->ret)
+            break;
+    }
+}
+
+static void include_job_merge(struct audio_policy_configuration *conf, struct include_job *job) {
+    struct global_configuration *global;
+    struct module *module;
+    struct includes *include;
+
+    if (!job->data.conf)
+        return;
+
+    while (job->data.conf->global) {
+        SLLIST_STEAL_FIRST(global, job->data.conf->global);
+        SLLIST_APPEND(struct global_configuration, conf->global, global);
+    }
+
+    while (job->data.conf->modules) {
+        SLLIST_STEAL_FIRST(module, job->data.conf->modules);
+        SLLIST_APPEND(struct module, conf->modules, module);
+    }
+
+    while (job->data.conf->includes) {
+        SLLIST_STEAL_FIRST(include, job->data.conf->includes);
+        SLLIST_APPEND(struct includes, conf->includes, include);
+    }
+
+    audio_policy_configuration_free(job->data.conf);
+    job->data.conf = NULL;
+}
+
+/* Included files are parsed in waves: all includes known after the previous
+ * wave are parsed concurrently, each job into a configuration of its own.
+ * Includes that add to the same module are handled sequentially by the same
+ * job so that no module is modified from two threads. When the wave is done
+ * results are merged in include order, which gives the same end result as
+ * parsing the includes one after another. Includes found from included files
+ * form the next wave. */
+static bool parse_includes(struct parser_data *data, const char *filename) {
+    struct includes *pending;
+    struct includes *include;
     bool ret = true;
 
-    pa_assert(filename);
+    pending = data->conf->includes;
 
-    memset(&data, 0, sizeof(data));
+    while (pending && ret) {
+        struct include_job *jobs;
+        struct includes *last;
+        unsigned n_pending = 0;
+        unsigned n_jobs = 0;
+        unsigned i;
 
-    if (!(ret = parse_file(&data, &element_parse_root, filename)))
-        goto done;
+        SLLIST_FOREACH(include, pending)
+            n_pending++;
+
+        jobs = pa_xnew0(struct include_job, n_pending);
+
+        SLLIST_FOREACH(include, pending) {
+            struct include_job *job = NULL;
+
+            if (include->module) {
+                for (i = 0; i < n_jobs; i++) {
+                    if (jobs[i].includes[0]->module == include->module) {
+                        job = &jobs[i];
+                        break;
+                    }
+                }
+            }
 
-    if (data.conf->includes) {
-        /* Only handle module includes for now. */
-        SLLIST_FOREACH(data.current_include, data.conf->includes) {
-            char *fn = NULL;
+            if (!job) {
+                job = &jobs[n_jobs++];
+                job->base_filename = filename;
+                job->includes = pa_xnew0(struct includes *, n_pending);
+            }
 
-            if (data.current_include->href[0] != '/')
-                fn = build_path(filename, data.current_include->href);
+            job->includes[job->n_includes++] = include;
+        }
 
-            ret = parse_file(&data, &element_parse_modules, fn ? fn : data.current_include->href);
+        /* First job is run in this thread, the rest in worker threads. If a
+         * thread cannot be created the job is run here as well. */
+        for (i = 1; i < n_jobs; i++) {
+            char *name = pa_sprintf_malloc("droid-xml-%u", i);
+            if (!(jobs[i].thread = pa_thread_new(name, include_job_run, &jobs[i])))
+                include_job_run(&jobs[i]);
+            pa_xfree(name);
+        }
 
-            pa_assert(!data.current_module);
-            pa_xfree(fn);
+        include_job_run(&jobs[0]);
 
-            if (!ret)
-                goto done;
+        for (last = pending; last->next; last = last->next);
+
+        for (i = 0; i < n_jobs; i++) {
+            if (jobs[i].thread)
+                pa_thread_free(jobs[i].thread);
+
+            if (!jobs[i].ret)
+                ret = false;
+
+            include_job_merge(data->conf, &jobs[i]);
+            pa_xfree(jobs[i].includes);
         }
+
+        pa_xfree(jobs);
+
+        pending = last->next;
     }
 
+    return ret;
+}
+
+dm_config_device *pa_parse_droid_audio_config_xml(const char *filename) {
+    dm_config_device *config = NULL;
+    struct parser_data data;
+    bool ret = true;
+
+    pa_assert(filename);
+
+    memset(&data, 0, sizeof(data));
+
+    if (!(ret = parse_file(&data, &element_parse_root, filename)))
+        goto done;
+
+    /* Only handle module includes for now. */
+    if (data.conf->includes && !(ret = parse_includes(&data, filename)))
+        goto done;
+
     config = process_config(data.conf);
 
 done:
@@ -30,22 +30,162 @@
 #include "droid-util-audio.h"
 #endif
 
+#include <string.h>
+
 #include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/once.h>
+#include <pulsecore/strbuf.h>
 
 #include <hardware/audio.h>
 
 #include "droid/conversion.h"
 #include "droid/droid-config.h"
 
-#define CONVERT_FUNC(TABL) \
-bool pa_convert_ ## TABL (uint32_t value, pa_conversion_field_t field, uint32_t *to_value) {                    \
-    for (unsigned int i = 0; i < sizeof( conversion_table_ ## TABL )/(sizeof(uint32_t)*2); i++) {               \
-        if ( conversion_table_ ## TABL [i][field] == value) {                                                   \
-            *to_value = conversion_table_ ## TABL [i][!field];                                                  \
-            return true;                                                                                        \
-        }                                                                                                       \
-    }                                                                                                           \
-    return false;                                                                                               \
+/* Lookup indices for the conversion tables.
+ *
+ * Tables in droid-util-audio.h are in human readable order and contain entries
+ * which depend on the HAL headers (HAVE_ENUM_* checks), so the final contents are
+ * known only after preprocessing. Instead of scanning the tables linearly on every
+ * lookup, sorted indices are built once on first use and lookups are done with
+ * binary search. Sorting is stable, so with duplicate keys the entry appearing
+ * first in the table is found, same as with linear scan. */
+
+struct value_index {
+    uint32_t (*table)[2];
+    unsigned count;
+    uint16_t *by_field[2];
+};
+
+struct string_index {
+    const struct string_conversion *list;
+    unsigned count;
+    const struct string_conversion **by_value;
+    const struct string_conversion **by_str;
+};
+
+#define VALUE_INDEX(TABL)                                                                                           \
+static uint16_t TABL ## _by_field[2][PA_ELEMENTSOF(conversion_table_ ## TABL)];                                     \
+static struct value_index value_index_ ## TABL = {                                                                  \
+    conversion_table_ ## TABL, PA_ELEMENTSOF(conversion_table_ ## TABL),                                            \
+    { TABL ## _by_field[0], TABL ## _by_field[1] }                                                                  \
+}
+
+/* Last entry of string tables is the { 0, NULL } terminator, which is not indexed. */
+#define STRING_INDEX(TABL)                                                                                          \
+static const struct string_conversion *TABL ## _by_value[PA_ELEMENTSOF(string_conversion_table_ ## TABL)];          \
+static const struct string_conversion *TABL ## _by_str[PA_ELEMENTSOF(string_conversion_table_ ## TABL)];            \
+static struct string_index string_index_ ## TABL = {                                                                \
+    string_conversion_table_ ## TABL, PA_ELEMENTSOF(string_conversion_table_ ## TABL) - 1,                          \
+    TABL ## _by_value, TABL ## _by_str                                                                              \
+}
+
+VALUE_INDEX(format);
+VALUE_INDEX(output_channel);
+VALUE_INDEX(input_channel);
+VALUE_INDEX(default_audio_source);
+
+STRING_INDEX(format);
+STRING_INDEX(output_channels);
+STRING_INDEX(input_channels);
+STRING_INDEX(output_device);
+STRING_INDEX(output_device_fancy);
+STRING_INDEX(input_device);
+STRING_INDEX(input_device_fancy);
+STRING_INDEX(output_flag);
+STRING_INDEX(input_flag);
+STRING_INDEX(audio_source_fancy);
+
+static struct value_index *value_indices[] = {
+    &value_index_format,
+    &value_index_output_channel,
+    &value_index_input_channel,
+    &value_index_default_audio_source,
+};
+
+static struct string_index *string_indices[] = {
+    &string_index_format,
+    &string_index_output_channels,
+    &string_index_input_channels,
+    &string_index_output_device,
+    &string_index_output_device_fancy,
+    &string_index_input_device,
+    &string_index_input_device_fancy,
+    &string_index_output_flag,
+    &string_index_input_flag,
+    &string_index_audio_source_fancy,
+};
+
+/* Tables are small, insertion sort keeps equal entries in table order. */
+static void value_index_build(struct value_index *idx) {
+    for (unsigned f = 0; f < 2; f++) {
+        uint16_t *v = idx->by_field[f];
+
+        for (unsigned i = 0; i < idx->count; i++) {
+            unsigned j = i;
+
+            while (j > 0 && idx->table[v[j - 1]][f] > idx->table[i][f]) {
+                v[j] = v[j - 1];
+                j--;
+            }
+            v[j] = i;
+        }
+    }
+}
+
+static void string_index_build(struct string_index *idx) {
+    for (unsigned i = 0; i < idx->count; i++) {
+        const struct string_conversion *e = &idx->list[i];
+        unsigned j;
+
+        for (j = i; j > 0 && idx->by_value[j - 1]->value > e->value; j--)
+            idx->by_value[j] = idx->by_value[j - 1];
+        idx->by_value[j] = e;
+
+        for (j = i; j > 0 && strcmp(idx->by_str[j - 1]->str, e->str) > 0; j--)
+            idx->by_str[j] = idx->by_str[j - 1];
+        idx->by_str[j] = e;
+    }
+}
+
+static void indices_init(void) {
+    PA_ONCE_BEGIN {
+        for (unsigned i = 0; i < PA_ELEMENTSOF(value_indices); i++)
+            value_index_build(value_indices[i]);
+        for (unsigned i = 0; i < PA_ELEMENTSOF(string_indices); i++)
+            string_index_build(string_indices[i]);
+    } PA_ONCE_END;
+}
+
+static bool value_index_find(struct value_index *idx, uint32_t value, pa_conversion_field_t field, uint32_t *to_value) {
+    const uint16_t *v;
+    unsigned lo = 0, hi;
+
+    indices_init();
+
+    v = idx->by_field[field];
+    hi = idx->count;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (idx->table[v[mid]][field] < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < idx->count && idx->table[v[lo]][field] == value) {
+        *to_value = idx->table[v[lo]][!field];
+        return true;
+    }
+
+    return false;
+}
+
+#define CONVERT_FUNC(TABL)                                                                                          \
+bool pa_convert_ ## TABL (uint32_t value, pa_conversion_field_t field, uint32_t *to_value) {                        \
+    return value_index_find(&value_index_ ## TABL, value, field, to_value);                                         \
 } struct __funny_extra_to_allow_semicolon
 
 /* Creates convert_format convert_channel etc.
@@ -57,81 +197,123 @@ CONVERT_FUNC(input_channel);
 
 #define VALUE_SEPARATOR " ,"
 
-static bool string_convert_num_to_str(const struct string_conversion *list, const uint32_t value, const char **to_str) {
-    pa_assert(list);
+static bool string_convert_num_to_str(struct string_index *idx, const uint32_t value, const char **to_str) {
+    unsigned lo = 0, hi;
+
+    pa_assert(idx);
     pa_assert(to_str);
 
-    for (unsigned int i = 0; list[i].str; i++) {
-        if (list[i].value == value) {
-            *to_str = list[i].str;
-            return true;
-        }
+    indices_init();
+
+    hi = idx->count;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (idx->by_value[mid]->value < value)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+
+    if (lo < idx->count && idx->by_value[lo]->value == value) {
+        *to_str = idx->by_value[lo]->str;
+        return true;
+    }
+
     return false;
 }
 
-static bool string_convert_str_to_num(const struct string_conversion *list, const char *str, uint32_t *to_value) {
-    pa_assert(list);
+/* Compare NUL terminated table string to string span of len characters. */
+static int span_cmp(const char *table_str, const char *str, size_t len) {
+    int r;
+
+    if ((r = strncmp(table_str, str, len)))
+        return r;
+
+    return table_str[len] != '\0';
+}
+
+static bool string_convert_span_to_num(struct string_index *idx, const char *str, size_t len, uint32_t *to_value) {
+    unsigned lo = 0, hi;
+
+    pa_assert(idx);
     pa_assert(str);
     pa_assert(to_value);
 
-    for (unsigned int i = 0; list[i].str; i++) {
-        if (pa_streq(list[i].str, str)) {
-            *to_value = list[i].value;
-            return true;
-        }
+    indices_init();
+
+    hi = idx->count;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (span_cmp(idx->by_str[mid]->str, str, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+
+    if (lo < idx->count && span_cmp(idx->by_str[lo]->str, str, len) == 0) {
+        *to_value = idx->by_str[lo]->value;
+        return true;
+    }
+
     return false;
 }
 
+static bool string_convert_str_to_num(struct string_index *idx, const char *str, uint32_t *to_value) {
+    pa_assert(str);
+
+    return string_convert_span_to_num(idx, str, strlen(str), to_value);
+}
+
 static char *list_string(struct string_conversion *list, uint32_t flags) {
-    char *str = NULL;
-    char *tmp;
+    pa_strbuf *buf = NULL;
 
     for (unsigned int i = 0; list[i].str; i++) {
         if (popcount(list[i].value) != 1)
             continue;
 
         if (flags & list[i].value) {
-            if (str) {
-                tmp = pa_sprintf_malloc("%s|%s", str, list[i].str);
-                pa_xfree(str);
-                str = tmp;
-            } else {
-                str = pa_sprintf_malloc("%s", list[i].str);
-            }
+            if (buf)
+                pa_strbuf_putc(buf, '|');
+            else
+                buf = pa_strbuf_new();
+
+            pa_strbuf_puts(buf, list[i].str);
         }
     }
 
-    return str;
+    return buf ? pa_strbuf_to_string_free(buf) : NULL;
 }
 
 /* Generic conversion */
 bool pa_string_convert_num_to_str(pa_conversion_string_t type, uint32_t value, const char **to_str) {
     switch (type) {
         case CONV_STRING_FORMAT:
-            return string_convert_num_to_str(string_conversion_table_format, value, to_str);
+            return string_convert_num_to_str(&string_index_format, value, to_str);
 
         case CONV_STRING_OUTPUT_CHANNELS:
-            return string_convert_num_to_str(string_conversion_table_output_channels, value, to_str);
+            return string_convert_num_to_str(&string_index_output_channels, value, to_str);
 
         case CONV_STRING_INPUT_CHANNELS:
-            return string_convert_num_to_str(string_conversion_table_input_channels, value, to_str);
+            return string_convert_num_to_str(&string_index_input_channels, value, to_str);
 
         case CONV_STRING_OUTPUT_DEVICE:
-            return string_convert_num_to_str(string_conversion_table_output_device, value, to_str);
+            return string_convert_num_to_str(&string_index_output_device, value, to_str);
 
         case CONV_STRING_INPUT_DEVICE:
-            return string_convert_num_to_str(string_conversion_table_input_device, value, to_str);
+            return string_convert_num_to_str(&string_index_input_device, value, to_str);
 
         case CONV_STRING_OUTPUT_FLAG:
-            return string_convert_num_to_str(string_conversion_table_output_flag, value, to_str);
+            return string_convert_num_to_str(&string_index_output_flag, value, to_str);
 
         case CONV_STRING_INPUT_FLAG:
-            return string_convert_num_to_str(string_conversion_table_input_flag, value, to_str);
+            return string_convert_num_to_str(&string_index_input_flag, value, to_str);
 
         case CONV_STRING_AUDIO_SOURCE_FANCY:
-            return string_convert_num_to_str(string_conversion_table_audio_source_fancy, value, to_str);
+            return string_convert_num_to_str(&string_index_audio_source_fancy, value, to_str);
     }
 
     pa_assert_not_reached();
@@ -141,28 +323,28 @@ bool pa_string_convert_num_to_str(pa_conversion_string_t type, uint32_t value, c
 bool pa_string_convert_str_to_num(pa_conversion_string_t type, const char *str, uint32_t *to_value) {
     switch (type) {
         case CONV_STRING_FORMAT:
-            return string_convert_str_to_num(string_conversion_table_format, str, to_value);
+            return string_convert_str_to_num(&string_index_format, str, to_value);
 
         case CONV_STRING_OUTPUT_CHANNELS:
-            return string_convert_str_to_num(string_conversion_table_output_channels, str, to_value);
+            return string_convert_str_to_num(&string_index_output_channels, str, to_value);
 
         case CONV_STRING_INPUT_CHANNELS:
-            return string_convert_str_to_num(string_conversion_table_input_channels, str, to_value);
+            return string_convert_str_to_num(&string_index_input_channels, str, to_value);
 
         case CONV_STRING_OUTPUT_DEVICE:
-            return string_convert_str_to_num(string_conversion_table_output_device, str, to_value);
+            return string_convert_str_to_num(&string_index_output_device, str, to_value);
 
         case CONV_STRING_INPUT_DEVICE:
-            return string_convert_str_to_num(string_conversion_table_input_device, str, to_value);
+            return string_convert_str_to_num(&string_index_input_device, str, to_value);
 
         case CONV_STRING_OUTPUT_FLAG:
-            return string_convert_str_to_num(string_conversion_table_output_flag, str, to_value);
+            return string_convert_str_to_num(&string_index_output_flag, str, to_value);
 
         case CONV_STRING_INPUT_FLAG:
-            return string_convert_str_to_num(string_conversion_table_input_flag, str, to_value);
+            return string_convert_str_to_num(&string_index_input_flag, str, to_value);
 
         case CONV_STRING_AUDIO_SOURCE_FANCY:
-            return string_convert_str_to_num(string_conversion_table_audio_source_fancy, str, to_value);
+            return string_convert_str_to_num(&string_index_audio_source_fancy, str, to_value);
     }
 
     pa_assert_not_reached();
@@ -171,29 +353,29 @@ bool pa_string_convert_str_to_num(pa_conversion_string_t type, const char *str,
 
 /* Output device */
 bool pa_string_convert_output_device_num_to_str(audio_devices_t value, const char **to_str) {
-    return string_convert_num_to_str(string_conversion_table_output_device, (uint32_t) value, to_str);
+    return string_convert_num_to_str(&string_index_output_device, (uint32_t) value, to_str);
 }
 
 bool pa_string_convert_output_device_str_to_num(const char *str, audio_devices_t *to_value) {
-    return string_convert_str_to_num(string_conversion_table_output_device, str, (uint32_t*) to_value);
+    return string_convert_str_to_num(&string_index_output_device, str, (uint32_t*) to_value);
 }
 
 /* Input device */
 bool pa_string_convert_input_device_num_to_str(audio_devices_t value, const char **to_str) {
-    return string_convert_num_to_str(string_conversion_table_input_device, (uint32_t) value, to_str);
+    return string_convert_num_to_str(&string_index_input_device, (uint32_t) value, to_str);
 }
 
 bool pa_string_convert_input_device_str_to_num(const char *str, audio_devices_t *to_value) {
-    return string_convert_str_to_num(string_conversion_table_input_device, str, (uint32_t*) to_value);
+    return string_convert_str_to_num(&string_index_input_device, str, (uint32_t*) to_value);
 }
 
 /* Flags */
 bool pa_string_convert_flag_num_to_str(audio_output_flags_t value, const char **to_str) {
-    return string_convert_num_to_str(string_conversion_table_output_flag, (uint32_t) value, to_str);
+    return string_convert_num_to_str(&string_index_output_flag, (uint32_t) value, to_str);
 }
 
 bool pa_string_convert_flag_str_to_num(const char *str, audio_output_flags_t *to_value) {
-    return string_convert_str_to_num(string_conversion_table_output_flag, str, (uint32_t*) to_value);
+    return string_convert_str_to_num(&string_index_output_flag, str, (uint32_t*) to_value);
 }
 
 char *pa_list_string_flags(audio_output_flags_t flags) {
@@ -203,40 +385,35 @@ char *pa_list_string_flags(audio_output_flags_t flags) {
 bool pa_input_device_default_audio_source(audio_devices_t input_device, audio_source_t *default_source)
 {
     /* Note converting HAL values to different HAL values! */
-    for (unsigned int i = 0; i < sizeof(conversion_table_default_audio_source) / (sizeof(uint32_t) * 2); i++) {
-        if (conversion_table_default_audio_source[i][0] == input_device) {
-            *default_source = conversion_table_default_audio_source[i][1];
-            return true;
-        }
-    }
-    return false;
+    return value_index_find(&value_index_default_audio_source, input_device, 0, (uint32_t *) default_source);
 }
 
 
 bool pa_droid_output_port_name(audio_devices_t value, const char **to_str) {
-    return string_convert_num_to_str(string_conversion_table_output_device_fancy, (uint32_t) value, to_str);
+    return string_convert_num_to_str(&string_index_output_device_fancy, (uint32_t) value, to_str);
 }
 
 bool pa_droid_output_port_name_to_device(const char *str, audio_devices_t *to_value) {
-    return string_convert_str_to_num(string_conversion_table_output_device_fancy, str, to_value);
+    return string_convert_str_to_num(&string_index_output_device_fancy, str, to_value);
 }
 
 bool pa_droid_input_port_name(audio_devices_t value, const char **to_str) {
-    return string_convert_num_to_str(string_conversion_table_input_device_fancy, (uint32_t) value, to_str);
+    return string_convert_num_to_str(&string_index_input_device_fancy, (uint32_t) value, to_str);
 }
 
 bool pa_droid_input_port_name_to_device(const char *str, audio_devices_t *to_value) {
-    return string_convert_str_to_num(string_conversion_table_input_device_fancy, str, to_value);
+    return string_convert_str_to_num(&string_index_input_device_fancy, str, to_value);
 }
 
-static int parse_list(const struct string_conversion *table,
+static int parse_list(struct string_index *table,
                       const char *separator,
                       const char *str,
                       uint32_t *dst,
                       char **unknown_entries) {
     int count = 0;
-    char *entry;
-    char *unknown = NULL;
+    const char *entry;
+    size_t len;
+    pa_strbuf *unknown = NULL;
     const char *state = NULL;
 
     pa_assert(table);
@@ -248,27 +425,26 @@ static int parse_list(const struct string_conversion *table,
     *dst = 0;
     *unknown_entries = NULL;
 
-    while ((entry = pa_split(str, separator, &state))) {
+    while ((entry = pa_split_in_place(str, separator, &len, &state))) {
         uint32_t d = 0;
 
-        if (!string_convert_str_to_num(table, entry, &d)) {
-            if (*unknown_entries) {
-                unknown = pa_sprintf_malloc("%s|%s", *unknown_entries, entry);
-                pa_xfree(*unknown_entries);
-                pa_xfree(entry);
-            } else
-                unknown = entry;
+        if (!string_convert_span_to_num(table, entry, len, &d)) {
+            if (unknown)
+                pa_strbuf_putc(unknown, '|');
+            else
+                unknown = pa_strbuf_new();
 
-            *unknown_entries = unknown;
+            pa_strbuf_putsn(unknown, entry, len);
             continue;
         }
 
         *dst |= d;
         count++;
-
-        pa_xfree(entry);
     }
 
+    if (unknown)
+        *unknown_entries = pa_strbuf_to_string_free(unknown);
+
     return count;
 }
 
@@ -276,25 +452,25 @@ int pa_conversion_parse_list(pa_conversion_string_t type, const char *separator,
                              const char *str, uint32_t *dst, char **unknown_entries) {
     switch (type) {
         case CONV_STRING_FORMAT:
-            return parse_list(string_conversion_table_format, separator, str, dst, unknown_entries);
+            return parse_list(&string_index_format, separator, str, dst, unknown_entries);
 
         case CONV_STRING_OUTPUT_CHANNELS:
-            return parse_list(string_conversion_table_output_channels, separator, str, dst, unknown_entries);
+            return parse_list(&string_index_output_channels, separator, str, dst, unknown_entries);
 
         case CONV_STRING_INPUT_CHANNELS:
-            return parse_list(string_conversion_table_input_channels, separator, str, dst, unknown_entries);
+            return parse_list(&string_index_input_channels, separator, str, dst, unknown_entries);
 
         case CONV_STRING_OUTPUT_DEVICE:
-            return parse_list(string_conversion_table_output_device, separator, str, dst, unknown_entries);
+            return parse_list(&string_index_output_device, separator, str, dst, unknown_entries);
 
         case CONV_STRING_INPUT_DEVICE:
-            return parse_list(string_conversion_table_input_device, separator, str, dst, unknown_entries);
+            return parse_list(&string_index_input_device, separator, str, dst, unknown_entries);
 
         case CONV_STRING_OUTPUT_FLAG:
-            return parse_list(string_conversion_table_output_flag, separator, str, dst, unknown_entries);
+            return parse_list(&string_index_output_flag, separator, str, dst, unknown_entries);
 
         case CONV_STRING_INPUT_FLAG:
-            return parse_list(string_conversion_table_input_flag, separator, str, dst, unknown_entries);
+            return parse_list(&string_index_input_flag, separator, str, dst, unknown_entries);
 
         /* Not handled in this context */
         case CONV_STRING_AUDIO_SOURCE_FANCY:
@@ -311,35 +487,39 @@ bool pa_conversion_parse_sampling_rates(const char *fn, const unsigned ln,
     pa_assert(fn);
     pa_assert(str);
 
-    char *entry;
+    const char *entry;
+    size_t len;
     const char *state = NULL;
 
     uint32_t pos = 0;
-    while ((entry = pa_split(str, VALUE_SEPARATOR, &state))) {
+    while ((entry = pa_split_in_place(str, VALUE_SEPARATOR, &len, &state))) {
+        char value[16];
         int32_t val;
 
-        if (pos == 0 && pa_streq(entry, "dynamic")) {
+        if (pos == 0 && len == strlen("dynamic") && pa_strneq(entry, "dynamic", len)) {
             sampling_rates[pos++] = (uint32_t) -1;
-            pa_xfree(entry);
             break;
         }
 
         if (pos == AUDIO_MAX_SAMPLING_RATES) {
             pa_log("[%s:%u] Too many sample rate entries (> %d)", fn, ln, AUDIO_MAX_SAMPLING_RATES);
-            pa_xfree(entry);
             return false;
         }
 
-        if (pa_atoi(entry, &val) < 0) {
-            pa_log("[%s:%u] Bad sample rate value %s", fn, ln, entry);
-            pa_xfree(entry);
+        if (len >= sizeof(value)) {
+            pa_log("[%s:%u] Bad sample rate value %.*s", fn, ln, (int) len, entry);
             return false;
         }
 
-        sampling_rates[pos++] = val;
+        memcpy(value, entry, len);
+        value[len] = '\0';
 
-        pa_xfree(entry);
+        if (pa_atoi(value, &val) < 0) {
+            pa_log("[%s:%u] Bad sample rate value %s", fn, ln, value);
+            return false;
+        }
 
+        sampling_rates[pos++] = val;
     }
 
     sampling_rates[pos] = 0;
@@ -402,7 +582,8 @@ static int parse_channels(const char *fn, const unsigned ln,
     bool success;
     int count = 0;
     char *unknown = NULL;
-    char *entry;
+    const char *entry;
+    size_t len;
     const char *state = NULL;
 
     pa_assert(fn);
@@ -414,27 +595,23 @@ static int parse_channels(const char *fn, const unsigned ln,
         return 1;
     }
 
-    while ((entry = pa_split(str, VALUE_SEPARATOR, &state))) {
+    while ((entry = pa_split_in_place(str, VALUE_SEPARATOR, &len, &state))) {
         uint32_t val;
 
         if (count == AUDIO_MAX_CHANNEL_MASKS) {
             pa_log("[%s:%u] Too many channel mask entries (> %d)", fn, ln, AUDIO_MAX_CHANNEL_MASKS);
-            pa_xfree(entry);
             return false;
         }
 
-        if (!string_convert_str_to_num(in_output ? string_conversion_table_output_channels
-                                                 : string_conversion_table_input_channels,
-                                       entry,
-                                       &val)) {
-            pa_log_debug("[%s:%u] Ignore unknown channel mask value %s", fn, ln, entry);
-            pa_xfree(entry);
+        if (!string_convert_span_to_num(in_output ? &string_index_output_channels
+                                                  : &string_index_input_channels,
+                                        entry, len,
+                                        &val)) {
+            pa_log_debug("[%s:%u] Ignore unknown channel mask value %.*s", fn, ln, (int) len, entry);
             continue;
         }
 
         channel_masks[count++] = val;
-
-        pa_xfree(entry);
     }
 
     channel_masks[count] = 0;
@@ -33,10 +33,15 @@
 #include <string.h>
 #include <strings.h>
 
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
 #ifdef HAVE_VALGRIND_MEMCHECK_H
 #include <valgrind/memcheck.h>
 #endif
 
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
@@ -51,6 +56,48 @@
 #define SYSTEM_AUDIO_POLICY_CONFIG_XML_FILE         "/system/etc/audio_policy_configuration.xml"
 
 
+/* Heap in use including mmapped chunks. This is process wide, so other
+ * threads allocating at the same time show up in the difference as well. */
+static bool heap_in_use(size_t *bytes) {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+
+    *bytes = mi.uordblks + mi.hblkhd;
+    return true;
+#else
+    *bytes = 0;
+    return false;
+#endif
+}
+
+static void config_log_summary(dm_config_device *config, pa_usec_t elapsed, bool have_heap, size_t heap_before) {
+    dm_config_module *module;
+    dm_config_port *port;
+    size_t mix_ports = 0, device_ports = 0, routes = 0, profiles = 0;
+    size_t heap_after;
+    void *state, *state2;
+
+    DM_LIST_FOREACH_DATA(module, config->modules, state) {
+        mix_ports += dm_list_size(module->mix_ports);
+        device_ports += dm_list_size(module->device_ports);
+        routes += dm_list_size(module->routes);
+
+        DM_LIST_FOREACH_DATA(port, module->ports, state2)
+            profiles += dm_list_size(port->profiles);
+    }
+
+    if (have_heap && heap_in_use(&heap_after))
+        pa_log_info("Loaded %s in %llu us: %zd modules, %zu mix ports, %zu device ports, %zu routes, %zu profiles, "
+                    "about %zu bytes of heap.",
+                    config->filename, (unsigned long long) elapsed, dm_list_size(config->modules),
+                    mix_ports, device_ports, routes, profiles,
+                    heap_after > heap_before ? heap_after - heap_before : 0);
+    else
+        pa_log_info("Loaded %s in %llu us: %zd modules, %zu mix ports, %zu device ports, %zu routes, %zu profiles.",
+                    config->filename, (unsigned long long) elapsed, dm_list_size(config->modules),
+                    mix_ports, device_ports, routes, profiles);
+}
+
 dm_config_device *dm_config_load(pa_modargs *ma) {
     dm_config_device *config = NULL;
     const char *manual_config;
@@ -60,9 +107,15 @@ dm_config_device *dm_config_load(pa_modargs *ma) {
         VENDOR_AUDIO_POLICY_CONFIG_XML_FILE,
         SYSTEM_AUDIO_POLICY_CONFIG_XML_FILE,
         NULL};
+    pa_usec_t begin;
+    size_t heap_before;
+    bool have_heap;
 
     pa_assert(ma);
 
+    begin = pa_rtclock_now();
+    have_heap = heap_in_use(&heap_before);
+
     if ((manual_config = pa_modargs_get_value(ma, "config", NULL))) {
         if (!(config = pa_parse_droid_audio_config(manual_config)))
             pa_log("Failed to parse configuration from %s", manual_config);
@@ -79,6 +132,8 @@ dm_config_device *dm_config_load(pa_modargs *ma) {
 
     if (!config)
         pa_log("Failed to parse any configuration.");
+    else
+        config_log_summary(config, pa_rtclock_now() - begin, have_heap, heap_before);
 
     return config;
 }
@@ -203,6 +258,7 @@ dm_config_device *dm_config_dup(const dm_config_device *config) {
     pa_assert(config);
 
     copy = pa_xnew0(dm_config_device, 1);
+    copy->filename = pa_xstrdup(config->filename);
     copy->global_config = dm_list_new();
     copy->modules = dm_list_new();
 
@@ -224,7 +280,12 @@ dm_config_device *dm_config_dup(const dm_config_device *config) {
 }
 
 dm_config_device *pa_parse_droid_audio_config(const char *filename) {
-    return pa_parse_droid_audio_config_xml(filename);
+    dm_config_device *config;
+
+    if ((config = pa_parse_droid_audio_config_xml(filename)))
+        config->filename = pa_xstrdup(filename);
+
+    return config;
 }
 
 static void config_global_free(void *data) {
@@ -267,6 +328,8 @@ static void config_module_free(void *data) {
     dm_list_free(module->device_ports, NULL);
     dm_list_free(module->mix_ports, NULL);
     dm_list_free(module->routes, config_route_free);
+    if (module->removed_ports)
+        dm_list_free(module->removed_ports, config_port_free);
     pa_xfree(module);
 }
 
@@ -276,6 +339,7 @@ void dm_config_free(dm_config_device *config) {
 
     dm_list_free(config->global_config, config_global_free);
     dm_list_free(config->modules, config_module_free);
+    pa_xfree(config->filename);
     pa_xfree(config);
 }
 
@@ -364,3 +428,203 @@ dm_config_port *dm_config_find_mix_port(dm_config_module *module, const char *na
 
     return NULL;
 }
+
+static bool config_profiles_equal(dm_list *a, dm_list *b) {
+    dm_list_entry *i, *j;
+
+    if (dm_list_size(a) != dm_list_size(b))
+        return false;
+
+    for (i = a->head, j = b->head; i && j; i = i->next, j = j->next) {
+        const dm_config_profile *pa = i->data;
+        const dm_config_profile *pb = j->data;
+
+        if (!pa_safe_streq(pa->name, pb->name) ||
+            pa->format != pb->format ||
+            memcmp(pa->sampling_rates, pb->sampling_rates, sizeof(pa->sampling_rates)) ||
+            memcmp(pa->channel_masks, pb->channel_masks, sizeof(pa->channel_masks)))
+            return false;
+    }
+
+    return true;
+}
+
+/* Ports are the same port if name, role and port type match. */
+static dm_config_port *config_find_same_port(dm_list *ports, const dm_config_port *port) {
+    dm_config_port *p;
+    void *state;
+
+    DM_LIST_FOREACH_DATA(p, ports, state) {
+        if (p->port_type == port->port_type && p->role == port->role && pa_streq(p->name, port->name))
+            return p;
+    }
+
+    return NULL;
+}
+
+static bool config_port_update(dm_config_port *port, const dm_config_port *update) {
+    const dm_list_entry *i;
+    bool changed = false;
+
+    if (!config_profiles_equal(port->profiles, update->profiles)) {
+        dm_list_free(port->profiles, config_profile_free);
+        port->profiles = dm_list_new();
+        DM_LIST_FOREACH(i, update->profiles)
+            dm_list_push_back(port->profiles, config_profile_dup(i->data));
+        changed = true;
+    }
+
+    if (port->port_type == DM_CONFIG_TYPE_DEVICE_PORT &&
+        (port->type != update->type || !pa_safe_streq(port->address, update->address))) {
+        port->type = update->type;
+        pa_xfree(port->address);
+        port->address = pa_xstrdup(update->address);
+        changed = true;
+    }
+
+    if (port->port_type == DM_CONFIG_TYPE_MIX_PORT &&
+        (port->flags != update->flags ||
+         port->max_open_count != update->max_open_count ||
+         port->max_active_count != update->max_active_count)) {
+        port->flags = update->flags;
+        port->max_open_count = update->max_open_count;
+        port->max_active_count = update->max_active_count;
+        changed = true;
+    }
+
+    return changed;
+}
+
+static void config_list_remove_data(dm_list *list, void *data) {
+    dm_list_entry *i;
+
+    DM_LIST_FOREACH(i, list) {
+        if (i->data == data) {
+            dm_list_remove(list, i);
+            return;
+        }
+    }
+}
+
+static bool config_lists_equal(dm_list *a, dm_list *b) {
+    dm_list_entry *i, *j;
+
+    if (dm_list_size(a) != dm_list_size(b))
+        return false;
+
+    for (i = a->head, j = b->head; i && j; i = i->next, j = j->next) {
+        if (i->data != j->data)
+            return false;
+    }
+
+    return true;
+}
+
+static bool config_routes_equal(dm_list *a, dm_list *b) {
+    dm_list_entry *i, *j;
+
+    if (dm_list_size(a) != dm_list_size(b))
+        return false;
+
+    for (i = a->head, j = b->head; i && j; i = i->next, j = j->next) {
+        const dm_config_route *ra = i->data;
+        const dm_config_route *rb = j->data;
+
+        if (ra->type != rb->type || ra->sink != rb->sink || !config_lists_equal(ra->sources, rb->sources))
+            return false;
+    }
+
+    return true;
+}
+
+bool dm_config_module_update(dm_config_module *module, const dm_config_module *update) {
+    dm_config_port *port, *existing;
+    dm_config_route *route;
+    dm_list *list;
+    void *state;
+    bool changed = false;
+
+    pa_assert(module);
+    pa_assert(update);
+
+    /* Ports removed from configuration. */
+    list = dm_list_new();
+    DM_LIST_FOREACH_DATA(port, module->ports, state) {
+        if (!config_find_same_port(update->ports, port))
+            dm_list_push_back(list, port);
+    }
+
+    while ((port = dm_list_steal_first(list))) {
+        pa_log_info("Config update: port \"%s\" removed.", port->name);
+        config_list_remove_data(module->ports, port);
+        config_list_remove_data(module->mix_ports, port);
+        config_list_remove_data(module->device_ports, port);
+        config_list_remove_data(module->attached_devices, port);
+        if (module->default_output_device == port)
+            module->default_output_device = NULL;
+        if (!module->removed_ports)
+            module->removed_ports = dm_list_new();
+        dm_list_push_back(module->removed_ports, port);
+        changed = true;
+    }
+    dm_list_free(list, NULL);
+
+    /* Changed and new ports. */
+    DM_LIST_FOREACH_DATA(port, update->ports, state) {
+        if ((existing = config_find_same_port(module->ports, port))) {
+            if (config_port_update(existing, port)) {
+                pa_log_info("Config update: port \"%s\" changed.", port->name);
+                changed = true;
+            }
+        } else {
+            existing = config_port_dup(port, module);
+            dm_list_push_back(module->ports, existing);
+            if (existing->port_type == DM_CONFIG_TYPE_MIX_PORT)
+                dm_list_push_back(module->mix_ports, existing);
+            else
+                dm_list_push_back(module->device_ports, existing);
+            pa_log_info("Config update: port \"%s\" added.", port->name);
+            changed = true;
+        }
+    }
+
+    /* Attached and default output devices. */
+    list = dm_list_new();
+    DM_LIST_FOREACH_DATA(port, update->attached_devices, state) {
+        if ((existing = config_find_same_port(module->device_ports, port)))
+            dm_list_push_back(list, existing);
+    }
+
+    if (config_lists_equal(module->attached_devices, list))
+        dm_list_free(list, NULL);
+    else {
+        pa_log_info("Config update: attached devices changed.");
+        dm_list_free(module->attached_devices, NULL);
+        module->attached_devices = list;
+        changed = true;
+    }
+
+    existing = update->default_output_device ? config_find_same_port(module->device_ports, update->default_output_device)
+                                             : NULL;
+    if (module->default_output_device != existing) {
+        pa_log_info("Config update: default output device changed to \"%s\".", existing ? existing->name : "<none>");
+        module->default_output_device = existing;
+        changed = true;
+    }
+
+    /* Routes, rebuilt against our own port objects. */
+    list = dm_list_new();
+    DM_LIST_FOREACH_DATA(route, update->routes, state)
+        dm_list_push_back(list, config_route_dup(route, module->ports));
+
+    if (config_routes_equal(module->routes, list))
+        dm_list_free(list, config_route_free);
+    else {
+        pa_log_info("Config update: routes changed.");
+        dm_list_free(module->routes, config_route_free);
+        module->routes = list;
+        changed = true;
+    }
+
+    return changed;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "droid-file-watch.h"
+
+#define WATCH_EVENT_MASK        (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct dm_file_watch {
+    pa_core *core;
+    char *directory;
+    char *name;
+    pa_usec_t settle_time;
+
+    int fd;
+    pa_io_event *io_event;
+    pa_time_event *settle_event;
+
+    dm_file_watch_cb_t cb;
+    void *userdata;
+};
+
+static void settle_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    dm_file_watch *watch = userdata;
+
+    pa_assert(watch);
+
+    watch->core->mainloop->time_restart(e, NULL);
+    watch->cb(watch, watch->userdata);
+}
+
+static void changed(dm_file_watch *watch) {
+    if (watch->settle_time == 0) {
+        watch->cb(watch, watch->userdata);
+        return;
+    }
+
+    if (watch->settle_event)
+        pa_core_rttime_restart(watch->core, watch->settle_event, pa_rtclock_now() + watch->settle_time);
+    else
+        watch->settle_event = pa_core_rttime_new(watch->core, pa_rtclock_now() + watch->settle_time,
+                                                 settle_cb, watch);
+}
+
+static void inotify_cb(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    dm_file_watch *watch = userdata;
+    bool matched = false;
+    union {
+        struct inotify_event event;
+        uint8_t raw[sizeof(struct inotify_event) + NAME_MAX + 1];
+    } buf;
+
+    pa_assert(watch);
+
+    for (;;) {
+        ssize_t r;
+        size_t offset = 0;
+
+        if ((r = pa_read(fd, &buf, sizeof(buf), NULL)) <= 0) {
+            if (r < 0 && errno == EAGAIN)
+                break;
+
+            pa_log_warn("Failed to read inotify events for %s: %s", watch->directory,
+                        r < 0 ? pa_cstrerror(errno) : "EOF");
+            a->io_free(watch->io_event);
+            watch->io_event = NULL;
+            break;
+        }
+
+        while (offset + sizeof(struct inotify_event) <= (size_t) r) {
+            struct inotify_event *event = (struct inotify_event *) &buf.raw[offset];
+
+            if (event->len > 0 && (!watch->name || pa_streq(watch->name, event->name)))
+                matched = true;
+
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (matched)
+        changed(watch);
+}
+
+dm_file_watch *dm_file_watch_new(pa_core *core,
+                                 const char *directory,
+                                 const char *name,
+                                 pa_usec_t settle_time,
+                                 dm_file_watch_cb_t cb,
+                                 void *userdata) {
+    dm_file_watch *watch;
+    int fd;
+
+    pa_assert(core);
+    pa_assert(directory);
+    pa_assert(cb);
+
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        pa_log("inotify_init1() failed: %s", pa_cstrerror(errno));
+        return NULL;
+    }
+
+    if (inotify_add_watch(fd, directory, WATCH_EVENT_MASK) < 0) {
+        pa_log("Failed to watch %s: %s", directory, pa_cstrerror(errno));
+        pa_close(fd);
+        return NULL;
+    }
+
+    watch = pa_xnew0(dm_file_watch, 1);
+    watch->core = core;
+    watch->directory = pa_xstrdup(directory);
+    watch->name = pa_xstrdup(name);
+    watch->settle_time = settle_time;
+    watch->fd = fd;
+    watch->cb = cb;
+    watch->userdata = userdata;
+    watch->io_event = core->mainloop->io_new(core->mainloop, fd, PA_IO_EVENT_INPUT, inotify_cb, watch);
+
+    pa_log_debug("Watching %s/%s for changes.", directory, name ? name : "*");
+
+    return watch;
+}
+
+void dm_file_watch_free(dm_file_watch *watch) {
+    pa_assert(watch);
+
+    if (watch->settle_event)
+        watch->core->mainloop->time_free(watch->settle_event);
+
+    if (watch->io_event)
+        watch->core->mainloop->io_free(watch->io_event);
+
+    pa_close(watch->fd);
+    pa_xfree(watch->directory);
+    pa_xfree(watch->name);
+    pa_xfree(watch);
+}
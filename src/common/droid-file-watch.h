@@ -0,0 +1,48 @@
+#ifndef foodroidfilewatchfoo
+#define foodroidfilewatchfoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/core.h>
+
+/* Watch a directory with inotify for files being written or moved into
+ * place. If name is NULL changes to any file in the directory are reported,
+ * otherwise only changes to the named file. Callback is called from the main
+ * loop once no new events have been seen for settle_time. */
+
+typedef struct dm_file_watch dm_file_watch;
+typedef void (*dm_file_watch_cb_t)(dm_file_watch *watch, void *userdata);
+
+dm_file_watch *dm_file_watch_new(pa_core *core,
+                                 const char *directory,
+                                 const char *name,
+                                 pa_usec_t settle_time,
+                                 dm_file_watch_cb_t cb,
+                                 void *userdata);
+void dm_file_watch_free(dm_file_watch *watch);
+
+#endif
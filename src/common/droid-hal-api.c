@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/strbuf.h>
+
+#include "droid/droid-util.h"
+#include "droid/droid-parameters.h"
+#include "droid/sllist.h"
+#include "droid/droid-hal-api.h"
+
+enum request_type {
+    REQUEST_SET,
+    REQUEST_GET,
+};
+
+struct request {
+    enum request_type type;
+    pa_droid_parameters *parameters; /* pairs to set, or keys to get with empty values */
+    dm_hal_api_cb_t cb;
+    void *userdata;
+};
+
+struct subscription {
+    pa_droid_parameters *keys; /* NULL for all keys */
+    dm_hal_api_cb_t cb;
+    void *userdata;
+    bool dead;
+};
+
+struct dm_hal_api {
+    pa_droid_hw_module *hw;
+    pa_defer_event *defer;
+    dm_list *requests;
+    dm_list *subscriptions;
+    pa_droid_parameters *changes;
+};
+
+static void request_free(struct request *r) {
+    pa_droid_parameters_free(r->parameters);
+    pa_xfree(r);
+}
+
+static void subscription_free(struct subscription *s) {
+    if (s->keys)
+        pa_droid_parameters_free(s->keys);
+    pa_xfree(s);
+}
+
+static pa_droid_parameters *parse_keys(const char *keys) {
+    pa_droid_parameters *p;
+    const char *state = NULL;
+    char *key;
+
+    p = pa_droid_parameters_new();
+
+    while ((key = pa_split(keys, ";", &state))) {
+        if (*key)
+            pa_droid_parameters_set(p, key, "");
+        pa_xfree(key);
+    }
+
+    return p;
+}
+
+static void complete(dm_hal_api *api, struct request *r, int result, const pa_droid_parameters *p) {
+    char *str;
+
+    str = p ? pa_droid_parameters_to_string(p) : NULL;
+    r->cb(api->hw, result, str, r->userdata);
+    pa_xfree(str);
+}
+
+/* Set all pairs of consecutive set requests with one HAL call. */
+static void process_set(dm_hal_api *api, struct request **batch, unsigned n) {
+    pa_droid_parameters *merged;
+    unsigned i;
+    int ret;
+
+    merged = pa_droid_parameters_new();
+    for (i = 0; i < n; i++)
+        pa_droid_parameters_merge(merged, batch[i]->parameters);
+
+    ret = pa_droid_hw_set_parameters(api->hw, merged);
+    pa_droid_parameters_free(merged);
+
+    for (i = 0; i < n; i++) {
+        if (batch[i]->cb)
+            complete(api, batch[i], ret, batch[i]->parameters);
+    }
+}
+
+/* Get keys of consecutive get requests with one HAL call. */
+static void process_get(dm_hal_api *api, struct request **batch, unsigned n) {
+    pa_droid_parameters *keys;
+    pa_droid_parameters *values = NULL;
+    pa_droid_parameters *result;
+    const char *key, *value;
+    pa_strbuf *buf;
+    char *str = NULL;
+    void *state;
+    unsigned i;
+
+    keys = pa_droid_parameters_new();
+    for (i = 0; i < n; i++)
+        pa_droid_parameters_merge(keys, batch[i]->parameters);
+
+    buf = pa_strbuf_new();
+    state = NULL;
+    while (pa_droid_parameters_iterate(keys, &state, &key, NULL)) {
+        if (!pa_strbuf_isempty(buf))
+            pa_strbuf_putc(buf, ';');
+        pa_strbuf_puts(buf, key);
+    }
+    pa_droid_parameters_free(keys);
+
+    if (!pa_strbuf_isempty(buf))
+        str = pa_strbuf_to_string(buf);
+    pa_strbuf_free(buf);
+
+    if (str) {
+        char *reply;
+
+        if ((reply = pa_droid_get_parameters(api->hw, str))) {
+            values = pa_droid_parameters_from_string(reply);
+            pa_xfree(reply);
+        }
+        pa_xfree(str);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (!values) {
+            complete(api, batch[i], -1, NULL);
+            continue;
+        }
+
+        result = pa_droid_parameters_new();
+        state = NULL;
+        while (pa_droid_parameters_iterate(batch[i]->parameters, &state, &key, NULL)) {
+            if ((value = pa_droid_parameters_get(values, key)))
+                pa_droid_parameters_set(result, key, value);
+        }
+        complete(api, batch[i], 0, result);
+        pa_droid_parameters_free(result);
+    }
+
+    if (values)
+        pa_droid_parameters_free(values);
+}
+
+static void process_requests(dm_hal_api *api) {
+    struct request *batch[16];
+    struct request *r;
+    unsigned n = 0;
+    unsigned i;
+    dm_list *requests;
+
+    /* Callbacks may make new requests, those are processed on next iteration. */
+    requests = api->requests;
+    api->requests = dm_list_new();
+
+    while ((r = dm_list_steal_first(requests)) || n > 0) {
+        bool flush;
+
+        flush = !r || n == PA_ELEMENTSOF(batch) || batch[0]->type != r->type;
+
+        /* Sets with same keys can't be merged to one call. */
+        if (!flush && r->type == REQUEST_SET) {
+            for (i = 0; i < n && !flush; i++)
+                flush = pa_droid_parameters_intersect(r->parameters, batch[i]->parameters);
+        }
+
+        if (n > 0 && flush) {
+            if (batch[0]->type == REQUEST_SET)
+                process_set(api, batch, n);
+            else
+                process_get(api, batch, n);
+
+            for (i = 0; i < n; i++)
+                request_free(batch[i]);
+            n = 0;
+        }
+
+        if (!r)
+            break;
+
+        batch[n++] = r;
+    }
+
+    dm_list_free(requests, NULL);
+}
+
+static void process_changes(dm_hal_api *api) {
+    struct subscription *s;
+    pa_droid_parameters *changes;
+    pa_droid_parameters *matched;
+    const char *key, *value;
+    void *state, *key_state;
+
+    if (!(changes = api->changes))
+        return;
+
+    api->changes = NULL;
+
+    DM_LIST_FOREACH_DATA(s, api->subscriptions, state) {
+        if (s->dead)
+            continue;
+
+        if (!s->keys) {
+            char *str = pa_droid_parameters_to_string(changes);
+            s->cb(api->hw, 0, str, s->userdata);
+            pa_xfree(str);
+            continue;
+        }
+
+        matched = pa_droid_parameters_new();
+        key_state = NULL;
+        while (pa_droid_parameters_iterate(changes, &key_state, &key, &value)) {
+            if (pa_droid_parameters_get(s->keys, key))
+                pa_droid_parameters_set(matched, key, value);
+        }
+
+        if (pa_droid_parameters_size(matched) > 0) {
+            char *str = pa_droid_parameters_to_string(matched);
+            s->cb(api->hw, 0, str, s->userdata);
+            pa_xfree(str);
+        }
+
+        pa_droid_parameters_free(matched);
+    }
+
+    pa_droid_parameters_free(changes);
+}
+
+static void remove_dead_subscriptions(dm_hal_api *api) {
+    dm_list_entry *i, *next;
+
+    for (i = api->subscriptions->head; i; i = next) {
+        struct subscription *s = i->data;
+
+        next = i->next;
+
+        if (s->dead) {
+            dm_list_remove(api->subscriptions, i);
+            subscription_free(s);
+        }
+    }
+}
+
+static void defer_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    dm_hal_api *api = userdata;
+
+    pa_assert(api);
+
+    m->defer_enable(e, 0);
+
+    process_requests(api);
+    process_changes(api);
+    remove_dead_subscriptions(api);
+}
+
+static void schedule(dm_hal_api *api) {
+    api->hw->core->mainloop->defer_enable(api->defer, 1);
+}
+
+static void add_changes(dm_hal_api *api, const pa_droid_parameters *p) {
+    if (dm_list_size(api->subscriptions) == 0)
+        return;
+
+    if (!api->changes)
+        api->changes = pa_droid_parameters_new();
+
+    pa_droid_parameters_merge(api->changes, p);
+    schedule(api);
+}
+
+static dm_hal_api *get_api(void *handle) {
+    pa_droid_hw_module *hw = handle;
+
+    pa_assert(hw);
+    pa_assert(hw->hal_api);
+    pa_assert_ctl_context();
+
+    return hw->hal_api;
+}
+
+static int set_parameters_v2_cb(void *handle, const char *key_value_pairs, dm_hal_api_cb_t cb, void *userdata) {
+    dm_hal_api *api = get_api(handle);
+    struct request *r;
+
+    pa_assert(key_value_pairs);
+
+    pa_log_debug(DROID_SET_PARAMETERS_V2 "(\"%s\")", key_value_pairs);
+
+    r = pa_xnew0(struct request, 1);
+    r->type = REQUEST_SET;
+    r->parameters = pa_droid_parameters_from_string(key_value_pairs);
+    r->cb = cb;
+    r->userdata = userdata;
+
+    if (pa_droid_parameters_size(r->parameters) == 0) {
+        request_free(r);
+        return -1;
+    }
+
+    dm_list_push_back(api->requests, r);
+    schedule(api);
+
+    return 0;
+}
+
+static int get_parameters_v2_cb(void *handle, const char *keys, dm_hal_api_cb_t cb, void *userdata) {
+    dm_hal_api *api = get_api(handle);
+    struct request *r;
+
+    pa_assert(keys);
+    pa_assert(cb);
+
+    pa_log_debug(DROID_GET_PARAMETERS_V2 "(\"%s\")", keys);
+
+    r = pa_xnew0(struct request, 1);
+    r->type = REQUEST_GET;
+    r->parameters = parse_keys(keys);
+    r->cb = cb;
+    r->userdata = userdata;
+
+    if (pa_droid_parameters_size(r->parameters) == 0) {
+        request_free(r);
+        return -1;
+    }
+
+    dm_list_push_back(api->requests, r);
+    schedule(api);
+
+    return 0;
+}
+
+/* keys may be NULL to subscribe to all changes. */
+static void *subscribe_v2_cb(void *handle, const char *keys, dm_hal_api_cb_t cb, void *userdata) {
+    dm_hal_api *api = get_api(handle);
+    struct subscription *s;
+
+    pa_assert(cb);
+
+    s = pa_xnew0(struct subscription, 1);
+    s->keys = keys ? parse_keys(keys) : NULL;
+    s->cb = cb;
+    s->userdata = userdata;
+
+    dm_list_push_back(api->subscriptions, s);
+
+    return s;
+}
+
+static void unsubscribe_v2_cb(void *handle, void *subscription) {
+    dm_hal_api *api = get_api(handle);
+    struct subscription *s = subscription;
+
+    pa_assert(s);
+
+    /* Subscription may be removed from its own callback, so only mark it
+     * here and remove from main loop. */
+    s->dead = true;
+    schedule(api);
+}
+
+dm_hal_api *dm_hal_api_new(pa_droid_hw_module *hw) {
+    dm_hal_api *api;
+
+    pa_assert(hw);
+
+    api = pa_xnew0(dm_hal_api, 1);
+    api->hw = hw;
+    api->requests = dm_list_new();
+    api->subscriptions = dm_list_new();
+    api->defer = hw->core->mainloop->defer_new(hw->core->mainloop, defer_cb, api);
+    hw->core->mainloop->defer_enable(api->defer, 0);
+
+    pa_shared_set(hw->core, DROID_SET_PARAMETERS_V2, set_parameters_v2_cb);
+    pa_shared_set(hw->core, DROID_GET_PARAMETERS_V2, get_parameters_v2_cb);
+    pa_shared_set(hw->core, DROID_SUBSCRIBE_V2, subscribe_v2_cb);
+    pa_shared_set(hw->core, DROID_UNSUBSCRIBE_V2, unsubscribe_v2_cb);
+
+    return api;
+}
+
+void dm_hal_api_free(dm_hal_api *api) {
+    struct request *r;
+
+    pa_assert(api);
+
+    pa_shared_remove(api->hw->core, DROID_SET_PARAMETERS_V2);
+    pa_shared_remove(api->hw->core, DROID_GET_PARAMETERS_V2);
+    pa_shared_remove(api->hw->core, DROID_SUBSCRIBE_V2);
+    pa_shared_remove(api->hw->core, DROID_UNSUBSCRIBE_V2);
+
+    while ((r = dm_list_steal_first(api->requests))) {
+        if (r->cb)
+            r->cb(api->hw, -1, NULL, r->userdata);
+        request_free(r);
+    }
+    dm_list_free(api->requests, NULL);
+
+    dm_list_free(api->subscriptions, (pa_free_cb_t) subscription_free);
+
+    if (api->changes)
+        pa_droid_parameters_free(api->changes);
+
+    api->hw->core->mainloop->defer_free(api->defer);
+
+    pa_xfree(api);
+}
+
+void dm_hal_api_notify(dm_hal_api *api, const char *key_value_pairs) {
+    pa_droid_parameters *p;
+
+    pa_assert(api);
+    pa_assert(key_value_pairs);
+
+    if (dm_list_size(api->subscriptions) == 0)
+        return;
+
+    p = pa_droid_parameters_from_string(key_value_pairs);
+    add_changes(api, p);
+    pa_droid_parameters_free(p);
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "droid/droid-hal-stats.h"
+
+static const char * const call_names[PA_DROID_HAL_CALL_MAX] = {
+    [PA_DROID_HAL_CALL_SET_PARAMETERS]          = "set_parameters",
+    [PA_DROID_HAL_CALL_GET_PARAMETERS]          = "get_parameters",
+    [PA_DROID_HAL_CALL_OPEN_OUTPUT_STREAM]      = "open_output_stream",
+    [PA_DROID_HAL_CALL_CLOSE_OUTPUT_STREAM]     = "close_output_stream",
+    [PA_DROID_HAL_CALL_OPEN_INPUT_STREAM]       = "open_input_stream",
+    [PA_DROID_HAL_CALL_CLOSE_INPUT_STREAM]      = "close_input_stream",
+    [PA_DROID_HAL_CALL_CREATE_AUDIO_PATCH]      = "create_audio_patch",
+    [PA_DROID_HAL_CALL_RELEASE_AUDIO_PATCH]     = "release_audio_patch",
+    [PA_DROID_HAL_CALL_SET_MODE]                = "set_mode",
+    [PA_DROID_HAL_CALL_SET_VOICE_VOLUME]        = "set_voice_volume",
+    [PA_DROID_HAL_CALL_SET_MIC_MUTE]            = "set_mic_mute",
+    [PA_DROID_HAL_CALL_GET_MIC_MUTE]            = "get_mic_mute",
+    [PA_DROID_HAL_CALL_WRITE]                   = "write",
+    [PA_DROID_HAL_CALL_READ]                    = "read",
+    [PA_DROID_HAL_CALL_STANDBY]                 = "standby",
+    [PA_DROID_HAL_CALL_GET_LATENCY]             = "get_latency",
+    [PA_DROID_HAL_CALL_SET_VOLUME]              = "set_volume",
+    [PA_DROID_HAL_CALL_STREAM_SET_PARAMETERS]   = "stream_set_parameters",
+};
+
+pa_droid_hal_stats *pa_droid_hal_stats_new(void) {
+    return pa_xnew0(pa_droid_hal_stats, 1);
+}
+
+void pa_droid_hal_stats_free(pa_droid_hal_stats *stats) {
+    pa_assert(stats);
+
+    pa_xfree(stats);
+}
+
+void pa_droid_hal_stats_reset(pa_droid_hal_stats *stats) {
+    pa_assert(stats);
+
+    memset(stats, 0, sizeof(*stats));
+}
+
+void pa_droid_hal_stats_merge(pa_droid_hal_stats *dst, const pa_droid_hal_stats *src) {
+    unsigned i, b;
+
+    pa_assert(dst);
+    pa_assert(src);
+
+    for (i = 0; i < PA_DROID_HAL_CALL_MAX; i++) {
+        pa_droid_hal_stat *d = &dst->calls[i];
+        const pa_droid_hal_stat *s = &src->calls[i];
+
+        d->count += s->count;
+        d->total_usec += s->total_usec;
+        if (s->max_usec > d->max_usec)
+            d->max_usec = s->max_usec;
+        for (b = 0; b < PA_DROID_HAL_STATS_BUCKETS; b++)
+            d->buckets[b] += s->buckets[b];
+    }
+}
+
+/* {"write":{"count":N,"total_usec":N,"max_usec":N,"histogram":[N,...]},...}
+ * Histogram is trimmed after the last non-empty bucket. */
+void pa_droid_hal_stats_to_json(const pa_droid_hal_stats *stats, pa_strbuf *buf) {
+    bool first = true;
+    unsigned i, b, last;
+
+    pa_assert(stats);
+    pa_assert(buf);
+
+    pa_strbuf_putc(buf, '{');
+
+    for (i = 0; i < PA_DROID_HAL_CALL_MAX; i++) {
+        const pa_droid_hal_stat *s = &stats->calls[i];
+
+        if (!s->count)
+            continue;
+
+        for (last = PA_DROID_HAL_STATS_BUCKETS - 1; last > 0 && !s->buckets[last]; last--);
+
+        pa_strbuf_printf(buf, "%s\"%s\":{\"count\":%llu,\"total_usec\":%llu,\"max_usec\":%llu,\"histogram\":[",
+                         first ? "" : ",",
+                         call_names[i],
+                         (unsigned long long) s->count,
+                         (unsigned long long) s->total_usec,
+                         (unsigned long long) s->max_usec);
+
+        for (b = 0; b <= last; b++)
+            pa_strbuf_printf(buf, "%s%llu", b ? "," : "", (unsigned long long) s->buckets[b]);
+
+        pa_strbuf_puts(buf, "]}");
+        first = false;
+    }
+
+    pa_strbuf_putc(buf, '}');
+}
+
+const char *pa_droid_hal_call_to_string(pa_droid_hal_call_t call) {
+    pa_assert(call < PA_DROID_HAL_CALL_MAX);
+
+    return call_names[call];
+}
@@ -0,0 +1,567 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/modargs.h>
+#include <pulsecore/mutex.h>
+
+#include "droid/droid-parameters.h"
+#include "droid-mock-hal.h"
+
+#define MOCK_DEFAULT_SAMPLE_RATE    (48000)
+#define MOCK_DEFAULT_PERIOD_MS      (20)
+#define MOCK_DEFAULT_STALL_MS       (100)
+
+static const char* const valid_settings[] = {
+    "period_ms",
+    "open_delay_ms",
+    "patch_delay_ms",
+    "mode_delay_ms",
+    "input_rate",
+    "short_write_every",
+    "error_every",
+    "stall_every",
+    "stall_ms",
+    NULL
+};
+
+struct mock_settings {
+    uint32_t period_ms;
+    uint32_t open_delay_ms;
+    uint32_t patch_delay_ms;
+    uint32_t mode_delay_ms;
+    uint32_t input_rate;
+    uint32_t short_write_every;
+    uint32_t error_every;
+    uint32_t stall_every;
+    uint32_t stall_ms;
+};
+
+struct mock_module {
+    struct hw_module_t module;          /* must be first */
+    struct hw_module_methods_t methods;
+    char *name;
+    struct mock_settings settings;
+};
+
+struct mock_device {
+    audio_hw_device_t device;           /* must be first */
+    struct mock_module *module;
+    pa_mutex *mutex;
+    pa_droid_parameters *parameters;
+    audio_mode_t mode;
+    bool mic_mute;
+    audio_patch_handle_t next_patch;
+};
+
+struct mock_stream {
+    union {
+        struct audio_stream_out out;    /* must be first */
+        struct audio_stream_in in;
+    };
+    struct mock_device *device;
+    bool output;
+    struct audio_config config;
+    size_t frame_size;
+    size_t buffer_size;
+    pa_usec_t next;                     /* when the next buffer is due, 0 in standby */
+    uint64_t io_count;
+    pa_droid_parameters *parameters;
+};
+
+static void mock_sleep(pa_usec_t until) {
+    pa_usec_t now = pa_rtclock_now();
+
+    if (until > now)
+        usleep(until - now);
+}
+
+static void mock_delay(uint32_t ms) {
+    if (ms > 0)
+        usleep(ms * PA_USEC_PER_MSEC);
+}
+
+/* Returns parameters for keys from values as newly allocated string, which
+ * HAL clients free with free(). */
+static char *mock_get_parameters(pa_droid_parameters *values, const char *keys) {
+    pa_droid_parameters *result;
+    const char *state = NULL;
+    char *key, *s, *ret;
+
+    result = pa_droid_parameters_new();
+
+    while ((key = pa_split(keys, ";", &state))) {
+        const char *value;
+
+        if ((value = pa_droid_parameters_get(values, key)))
+            pa_droid_parameters_set(result, key, value);
+
+        pa_xfree(key);
+    }
+
+    s = pa_droid_parameters_to_string(result);
+    ret = strdup(s);
+
+    pa_xfree(s);
+    pa_droid_parameters_free(result);
+
+    return ret;
+}
+
+static int mock_set_parameters(pa_droid_parameters *values, const char *kvpairs) {
+    pa_droid_parameters *p;
+
+    if (!(p = pa_droid_parameters_from_string(kvpairs)))
+        return -EINVAL;
+
+    pa_droid_parameters_merge(values, p);
+    pa_droid_parameters_free(p);
+
+    return 0;
+}
+
+/* Stream */
+
+static uint32_t stream_get_sample_rate(const struct audio_stream *stream) {
+    return ((const struct mock_stream *) stream)->config.sample_rate;
+}
+
+static size_t stream_get_buffer_size(const struct audio_stream *stream) {
+    return ((const struct mock_stream *) stream)->buffer_size;
+}
+
+static audio_channel_mask_t stream_get_channels(const struct audio_stream *stream) {
+    return ((const struct mock_stream *) stream)->config.channel_mask;
+}
+
+static audio_format_t stream_get_format(const struct audio_stream *stream) {
+    return ((const struct mock_stream *) stream)->config.format;
+}
+
+static int stream_standby(struct audio_stream *stream) {
+    ((struct mock_stream *) stream)->next = 0;
+    return 0;
+}
+
+static int stream_set_parameters(struct audio_stream *stream, const char *kvpairs) {
+    return mock_set_parameters(((struct mock_stream *) stream)->parameters, kvpairs);
+}
+
+static char *stream_get_parameters(const struct audio_stream *stream, const char *keys) {
+    return mock_get_parameters(((const struct mock_stream *) stream)->parameters, keys);
+}
+
+/* Block like hardware consuming or producing bytes in real time, keeping one
+ * buffer queued. Returns bytes to report as written or read, or negative
+ * errno when an error is injected. */
+static ssize_t stream_io(struct mock_stream *s, size_t bytes) {
+    const struct mock_settings *settings = &s->device->module->settings;
+    pa_usec_t now, duration;
+
+    s->io_count++;
+
+    if (settings->error_every && s->io_count % settings->error_every == 0)
+        return -EIO;
+
+    if (s->output && settings->short_write_every && s->io_count % settings->short_write_every == 0)
+        bytes = (bytes / 2 / s->frame_size) * s->frame_size;
+
+    duration = (pa_usec_t) (bytes / s->frame_size) * PA_USEC_PER_SEC / s->config.sample_rate;
+    now = pa_rtclock_now();
+
+    /* Coming out of standby or after an underrun start over. */
+    if (s->next == 0 || s->next + duration < now)
+        s->next = now;
+
+    s->next += duration;
+
+    if (s->output)
+        mock_sleep(s->next - duration);
+    else
+        mock_sleep(s->next);
+
+    if (settings->stall_every && s->io_count % settings->stall_every == 0)
+        mock_delay(settings->stall_ms);
+
+    return bytes;
+}
+
+static uint32_t out_get_latency(const struct audio_stream_out *stream) {
+    const struct mock_stream *s = (const struct mock_stream *) stream;
+
+    return 2 * s->device->module->settings.period_ms;
+}
+
+static int out_set_volume(struct audio_stream_out *stream, float left, float right) {
+    return 0;
+}
+
+static ssize_t out_write(struct audio_stream_out *stream, const void *buffer, size_t bytes) {
+    return stream_io((struct mock_stream *) stream, bytes);
+}
+
+static ssize_t in_read(struct audio_stream_in *stream, void *buffer, size_t bytes) {
+    ssize_t ret;
+
+    if ((ret = stream_io((struct mock_stream *) stream, bytes)) > 0)
+        memset(buffer, 0, ret);
+
+    return ret;
+}
+
+static struct mock_stream *mock_stream_new(struct mock_device *d, bool output, struct audio_config *config) {
+    struct mock_stream *s;
+    uint32_t channels;
+
+    if (config->sample_rate == 0)
+        config->sample_rate = MOCK_DEFAULT_SAMPLE_RATE;
+    if (config->format == AUDIO_FORMAT_DEFAULT)
+        config->format = AUDIO_FORMAT_PCM_16_BIT;
+    if (config->channel_mask == 0)
+        config->channel_mask = output ? AUDIO_CHANNEL_OUT_STEREO : AUDIO_CHANNEL_IN_STEREO;
+
+    channels = output ? audio_channel_count_from_out_mask(config->channel_mask)
+                      : audio_channel_count_from_in_mask(config->channel_mask);
+
+    s = pa_xnew0(struct mock_stream, 1);
+    s->device = d;
+    s->output = output;
+    s->config = *config;
+    s->frame_size = audio_bytes_per_sample(config->format) * channels;
+    if (s->frame_size == 0)
+        s->frame_size = 1;
+    s->buffer_size = (size_t) config->sample_rate * d->module->settings.period_ms / 1000 * s->frame_size;
+    s->parameters = pa_droid_parameters_new();
+
+    s->out.common.get_sample_rate = stream_get_sample_rate;
+    s->out.common.get_buffer_size = stream_get_buffer_size;
+    s->out.common.get_channels = stream_get_channels;
+    s->out.common.get_format = stream_get_format;
+    s->out.common.standby = stream_standby;
+    s->out.common.set_parameters = stream_set_parameters;
+    s->out.common.get_parameters = stream_get_parameters;
+
+    if (output) {
+        s->out.get_latency = out_get_latency;
+        s->out.set_volume = out_set_volume;
+        s->out.write = out_write;
+    } else
+        s->in.read = in_read;
+
+    return s;
+}
+
+static void mock_stream_free(struct mock_stream *s) {
+    pa_droid_parameters_free(s->parameters);
+    pa_xfree(s);
+}
+
+/* Device */
+
+static int device_init_check(const struct audio_hw_device *dev) {
+    return 0;
+}
+
+static int device_set_voice_volume(struct audio_hw_device *dev, float volume) {
+    return 0;
+}
+
+static int device_set_master_volume(struct audio_hw_device *dev, float volume) {
+    return -ENOSYS;
+}
+
+static int device_set_mode(struct audio_hw_device *dev, audio_mode_t mode) {
+    struct mock_device *d = (struct mock_device *) dev;
+
+    if (d->mode != mode)
+        mock_delay(d->module->settings.mode_delay_ms);
+
+    d->mode = mode;
+    return 0;
+}
+
+static int device_set_mic_mute(struct audio_hw_device *dev, bool state) {
+    ((struct mock_device *) dev)->mic_mute = state;
+    return 0;
+}
+
+static int device_get_mic_mute(const struct audio_hw_device *dev, bool *state) {
+    *state = ((const struct mock_device *) dev)->mic_mute;
+    return 0;
+}
+
+static int device_set_parameters(struct audio_hw_device *dev, const char *kvpairs) {
+    struct mock_device *d = (struct mock_device *) dev;
+    int ret;
+
+    pa_mutex_lock(d->mutex);
+    ret = mock_set_parameters(d->parameters, kvpairs);
+    pa_mutex_unlock(d->mutex);
+
+    return ret;
+}
+
+static char *device_get_parameters(const struct audio_hw_device *dev, const char *keys) {
+    const struct mock_device *d = (const struct mock_device *) dev;
+    char *ret;
+
+    pa_mutex_lock(d->mutex);
+    ret = mock_get_parameters(d->parameters, keys);
+    pa_mutex_unlock(d->mutex);
+
+    return ret;
+}
+
+static size_t device_get_input_buffer_size(const struct audio_hw_device *dev, const struct audio_config *config) {
+    const struct mock_device *d = (const struct mock_device *) dev;
+
+    return (size_t) config->sample_rate * d->module->settings.period_ms / 1000 *
+           audio_bytes_per_sample(config->format) * audio_channel_count_from_in_mask(config->channel_mask);
+}
+
+static int device_open_output_stream(struct audio_hw_device *dev,
+                                     audio_io_handle_t handle,
+                                     audio_devices_t devices,
+                                     audio_output_flags_t flags,
+                                     struct audio_config *config,
+                                     struct audio_stream_out **stream_out,
+                                     const char *address) {
+    struct mock_device *d = (struct mock_device *) dev;
+
+    mock_delay(d->module->settings.open_delay_ms);
+
+    *stream_out = &mock_stream_new(d, true, config)->out;
+
+    return 0;
+}
+
+static void device_close_output_stream(struct audio_hw_device *dev, struct audio_stream_out *stream) {
+    mock_stream_free((struct mock_stream *) stream);
+}
+
+static int device_open_input_stream(struct audio_hw_device *dev,
+                                    audio_io_handle_t handle,
+                                    audio_devices_t devices,
+                                    struct audio_config *config,
+                                    struct audio_stream_in **stream_in,
+                                    audio_input_flags_t flags,
+                                    const char *address,
+                                    audio_source_t source) {
+    struct mock_device *d = (struct mock_device *) dev;
+    uint32_t input_rate = d->module->settings.input_rate;
+
+    mock_delay(d->module->settings.open_delay_ms);
+
+    /* Like real HALs, suggest supported config by modifying the requested one. */
+    if (input_rate && config->sample_rate != input_rate) {
+        config->sample_rate = input_rate;
+        *stream_in = NULL;
+        return -EINVAL;
+    }
+
+    *stream_in = &mock_stream_new(d, false, config)->in;
+
+    return 0;
+}
+
+static void device_close_input_stream(struct audio_hw_device *dev, struct audio_stream_in *stream) {
+    mock_stream_free((struct mock_stream *) stream);
+}
+
+static int device_create_audio_patch(struct audio_hw_device *dev,
+                                     unsigned int num_sources,
+                                     const struct audio_port_config *sources,
+                                     unsigned int num_sinks,
+                                     const struct audio_port_config *sinks,
+                                     audio_patch_handle_t *handle) {
+    struct mock_device *d = (struct mock_device *) dev;
+
+    if (num_sources == 0 || num_sinks == 0)
+        return -EINVAL;
+
+    mock_delay(d->module->settings.patch_delay_ms);
+
+    pa_mutex_lock(d->mutex);
+    if (*handle == AUDIO_PATCH_HANDLE_NONE)
+        *handle = ++d->next_patch;
+    pa_mutex_unlock(d->mutex);
+
+    return 0;
+}
+
+static int device_release_audio_patch(struct audio_hw_device *dev, audio_patch_handle_t handle) {
+    struct mock_device *d = (struct mock_device *) dev;
+
+    if (handle == AUDIO_PATCH_HANDLE_NONE)
+        return -EINVAL;
+
+    mock_delay(d->module->settings.patch_delay_ms);
+
+    return 0;
+}
+
+static int device_close(struct hw_device_t *device) {
+    struct mock_device *d = (struct mock_device *) device;
+    struct mock_module *m = d->module;
+
+    pa_log_info("Close mock audio HAL %s", m->name);
+
+    pa_droid_parameters_free(d->parameters);
+    pa_mutex_free(d->mutex);
+    pa_xfree(d);
+
+    dm_mock_hal_free_module(&m->module);
+
+    return 0;
+}
+
+static int module_open(const struct hw_module_t *module, const char *id, struct hw_device_t **device) {
+    struct mock_device *d;
+
+    if (!pa_streq(id, AUDIO_HARDWARE_INTERFACE))
+        return -EINVAL;
+
+    d = pa_xnew0(struct mock_device, 1);
+    d->module = (struct mock_module *) module;
+    d->mutex = pa_mutex_new(false, false);
+    d->parameters = pa_droid_parameters_new();
+    d->mode = AUDIO_MODE_NORMAL;
+
+    d->device.common.tag = HARDWARE_DEVICE_TAG;
+    d->device.common.version = AUDIO_DEVICE_API_VERSION_CURRENT;
+    d->device.common.module = (struct hw_module_t *) module;
+    d->device.common.close = device_close;
+
+    d->device.init_check = device_init_check;
+    d->device.set_voice_volume = device_set_voice_volume;
+    d->device.set_master_volume = device_set_master_volume;
+    d->device.set_mode = device_set_mode;
+    d->device.set_mic_mute = device_set_mic_mute;
+    d->device.get_mic_mute = device_get_mic_mute;
+    d->device.set_parameters = device_set_parameters;
+    d->device.get_parameters = device_get_parameters;
+    d->device.get_input_buffer_size = device_get_input_buffer_size;
+    d->device.open_output_stream = device_open_output_stream;
+    d->device.close_output_stream = device_close_output_stream;
+    d->device.open_input_stream = device_open_input_stream;
+    d->device.close_input_stream = device_close_input_stream;
+    d->device.create_audio_patch = device_create_audio_patch;
+    d->device.release_audio_patch = device_release_audio_patch;
+
+    *device = &d->device.common;
+
+    return 0;
+}
+
+static bool settings_parse(struct mock_settings *settings, const char *s) {
+    pa_modargs *ma;
+    bool ret = false;
+
+    settings->period_ms = MOCK_DEFAULT_PERIOD_MS;
+    settings->stall_ms = MOCK_DEFAULT_STALL_MS;
+
+    if (!(ma = pa_modargs_new(s, valid_settings))) {
+        pa_log("Failed to parse mock HAL settings \"%s\"", s);
+        return false;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "period_ms", &settings->period_ms) < 0 ||
+        pa_modargs_get_value_u32(ma, "open_delay_ms", &settings->open_delay_ms) < 0 ||
+        pa_modargs_get_value_u32(ma, "patch_delay_ms", &settings->patch_delay_ms) < 0 ||
+        pa_modargs_get_value_u32(ma, "mode_delay_ms", &settings->mode_delay_ms) < 0 ||
+        pa_modargs_get_value_u32(ma, "input_rate", &settings->input_rate) < 0 ||
+        pa_modargs_get_value_u32(ma, "short_write_every", &settings->short_write_every) < 0 ||
+        pa_modargs_get_value_u32(ma, "error_every", &settings->error_every) < 0 ||
+        pa_modargs_get_value_u32(ma, "stall_every", &settings->stall_every) < 0 ||
+        pa_modargs_get_value_u32(ma, "stall_ms", &settings->stall_ms) < 0) {
+        pa_log("Invalid mock HAL settings \"%s\"", s);
+        goto done;
+    }
+
+    if (settings->period_ms == 0) {
+        pa_log("Mock HAL period_ms needs to be greater than 0.");
+        goto done;
+    }
+
+    ret = true;
+
+done:
+    pa_modargs_free(ma);
+
+    return ret;
+}
+
+int dm_mock_hal_get_module(const char *name, const char *settings, const struct hw_module_t **module) {
+    struct mock_module *m;
+
+    pa_assert(name);
+    pa_assert(settings);
+    pa_assert(module);
+
+    m = pa_xnew0(struct mock_module, 1);
+
+    if (!settings_parse(&m->settings, settings)) {
+        pa_xfree(m);
+        return -EINVAL;
+    }
+
+    m->name = pa_xstrdup(name);
+    m->methods.open = module_open;
+
+    m->module.tag = HARDWARE_MODULE_TAG;
+    m->module.module_api_version = AUDIO_MODULE_API_VERSION_CURRENT;
+    m->module.hal_api_version = HARDWARE_HAL_API_VERSION;
+    m->module.id = AUDIO_HARDWARE_MODULE_ID;
+    m->module.name = m->name;
+    m->module.author = "pulseaudio-modules-droid";
+    m->module.methods = &m->methods;
+
+    pa_log_info("Using mock audio HAL for %s (period %u ms, open delay %u ms, patch delay %u ms)",
+                name, m->settings.period_ms, m->settings.open_delay_ms, m->settings.patch_delay_ms);
+
+    *module = &m->module;
+
+    return 0;
+}
+
+void dm_mock_hal_free_module(struct hw_module_t *module) {
+    struct mock_module *m = (struct mock_module *) module;
+
+    pa_assert(module);
+
+    pa_xfree(m->name);
+    pa_xfree(m);
+}
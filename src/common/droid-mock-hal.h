@@ -0,0 +1,59 @@
+#ifndef foodroidmockhalfoo
+#define foodroidmockhalfoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <droid/version.h>
+
+/* Mock audio HAL, used in place of the vendor audio HAL when module argument
+ * mock_hal is given. Only built with the mock-hal meson option.
+ *
+ * Streams block in write() and read() as if the hardware consumed or
+ * produced audio in real time, and the HAL can be configured to be slow or
+ * misbehave. Settings are given as a string of key=value pairs:
+ *
+ *   period_ms          Stream buffer size in milliseconds (default 20)
+ *   open_delay_ms      Time open_output_stream() and open_input_stream() take
+ *   patch_delay_ms     Time create_audio_patch() and release_audio_patch() take
+ *   mode_delay_ms      Time set_mode() takes when mode changes
+ *   input_rate         If set, open_input_stream() with different sample rate
+ *                      fails and suggests this rate instead
+ *   short_write_every  Every nth write() writes only half of the buffer
+ *   error_every        Every nth write() or read() fails
+ *   stall_every        Every nth write() or read() blocks stall_ms longer
+ *   stall_ms           Length of stalls (default 100)
+ *
+ * for example mock_hal="period_ms=10 open_delay_ms=30 error_every=1000" */
+
+/* Returns 0 and module which can be opened with audio_hw_device_open(), or
+ * negative errno if settings couldn't be parsed. Module is freed when the
+ * device opened from it is closed, if the device is never opened module
+ * needs to be freed with dm_mock_hal_free_module(). */
+int dm_mock_hal_get_module(const char *name, const char *settings, const struct hw_module_t **module);
+void dm_mock_hal_free_module(struct hw_module_t *module);
+
+#endif
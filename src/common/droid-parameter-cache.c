@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+#include "droid/droid-parameters.h"
+#include "droid-parameter-cache.h"
+
+struct cache_entry {
+    char *key;
+    char *value; /* NULL if HAL has no value for key */
+    pa_usec_t timestamp;
+};
+
+struct dm_parameter_cache {
+    pa_usec_t ttl;
+    pa_hashmap *entries;
+};
+
+static void cache_entry_free(struct cache_entry *e) {
+    pa_xfree(e->key);
+    pa_xfree(e->value);
+    pa_xfree(e);
+}
+
+dm_parameter_cache *dm_parameter_cache_new(pa_usec_t ttl) {
+    dm_parameter_cache *cache;
+
+    cache = pa_xnew0(dm_parameter_cache, 1);
+    cache->ttl = ttl;
+    cache->entries = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                                         NULL, (pa_free_cb_t) cache_entry_free);
+
+    return cache;
+}
+
+void dm_parameter_cache_free(dm_parameter_cache *cache) {
+    pa_assert(cache);
+
+    pa_hashmap_free(cache->entries);
+    pa_xfree(cache);
+}
+
+char *dm_parameter_cache_get(dm_parameter_cache *cache, const char *keys) {
+    struct cache_entry *e;
+    const char *state = NULL;
+    pa_usec_t now = 0;
+    pa_strbuf *buf;
+    char *key;
+
+    pa_assert(cache);
+    pa_assert(keys);
+
+    if (cache->ttl > 0)
+        now = pa_rtclock_now();
+
+    buf = pa_strbuf_new();
+
+    while ((key = pa_split(keys, ";", &state))) {
+        if (*key == '\0') {
+            pa_xfree(key);
+            continue;
+        }
+
+        if (!(e = pa_hashmap_get(cache->entries, key)) ||
+            (cache->ttl > 0 && now - e->timestamp > cache->ttl)) {
+            pa_xfree(key);
+            pa_strbuf_free(buf);
+            return NULL;
+        }
+
+        if (e->value)
+            pa_strbuf_printf(buf, "%s%s=%s", pa_strbuf_isempty(buf) ? "" : ";", e->key, e->value);
+
+        pa_xfree(key);
+    }
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+void dm_parameter_cache_put(dm_parameter_cache *cache, const char *keys, const char *reply) {
+    pa_droid_parameters *values;
+    struct cache_entry *e;
+    const char *state = NULL;
+    const char *value;
+    pa_usec_t now;
+    char *key;
+
+    pa_assert(cache);
+    pa_assert(keys);
+    pa_assert(reply);
+
+    values = pa_droid_parameters_from_string(reply);
+    now = pa_rtclock_now();
+
+    while ((key = pa_split(keys, ";", &state))) {
+        if (*key == '\0') {
+            pa_xfree(key);
+            continue;
+        }
+
+        value = pa_droid_parameters_get(values, key);
+
+        if ((e = pa_hashmap_get(cache->entries, key))) {
+            pa_xfree(key);
+            pa_xfree(e->value);
+        } else {
+            e = pa_xnew0(struct cache_entry, 1);
+            e->key = key;
+            pa_hashmap_put(cache->entries, e->key, e);
+        }
+
+        e->value = pa_xstrdup(value);
+        e->timestamp = now;
+    }
+
+    pa_droid_parameters_free(values);
+}
+
+void dm_parameter_cache_invalidate(dm_parameter_cache *cache, const char *key_value_pairs) {
+    pa_droid_parameters *pairs;
+    const char *key;
+    void *state = NULL;
+
+    pa_assert(cache);
+    pa_assert(key_value_pairs);
+
+    if (pa_hashmap_isempty(cache->entries))
+        return;
+
+    pairs = pa_droid_parameters_from_string(key_value_pairs);
+
+    while (pa_droid_parameters_iterate(pairs, &state, &key, NULL))
+        pa_hashmap_remove_and_free(cache->entries, key);
+
+    pa_droid_parameters_free(pairs);
+}
+
+void dm_parameter_cache_invalidate_all(dm_parameter_cache *cache) {
+    pa_assert(cache);
+
+    pa_hashmap_remove_all(cache->entries);
+}
@@ -0,0 +1,52 @@
+#ifndef foodroidparametercachefoo
+#define foodroidparametercachefoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/sample.h>
+
+/* Key level cache of HAL get_parameters() replies. Keys HAL didn't return a
+ * value for are cached as well. Entries are dropped when matching keys are
+ * set, when everything is invalidated, or optionally when ttl has passed.
+ * Not thread-safe, callers hold the hw module lock. */
+
+typedef struct dm_parameter_cache dm_parameter_cache;
+
+/* ttl of 0 means entries don't expire. */
+dm_parameter_cache *dm_parameter_cache_new(pa_usec_t ttl);
+void dm_parameter_cache_free(dm_parameter_cache *cache);
+
+/* Returns reply for keys if all of them are cached, NULL otherwise. Returned
+ * string needs to be freed with pa_xfree(). */
+char *dm_parameter_cache_get(dm_parameter_cache *cache, const char *keys);
+/* Store HAL reply for queried keys. */
+void dm_parameter_cache_put(dm_parameter_cache *cache, const char *keys, const char *reply);
+/* Drop entries for keys in key value pairs. */
+void dm_parameter_cache_invalidate(dm_parameter_cache *cache, const char *key_value_pairs);
+void dm_parameter_cache_invalidate_all(dm_parameter_cache *cache);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+#include <droid/sllist.h>
+#include <droid/droid-parameters.h>
+
+typedef struct parameter_pair parameter_pair;
+
+struct parameter_pair {
+    char *key;
+    char *value;
+    parameter_pair *next;
+};
+
+struct pa_droid_parameters {
+    parameter_pair *pairs;
+    unsigned size;
+};
+
+static parameter_pair *find_pair(const pa_droid_parameters *p, const char *key) {
+    parameter_pair *pair;
+
+    SLLIST_FOREACH(pair, p->pairs) {
+        if (pa_streq(pair->key, key))
+            return pair;
+    }
+
+    return NULL;
+}
+
+pa_droid_parameters *pa_droid_parameters_new(void) {
+    return pa_xnew0(pa_droid_parameters, 1);
+}
+
+pa_droid_parameters *pa_droid_parameters_from_string(const char *str) {
+    pa_droid_parameters *p;
+    const char *state = NULL;
+    char *pair;
+    char *value;
+
+    pa_assert(str);
+
+    p = pa_droid_parameters_new();
+
+    while ((pair = pa_split(str, ";", &state))) {
+        if ((value = strchr(pair, '=')) && value != pair) {
+            *value++ = '\0';
+            pa_droid_parameters_set(p, pair, value);
+        }
+        pa_xfree(pair);
+    }
+
+    return p;
+}
+
+pa_droid_parameters *pa_droid_parameters_copy(const pa_droid_parameters *p) {
+    pa_droid_parameters *copy;
+
+    pa_assert(p);
+
+    copy = pa_droid_parameters_new();
+    pa_droid_parameters_merge(copy, p);
+
+    return copy;
+}
+
+void pa_droid_parameters_free(pa_droid_parameters *p) {
+    parameter_pair *pair;
+
+    pa_assert(p);
+
+    for (;;) {
+        SLLIST_STEAL_FIRST(pair, p->pairs);
+        if (!pair)
+            break;
+        pa_xfree(pair->key);
+        pa_xfree(pair->value);
+        pa_xfree(pair);
+    }
+
+    pa_xfree(p);
+}
+
+void pa_droid_parameters_set(pa_droid_parameters *p, const char *key, const char *value) {
+    parameter_pair *pair;
+
+    pa_assert(p);
+    pa_assert(key);
+    pa_assert(value);
+
+    if ((pair = find_pair(p, key))) {
+        pa_xfree(pair->value);
+        pair->value = pa_xstrdup(value);
+        return;
+    }
+
+    pair = pa_xnew0(parameter_pair, 1);
+    pair->key = pa_xstrdup(key);
+    pair->value = pa_xstrdup(value);
+    SLLIST_APPEND(parameter_pair, p->pairs, pair);
+    p->size++;
+}
+
+void pa_droid_parameters_set_int(pa_droid_parameters *p, const char *key, int32_t value) {
+    char str[12];
+
+    pa_snprintf(str, sizeof(str), "%d", value);
+    pa_droid_parameters_set(p, key, str);
+}
+
+void pa_droid_parameters_set_uint(pa_droid_parameters *p, const char *key, uint32_t value) {
+    char str[11];
+
+    pa_snprintf(str, sizeof(str), "%u", value);
+    pa_droid_parameters_set(p, key, str);
+}
+
+void pa_droid_parameters_merge(pa_droid_parameters *p, const pa_droid_parameters *src) {
+    parameter_pair *pair;
+
+    pa_assert(p);
+    pa_assert(src);
+
+    SLLIST_FOREACH(pair, src->pairs)
+        pa_droid_parameters_set(p, pair->key, pair->value);
+}
+
+const char *pa_droid_parameters_get(const pa_droid_parameters *p, const char *key) {
+    parameter_pair *pair;
+
+    pa_assert(p);
+    pa_assert(key);
+
+    return (pair = find_pair(p, key)) ? pair->value : NULL;
+}
+
+const char *pa_droid_parameters_first_key(const pa_droid_parameters *p) {
+    pa_assert(p);
+
+    return p->pairs ? p->pairs->key : NULL;
+}
+
+unsigned pa_droid_parameters_size(const pa_droid_parameters *p) {
+    pa_assert(p);
+
+    return p->size;
+}
+
+bool pa_droid_parameters_iterate(const pa_droid_parameters *p, void **state,
+                                 const char **key, const char **value) {
+    parameter_pair *pair;
+
+    pa_assert(p);
+    pa_assert(state);
+
+    pair = *state ? ((parameter_pair *) *state)->next : p->pairs;
+    *state = pair;
+
+    if (!pair)
+        return false;
+
+    if (key)
+        *key = pair->key;
+    if (value)
+        *value = pair->value;
+
+    return true;
+}
+
+bool pa_droid_parameters_intersect(const pa_droid_parameters *a, const pa_droid_parameters *b) {
+    parameter_pair *pair;
+
+    pa_assert(a);
+    pa_assert(b);
+
+    SLLIST_FOREACH(pair, a->pairs) {
+        if (find_pair(b, pair->key))
+            return true;
+    }
+
+    return false;
+}
+
+bool pa_droid_parameters_equal(const pa_droid_parameters *a, const pa_droid_parameters *b, bool compare_values) {
+    parameter_pair *i, *j;
+
+    pa_assert(a);
+    pa_assert(b);
+
+    if (a->size != b->size)
+        return false;
+
+    for (i = a->pairs, j = b->pairs; i && j; i = i->next, j = j->next) {
+        if (!pa_streq(i->key, j->key))
+            return false;
+        if (compare_values && !pa_streq(i->value, j->value))
+            return false;
+    }
+
+    return true;
+}
+
+char *pa_droid_parameters_to_string(const pa_droid_parameters *p) {
+    parameter_pair *pair;
+    pa_strbuf *buf;
+
+    pa_assert(p);
+
+    buf = pa_strbuf_new();
+
+    SLLIST_FOREACH(pair, p->pairs)
+        pa_strbuf_printf(buf, "%s%s=%s", pair == p->pairs ? "" : ";", pair->key, pair->value);
+
+    return pa_strbuf_to_string_free(buf);
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+#include "droid/sllist.h"
+#include "droid/utils.h"
+#include "droid-startup-trace.h"
+
+struct startup_phase {
+    char *name;
+    pa_usec_t start;
+    pa_usec_t duration;
+};
+
+struct dm_startup_trace {
+    pa_usec_t begin;
+    pa_usec_t end;
+    dm_list *phases;
+};
+
+static void startup_phase_free(struct startup_phase *phase) {
+    pa_assert(phase);
+
+    pa_xfree(phase->name);
+    pa_xfree(phase);
+}
+
+dm_startup_trace *dm_startup_trace_new(void) {
+    dm_startup_trace *trace;
+
+    trace = pa_xnew0(dm_startup_trace, 1);
+    trace->begin = pa_rtclock_now();
+    trace->phases = dm_list_new();
+
+    return trace;
+}
+
+void dm_startup_trace_free(dm_startup_trace *trace) {
+    pa_assert(trace);
+
+    dm_list_free(trace->phases, (pa_free_cb_t) startup_phase_free);
+    pa_xfree(trace);
+}
+
+void dm_startup_trace_add(dm_startup_trace *trace, const char *name, pa_usec_t begin) {
+    struct startup_phase *phase;
+    pa_usec_t now;
+
+    pa_assert(trace);
+    pa_assert(name);
+
+    now = pa_rtclock_now();
+
+    phase = pa_xnew0(struct startup_phase, 1);
+    phase->name = pa_xstrdup(name);
+    phase->start = begin > trace->begin ? begin - trace->begin : 0;
+    phase->duration = now > begin ? now - begin : 0;
+    dm_list_push_back(trace->phases, phase);
+
+    if (trace->end)
+        pa_log_info("Startup phase %s took %0.1f ms (after startup finished)",
+                    phase->name, (double) phase->duration / PA_USEC_PER_MSEC);
+}
+
+void dm_startup_trace_finish(dm_startup_trace *trace) {
+    struct startup_phase *phase;
+    void *state = NULL;
+
+    pa_assert(trace);
+
+    if (trace->end)
+        return;
+
+    trace->end = pa_rtclock_now();
+
+    pa_log_info("Startup took %0.1f ms:", (double) (trace->end - trace->begin) / PA_USEC_PER_MSEC);
+
+    DM_LIST_FOREACH_DATA(phase, trace->phases, state)
+        pa_log_info("  %8.1f ms %8.1f ms  %s",
+                    (double) phase->start / PA_USEC_PER_MSEC,
+                    (double) phase->duration / PA_USEC_PER_MSEC,
+                    phase->name);
+}
+
+bool dm_startup_trace_finished(dm_startup_trace *trace) {
+    pa_assert(trace);
+
+    return trace->end > 0;
+}
+
+/* {"finished":true,"total_usec":N,"phases":[{"name":"...","start_usec":N,"duration_usec":N},...]}
+ * While startup is not finished total_usec is time elapsed so far. */
+char *dm_startup_trace_to_string(dm_startup_trace *trace) {
+    struct startup_phase *phase;
+    pa_strbuf *buf;
+    void *state = NULL;
+    bool first = true;
+
+    pa_assert(trace);
+
+    buf = pa_strbuf_new();
+
+    pa_strbuf_printf(buf, "{\"finished\":%s,\"total_usec\":%llu,\"phases\":[",
+                     trace->end ? "true" : "false",
+                     (unsigned long long) ((trace->end ? trace->end : pa_rtclock_now()) - trace->begin));
+
+    DM_LIST_FOREACH_DATA(phase, trace->phases, state) {
+        pa_strbuf_puts(buf, first ? "{\"name\":" : ",{\"name\":");
+        dm_json_append_string(buf, phase->name);
+        pa_strbuf_printf(buf, ",\"start_usec\":%llu,\"duration_usec\":%llu}",
+                         (unsigned long long) phase->start,
+                         (unsigned long long) phase->duration);
+        first = false;
+    }
+
+    pa_strbuf_puts(buf, "]}");
+
+    return pa_strbuf_to_string_free(buf);
+}
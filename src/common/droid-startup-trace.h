@@ -0,0 +1,52 @@
+#ifndef foodroidstartuptracefoo
+#define foodroidstartuptracefoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+
+#include <pulse/sample.h>
+
+/* Records how long each phase of bringing up a hw module takes. Phases are
+ * kept in the order they are added, with start time relative to the creation
+ * of the trace. Used from main thread only. */
+
+typedef struct dm_startup_trace dm_startup_trace;
+
+dm_startup_trace *dm_startup_trace_new(void);
+void dm_startup_trace_free(dm_startup_trace *trace);
+
+/* Add phase which started at begin and ended now. */
+void dm_startup_trace_add(dm_startup_trace *trace, const char *name, pa_usec_t begin);
+/* Mark startup finished and log the report. Phases can still be added after
+ * this, they are logged when added. */
+void dm_startup_trace_finish(dm_startup_trace *trace);
+bool dm_startup_trace_finished(dm_startup_trace *trace);
+/* Returns report as JSON object, free with pa_xfree(). */
+char *dm_startup_trace_to_string(dm_startup_trace *trace);
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/strbuf.h>
+
+#include "droid-stream-cache.h"
+
+#define CACHE_FILE_PREFIX       "droid-stream-cache-"
+#define CACHE_LINE_MAX          (512)
+
+/* Cache file format:
+ *
+ * First line identifies the HAL build, rest of the lines are entries
+ *   <device> <source> <rate> <channel mask> <format> = <rate> <channel mask> <format> <mix port name>
+ * where the left hand side is the requested configuration and the right hand
+ * side the configuration HAL accepted. Mix port name is last as it may
+ * contain whitespace. */
+
+struct cache_entry {
+    char *key;
+    uint32_t sample_rate;
+    audio_channel_mask_t channel_mask;
+    audio_format_t format;
+};
+
+struct dm_stream_cache {
+    pa_mutex *mutex;
+    char *path;
+    char *identity;
+    pa_hashmap *entries;
+    bool dirty;
+    dm_stream_cache_changed_cb_t changed_cb;
+    void *userdata;
+};
+
+static void cache_entry_free(struct cache_entry *e) {
+    pa_assert(e);
+
+    pa_xfree(e->key);
+    pa_xfree(e);
+}
+
+static char *entry_key(const char *mix_port,
+                       audio_devices_t device,
+                       audio_source_t source,
+                       const struct audio_config *requested) {
+    return pa_sprintf_malloc("%#010x %u %u %#010x %#010x = %s",
+                             device,
+                             (uint32_t) source,
+                             requested->sample_rate,
+                             requested->channel_mask,
+                             requested->format,
+                             mix_port);
+}
+
+static char *identity_get(const struct hw_module_t *hwmod, const audio_hw_device_t *device) {
+    return pa_sprintf_malloc("%s %s %#x %#x %#x %s %s",
+                             DROID_DEVICE_STRING,
+                             PACKAGE_VERSION,
+                             hwmod->module_api_version,
+                             hwmod->hal_api_version,
+                             device->common.version,
+                             hwmod->name ? hwmod->name : "",
+                             hwmod->author ? hwmod->author : "");
+}
+
+static void cache_load(dm_stream_cache *cache) {
+    FILE *f;
+    char line[CACHE_LINE_MAX];
+    unsigned count = 0;
+
+    if (!(f = pa_fopen_cloexec(cache->path, "r"))) {
+        if (errno != ENOENT)
+            pa_log_warn("Failed to open stream cache %s: %s", cache->path, pa_cstrerror(errno));
+        return;
+    }
+
+    if (!fgets(line, sizeof(line), f) || !pa_streq(pa_strip_nl(line), cache->identity)) {
+        pa_log_info("Stream cache %s is for different HAL build, discarding.", cache->path);
+        goto done;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        struct cache_entry *e;
+        uint32_t device, source, req_rate, req_mask, req_format;
+        uint32_t rate, mask, format;
+        int name_start = 0;
+        struct audio_config requested;
+
+        pa_strip_nl(line);
+
+        if (sscanf(line, "%x %u %u %x %x = %u %x %x %n",
+                   &device, &source, &req_rate, &req_mask, &req_format,
+                   &rate, &mask, &format, &name_start) != 8 || line[name_start] == '\0') {
+            pa_log_debug("Ignoring malformed stream cache line \"%s\"", line);
+            continue;
+        }
+
+        memset(&requested, 0, sizeof(requested));
+        requested.sample_rate = req_rate;
+        requested.channel_mask = req_mask;
+        requested.format = req_format;
+
+        e = pa_xnew0(struct cache_entry, 1);
+        e->key = entry_key(line + name_start, device, source, &requested);
+        e->sample_rate = rate;
+        e->channel_mask = mask;
+        e->format = format;
+
+        if (pa_hashmap_put(cache->entries, e->key, e) < 0)
+            cache_entry_free(e);
+        else
+            count++;
+    }
+
+    pa_log_debug("Loaded %u entries from stream cache %s", count, cache->path);
+
+done:
+    fclose(f);
+}
+
+/* Called with cache mutex held. */
+static char *cache_to_string(dm_stream_cache *cache) {
+    pa_strbuf *buf;
+    struct cache_entry *e;
+    void *state = NULL;
+
+    buf = pa_strbuf_new();
+    pa_strbuf_printf(buf, "%s\n", cache->identity);
+
+    PA_HASHMAP_FOREACH(e, cache->entries, state) {
+        const char *name;
+        uint32_t device, source, req_rate, req_mask, req_format;
+
+        pa_assert_se(sscanf(e->key, "%x %u %u %x %x", &device, &source, &req_rate, &req_mask, &req_format) == 5);
+        pa_assert_se(name = strstr(e->key, " = "));
+
+        pa_strbuf_printf(buf, "%#010x %u %u %#010x %#010x = %u %#010x %#010x %s\n",
+                         device, source, req_rate, req_mask, req_format,
+                         e->sample_rate, e->channel_mask, e->format,
+                         name + 3);
+    }
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+static void cache_write(dm_stream_cache *cache, const char *contents) {
+    FILE *f;
+    char *tmp_path;
+
+    tmp_path = pa_sprintf_malloc("%s.tmp", cache->path);
+
+    if (!(f = pa_fopen_cloexec(tmp_path, "w"))) {
+        pa_log_warn("Failed to write stream cache %s: %s", tmp_path, pa_cstrerror(errno));
+        goto done;
+    }
+
+    fputs(contents, f);
+
+    if (fclose(f) != 0 || rename(tmp_path, cache->path) < 0) {
+        pa_log_warn("Failed to write stream cache %s: %s", cache->path, pa_cstrerror(errno));
+        unlink(tmp_path);
+    }
+
+done:
+    pa_xfree(tmp_path);
+}
+
+dm_stream_cache *dm_stream_cache_new(const char *module_id,
+                                     const struct hw_module_t *hwmod,
+                                     const audio_hw_device_t *device,
+                                     dm_stream_cache_changed_cb_t changed_cb,
+                                     void *userdata) {
+    dm_stream_cache *cache;
+    char *fn;
+    char *path;
+
+    pa_assert(module_id);
+    pa_assert(hwmod);
+    pa_assert(device);
+
+    fn = pa_sprintf_malloc(CACHE_FILE_PREFIX "%s", module_id);
+    path = pa_state_path(fn, true);
+    pa_xfree(fn);
+
+    if (!path) {
+        pa_log_info("No state directory available, stream cache disabled.");
+        return NULL;
+    }
+
+    cache = pa_xnew0(dm_stream_cache, 1);
+    cache->mutex = pa_mutex_new(false, false);
+    cache->path = path;
+    cache->identity = identity_get(hwmod, device);
+    cache->entries = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                                         NULL, (pa_free_cb_t) cache_entry_free);
+    cache->changed_cb = changed_cb;
+    cache->userdata = userdata;
+
+    cache_load(cache);
+
+    return cache;
+}
+
+void dm_stream_cache_free(dm_stream_cache *cache) {
+    pa_assert(cache);
+
+    dm_stream_cache_save(cache);
+
+    pa_hashmap_free(cache->entries);
+    pa_mutex_free(cache->mutex);
+    pa_xfree(cache->identity);
+    pa_xfree(cache->path);
+    pa_xfree(cache);
+}
+
+void dm_stream_cache_save(dm_stream_cache *cache) {
+    char *contents = NULL;
+
+    pa_assert(cache);
+
+    /* Only serialize under the lock so that IO threads opening streams
+     * don't wait for the file to be written. */
+    pa_mutex_lock(cache->mutex);
+    if (cache->dirty) {
+        contents = cache_to_string(cache);
+        cache->dirty = false;
+    }
+    pa_mutex_unlock(cache->mutex);
+
+    if (contents) {
+        cache_write(cache, contents);
+        pa_xfree(contents);
+    }
+}
+
+static void cache_changed(dm_stream_cache *cache) {
+    if (cache->changed_cb)
+        cache->changed_cb(cache, cache->userdata);
+}
+
+bool dm_stream_cache_get(dm_stream_cache *cache,
+                         const char *mix_port,
+                         audio_devices_t device,
+                         audio_source_t source,
+                         const struct audio_config *requested,
+                         struct audio_config *accepted) {
+    struct cache_entry *e;
+    char *key;
+
+    pa_assert(cache);
+    pa_assert(mix_port);
+    pa_assert(requested);
+    pa_assert(accepted);
+
+    key = entry_key(mix_port, device, source, requested);
+
+    pa_mutex_lock(cache->mutex);
+    if ((e = pa_hashmap_get(cache->entries, key))) {
+        *accepted = *requested;
+        accepted->sample_rate = e->sample_rate;
+        accepted->channel_mask = e->channel_mask;
+        accepted->format = e->format;
+    }
+    pa_mutex_unlock(cache->mutex);
+
+    pa_xfree(key);
+
+    return !!e;
+}
+
+void dm_stream_cache_put(dm_stream_cache *cache,
+                         const char *mix_port,
+                         audio_devices_t device,
+                         audio_source_t source,
+                         const struct audio_config *requested,
+                         const struct audio_config *accepted) {
+    struct cache_entry *e;
+    char *key;
+    bool changed = false;
+
+    pa_assert(cache);
+    pa_assert(mix_port);
+    pa_assert(requested);
+    pa_assert(accepted);
+
+    key = entry_key(mix_port, device, source, requested);
+
+    pa_mutex_lock(cache->mutex);
+
+    if ((e = pa_hashmap_get(cache->entries, key))) {
+        pa_xfree(key);
+
+        if (e->sample_rate == accepted->sample_rate &&
+            e->channel_mask == accepted->channel_mask &&
+            e->format == accepted->format)
+            goto done;
+    } else {
+        e = pa_xnew0(struct cache_entry, 1);
+        e->key = key;
+        pa_hashmap_put(cache->entries, e->key, e);
+    }
+
+    e->sample_rate = accepted->sample_rate;
+    e->channel_mask = accepted->channel_mask;
+    e->format = accepted->format;
+
+    pa_log_debug("Stream cache update: %s -> %u %#010x %#010x",
+                 e->key, e->sample_rate, e->channel_mask, e->format);
+
+    cache->dirty = changed = true;
+
+done:
+    pa_mutex_unlock(cache->mutex);
+
+    if (changed)
+        cache_changed(cache);
+}
+
+void dm_stream_cache_remove(dm_stream_cache *cache,
+                            const char *mix_port,
+                            audio_devices_t device,
+                            audio_source_t source,
+                            const struct audio_config *requested) {
+    char *key;
+    bool changed = false;
+
+    pa_assert(cache);
+    pa_assert(mix_port);
+    pa_assert(requested);
+
+    key = entry_key(mix_port, device, source, requested);
+
+    pa_mutex_lock(cache->mutex);
+    if (pa_hashmap_remove_and_free(cache->entries, key) == 0) {
+        pa_log_debug("Stream cache entry %s removed.", key);
+        cache->dirty = changed = true;
+    }
+    pa_mutex_unlock(cache->mutex);
+
+    pa_xfree(key);
+
+    if (changed)
+        cache_changed(cache);
+}
@@ -0,0 +1,75 @@
+#ifndef foodroidstreamcachefoo
+#define foodroidstreamcachefoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+
+#include <droid/version.h>
+
+/* Persistent cache of stream configurations the HAL accepted when opening
+ * streams. Entries are keyed by mix port name, device, audio source and the
+ * requested configuration. The cache file is bound to the HAL build it was
+ * written with and is discarded if the HAL changes.
+ *
+ * Entries can be looked up and changed from any thread. Changes only mark
+ * the cache dirty and call changed_cb, the file is written with
+ * dm_stream_cache_save() which should be called from main thread. */
+
+typedef struct dm_stream_cache dm_stream_cache;
+
+/* Called from the thread changing the cache, without cache lock held. */
+typedef void (*dm_stream_cache_changed_cb_t)(dm_stream_cache *cache, void *userdata);
+
+dm_stream_cache *dm_stream_cache_new(const char *module_id,
+                                     const struct hw_module_t *hwmod,
+                                     const audio_hw_device_t *device,
+                                     dm_stream_cache_changed_cb_t changed_cb,
+                                     void *userdata);
+/* Unsaved changes are written before freeing. */
+void dm_stream_cache_free(dm_stream_cache *cache);
+/* Write cache file if there are unsaved changes. */
+void dm_stream_cache_save(dm_stream_cache *cache);
+
+bool dm_stream_cache_get(dm_stream_cache *cache,
+                         const char *mix_port,
+                         audio_devices_t device,
+                         audio_source_t source,
+                         const struct audio_config *requested,
+                         struct audio_config *accepted);
+void dm_stream_cache_put(dm_stream_cache *cache,
+                         const char *mix_port,
+                         audio_devices_t device,
+                         audio_source_t source,
+                         const struct audio_config *requested,
+                         const struct audio_config *accepted);
+void dm_stream_cache_remove(dm_stream_cache *cache,
+                            const char *mix_port,
+                            audio_devices_t device,
+                            audio_source_t source,
+                            const struct audio_config *requested);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/rtclock.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "droid/droid-stream-stats.h"
+
+pa_droid_stream_stats *pa_droid_stream_stats_new(void) {
+    void *p = NULL;
+
+    /* Statistics are written by IO thread, don't share cache line with
+     * anything else. */
+    pa_assert_se(posix_memalign(&p, PA_DROID_STREAM_STATS_ALIGN, sizeof(pa_droid_stream_stats)) == 0);
+    memset(p, 0, sizeof(pa_droid_stream_stats));
+    ((pa_droid_stream_stats *) p)->started = pa_rtclock_now();
+
+    return p;
+}
+
+void pa_droid_stream_stats_free(pa_droid_stream_stats *stats) {
+    pa_assert(stats);
+
+    free(stats);
+}
+
+void pa_droid_stream_stats_reset(pa_droid_stream_stats *stats) {
+    pa_assert(stats);
+
+    pa_atomic_store(&stats->reset, 1);
+}
+
+void pa_droid_stream_stats_do_reset(pa_droid_stream_stats *stats) {
+    pa_assert(stats);
+
+    memset((uint8_t *) stats + offsetof(pa_droid_stream_stats, started), 0,
+           sizeof(*stats) - offsetof(pa_droid_stream_stats, started));
+    stats->started = pa_rtclock_now();
+    pa_atomic_store(&stats->reset, 0);
+}
+
+static uint64_t isqrt(uint64_t v) {
+    uint64_t r = 0, bit = (uint64_t) 1 << 62;
+
+    while (bit > v)
+        bit >>= 2;
+
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else
+            r >>= 1;
+        bit >>= 2;
+    }
+
+    return r;
+}
+
+/* Standard deviation of wakeup lateness. */
+static uint64_t wakeup_jitter(const pa_droid_stream_stats *s) {
+    uint64_t mean, mean_sq;
+
+    if (s->wakeups == 0)
+        return 0;
+
+    mean = s->wakeup_late_total / s->wakeups;
+    mean_sq = s->wakeup_late_sq_total / s->wakeups;
+
+    return mean_sq > mean * mean ? isqrt(mean_sq - mean * mean) : 0;
+}
+
+void pa_droid_stream_stats_get(const pa_droid_stream_stats *stats, pa_droid_stream_stats *snapshot) {
+    int seq;
+
+    pa_assert(stats);
+    pa_assert(snapshot);
+
+    for (;;) {
+        if ((seq = pa_atomic_load(&stats->seq)) & 1)
+            continue;
+
+        memcpy(snapshot, stats, sizeof(*snapshot));
+
+        if (pa_atomic_load(&stats->seq) == seq)
+            break;
+    }
+}
+
+void pa_droid_stream_stats_to_json(const pa_droid_stream_stats *s, pa_strbuf *buf) {
+    pa_usec_t elapsed;
+
+    pa_assert(s);
+    pa_assert(buf);
+
+    elapsed = pa_rtclock_now() - s->started;
+
+    pa_strbuf_printf(buf,
+                     "\"elapsed_usec\":%llu,"
+                     "\"frames\":%llu,"
+                     "\"io_count\":%llu,"
+                     "\"io_time_min_usec\":%llu,"
+                     "\"io_time_avg_usec\":%llu,"
+                     "\"io_time_max_usec\":%llu,"
+                     "\"wakeups\":%llu,"
+                     "\"wakeup_late_avg_usec\":%llu,"
+                     "\"wakeup_late_max_usec\":%llu,"
+                     "\"wakeup_jitter_usec\":%llu,"
+                     "\"wakeups_per_sec\":%llu,"
+                     "\"late_wakeups\":%llu,"
+                     "\"underruns\":%llu,"
+                     "\"cpu_per_wakeup_avg_usec\":%llu,"
+                     "\"cpu_per_wakeup_max_usec\":%llu,"
+                     "\"cpu_load_permille\":%llu,"
+                     "\"device_latency_usec\":%llu,"
+                     "\"device_latency_max_usec\":%llu,"
+                     "\"short_writes\":%llu,"
+                     "\"errors\":%llu,"
+                     "\"silence_periods\":%llu,"
+                     "\"silence_frames\":%llu,"
+                     "\"rewinds\":%llu,"
+                     "\"suspends\":%llu,"
+                     "\"resumes\":%llu",
+                     (unsigned long long) elapsed,
+                     (unsigned long long) s->frames,
+                     (unsigned long long) s->io_count,
+                     (unsigned long long) s->io_time_min,
+                     (unsigned long long) (s->io_count ? s->io_time_total / s->io_count : 0),
+                     (unsigned long long) s->io_time_max,
+                     (unsigned long long) s->wakeups,
+                     (unsigned long long) (s->wakeups ? s->wakeup_late_total / s->wakeups : 0),
+                     (unsigned long long) s->wakeup_late_max,
+                     (unsigned long long) wakeup_jitter(s),
+                     (unsigned long long) (elapsed ? s->wakeups * PA_USEC_PER_SEC / elapsed : 0),
+                     (unsigned long long) s->late_wakeups,
+                     (unsigned long long) s->underruns,
+                     (unsigned long long) (s->cpu_count ? s->cpu_time_total / s->cpu_count : 0),
+                     (unsigned long long) s->cpu_time_max,
+                     (unsigned long long) (elapsed ? s->cpu_time_total * 1000 / elapsed : 0),
+                     (unsigned long long) s->device_latency,
+                     (unsigned long long) s->device_latency_max,
+                     (unsigned long long) s->short_writes,
+                     (unsigned long long) s->errors,
+                     (unsigned long long) s->silence_periods,
+                     (unsigned long long) s->silence_frames,
+                     (unsigned long long) s->rewinds,
+                     (unsigned long long) s->suspends,
+                     (unsigned long long) s->resumes);
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "droid/droid-trace.h"
+
+#define TRACE_LINE_MAX (256)
+
+static const char * const trace_marker_paths[] = {
+    "/sys/kernel/tracing/trace_marker",
+    "/sys/kernel/debug/tracing/trace_marker",
+};
+
+pa_atomic_t pa_droid_trace_enabled_flag = PA_ATOMIC_INIT(0);
+
+/* Opened when tracing is enabled the first time and kept open, so that IO
+ * threads never see it closed under them. */
+static int trace_fd = -1;
+static pid_t trace_pid;
+
+bool pa_droid_trace_set_enabled(bool enabled) {
+    unsigned i;
+
+    if (!enabled) {
+        if (pa_atomic_load(&pa_droid_trace_enabled_flag))
+            pa_log_info("Tracing disabled.");
+        pa_atomic_store(&pa_droid_trace_enabled_flag, 0);
+        return true;
+    }
+
+    if (trace_fd < 0) {
+        for (i = 0; i < PA_ELEMENTSOF(trace_marker_paths) && trace_fd < 0; i++) {
+            if ((trace_fd = pa_open_cloexec(trace_marker_paths[i], O_WRONLY, 0)) < 0)
+                pa_log_debug("Couldn't open %s: %s", trace_marker_paths[i], pa_cstrerror(errno));
+            else
+                pa_log_info("Tracing to %s", trace_marker_paths[i]);
+        }
+
+        if (trace_fd < 0) {
+            pa_log_warn("Couldn't enable tracing, trace_marker not available.");
+            return false;
+        }
+
+        trace_pid = getpid();
+    }
+
+    pa_atomic_store(&pa_droid_trace_enabled_flag, 1);
+
+    return true;
+}
+
+static void trace_write(char *line, int len) {
+    if (len <= 0)
+        return;
+
+    if (len >= TRACE_LINE_MAX)
+        len = TRACE_LINE_MAX - 1;
+
+    /* Nothing sensible to do if writing fails, and logging from IO thread
+     * would be worse than losing a tracepoint. */
+    if (write(trace_fd, line, len) < 0)
+        return;
+}
+
+static void trace_vformat(char type, const char *format, va_list ap) {
+    char line[TRACE_LINE_MAX];
+    int len;
+
+    len = snprintf(line, sizeof(line), "%c|%d|", type, (int) trace_pid);
+    len += vsnprintf(line + len, sizeof(line) - len, format, ap);
+
+    trace_write(line, len);
+}
+
+void pa_droid_trace_begin(const char *format, ...) {
+    va_list ap;
+
+    va_start(ap, format);
+    trace_vformat('B', format, ap);
+    va_end(ap);
+}
+
+void pa_droid_trace_end(void) {
+    char line[TRACE_LINE_MAX];
+
+    trace_write(line, snprintf(line, sizeof(line), "E|%d", (int) trace_pid));
+}
+
+/* Zero length slice, shown as a marker in the timeline. */
+void pa_droid_trace_instant(const char *format, ...) {
+    va_list ap;
+
+    va_start(ap, format);
+    trace_vformat('B', format, ap);
+    va_end(ap);
+
+    pa_droid_trace_end();
+}
+
+void pa_droid_trace_counter(const char *name, int64_t value) {
+    char line[TRACE_LINE_MAX];
+
+    trace_write(line, snprintf(line, sizeof(line), "C|%d|%s|%lld", (int) trace_pid, name, (long long) value));
+}
@@ -65,6 +65,9 @@
 #include <pulsecore/mutex.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/atomic.h>
+#include <pulsecore/strbuf.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/asyncmsgq.h>
 
 #include "droid/version.h"
 #include "droid/droid-util.h"
@@ -72,6 +75,15 @@
 #include "droid/conversion.h"
 #include "droid/sllist.h"
 #include "droid/utils.h"
+#include "droid/droid-trace.h"
+#include "droid/droid-hal-api.h"
+#include "droid-stream-cache.h"
+#include "droid-file-watch.h"
+#include "droid-parameter-cache.h"
+#include "droid-startup-trace.h"
+#ifdef DROID_MOCK_HAL
+#include "droid-mock-hal.h"
+#endif
 
 struct droid_option {
     const char *name;
@@ -93,6 +105,13 @@ struct droid_option valid_options[] = {
     { "record_voice_16k",                  DM_OPTION_RECORD_VOICE_16K                  },
     { "use_legacy_stream_set_parameters",  DM_OPTION_USE_LEGACY_STREAM_SET_PARAMETERS  },
     { "usb_devices",                       DM_OPTION_USB_DEVICES                       },
+    { "stream_cache",                      DM_OPTION_STREAM_CACHE                      },
+    { "config_reload",                     DM_OPTION_CONFIG_RELOAD                     },
+    { "independent_routing",               DM_OPTION_INDEPENDENT_ROUTING               },
+    { "parameter_cache",                   DM_OPTION_PARAMETER_CACHE                   },
+    { "deferred_sinks",                    DM_OPTION_DEFERRED_SINKS                    },
+    { "hal_stats",                         DM_OPTION_HAL_STATS                         },
+    { "trace",                             DM_OPTION_TRACE                             },
 
 };
 
@@ -101,8 +120,13 @@ struct user_options {
         bool enable;
         bool set;
     } options[DM_OPTION_COUNT];
+    uint32_t parameter_cache_ttl_ms;
+    const char *mock_hal;
 };
 
+#define DM_MODARG_PARAMETER_CACHE_TTL   "parameter_cache_ttl"
+#define DM_MODARG_MOCK_HAL              "mock_hal"
+
 #define DM_OPTION_AUDIO_CAL_WAIT_S  (10)
 #define DM_OPTION_AUDIO_CAL_FILE    "/data/vendor/audio/cirrus_sony.cal"
 #define DM_OPTION_AUDIO_CAL_GROUP   "audio"
@@ -131,6 +155,7 @@ static void droid_port_free(pa_droid_port *p);
 
 static int input_stream_set_route(pa_droid_stream *stream, const dm_config_port *device_port);
 static int droid_set_parameters(pa_droid_hw_module *hw, const char *parameters);
+static void parameters_flush(pa_droid_hw_module *hw);
 static bool droid_set_audio_source(pa_droid_stream *stream, audio_source_t audio_source);
 static void add_output_ports(pa_droid_mapping *droid_mapping, dm_config_port *device_port);
 static void add_input_ports(pa_droid_mapping *droid_mapping, dm_config_port *device_port);
@@ -395,9 +420,113 @@ void pa_droid_profile_set_free(pa_droid_profile_set *ps) {
     if (ps->profiles)
         pa_hashmap_free(ps->profiles);
 
+    if (ps->removed_mappings)
+        dm_list_free(ps->removed_mappings, (pa_free_cb_t) pa_droid_mapping_free);
+
     pa_xfree(ps);
 }
 
+static bool module_has_mix_port(dm_config_module *module, dm_config_port *mix_port) {
+    dm_config_port *port;
+    void *state;
+
+    DM_LIST_FOREACH_DATA(port, module->mix_ports, state) {
+        if (port == mix_port)
+            return true;
+    }
+
+    return false;
+}
+
+static void profile_set_remove_mapping(pa_droid_profile_set *ps, pa_hashmap *map, pa_droid_mapping *am) {
+    pa_droid_profile *p;
+    void *state;
+
+    pa_hashmap_remove(map, am->name);
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state) {
+        if (p->output_mappings)
+            pa_idxset_remove_by_data(p->output_mappings, am, NULL);
+        if (p->input_mappings)
+            pa_idxset_remove_by_data(p->input_mappings, am, NULL);
+        if (p->input_mapping == am)
+            p->input_mapping = NULL;
+    }
+
+    /* Ports and streams may still refer to the mapping. */
+    if (!ps->removed_mappings)
+        ps->removed_mappings = dm_list_new();
+    dm_list_push_back(ps->removed_mappings, am);
+}
+
+void pa_droid_profile_set_update(pa_droid_profile_set *ps, dm_config_module *module,
+                                 pa_idxset *added, pa_idxset *removed) {
+    pa_droid_profile *profile;
+    pa_droid_mapping *am;
+    dm_config_route *route;
+    dm_config_port *port;
+    pa_idxset *new_mix_ports;
+    void *state, *state2;
+    uint32_t idx;
+
+    pa_assert(ps);
+    pa_assert(module);
+    pa_assert(added);
+    pa_assert(removed);
+
+    /* Mappings of removed mix ports. */
+    PA_HASHMAP_FOREACH(am, ps->output_mappings, state) {
+        if (am->module != module || module_has_mix_port(module, am->mix_port))
+            continue;
+
+        if (pa_droid_mapping_is_primary(am)) {
+            pa_log_warn("Primary output mix port \"%s\" removed from configuration, keeping it.", am->name);
+            continue;
+        }
+
+        pa_idxset_put(removed, am, NULL);
+    }
+
+    PA_HASHMAP_FOREACH(am, ps->input_mappings, state) {
+        if (am->module == module && !module_has_mix_port(module, am->mix_port))
+            pa_idxset_put(removed, am, NULL);
+    }
+
+    PA_IDXSET_FOREACH(am, removed, idx) {
+        pa_log_info("Remove %s mapping \"%s\"", am->direction == PA_DIRECTION_OUTPUT ? "output" : "input", am->name);
+        profile_set_remove_mapping(ps, am->direction == PA_DIRECTION_OUTPUT ? ps->output_mappings : ps->input_mappings, am);
+    }
+
+    /* Mappings for new mix ports, from their routes as in auto_add_profiles(). */
+    if (!(profile = pa_hashmap_get(ps->profiles, "default")))
+        return;
+
+    new_mix_ports = pa_idxset_new(NULL, NULL);
+
+    DM_LIST_FOREACH_DATA(port, module->mix_ports, state) {
+        if (!pa_hashmap_get(port->role == DM_CONFIG_ROLE_SOURCE ? ps->output_mappings : ps->input_mappings, port->name))
+            pa_idxset_put(new_mix_ports, port, NULL);
+    }
+
+    if (!pa_idxset_isempty(new_mix_ports)) {
+        DM_LIST_FOREACH_DATA(route, module->routes, state) {
+            DM_LIST_FOREACH_DATA(port, route->sources, state2) {
+                if (pa_idxset_get_by_data(new_mix_ports, port, NULL) ||
+                    pa_idxset_get_by_data(new_mix_ports, route->sink, NULL))
+                    update_mapping(ps, profile, module, port, route->sink);
+            }
+        }
+
+        PA_IDXSET_FOREACH(port, new_mix_ports, idx) {
+            if ((am = pa_hashmap_get(port->role == DM_CONFIG_ROLE_SOURCE ? ps->output_mappings : ps->input_mappings,
+                                     port->name)))
+                pa_idxset_put(added, am, NULL);
+        }
+    }
+
+    pa_idxset_free(new_mix_ports, NULL);
+}
+
 static pa_droid_port *create_output_port(pa_droid_mapping *am,
                                          dm_config_port *device_port,
                                          const char *name,
@@ -701,6 +830,7 @@ static void set_options(pa_droid_options *options,
     options->enabled[DM_OPTION_OUTPUT_DEEP_BUFFER] = true;
     options->enabled[DM_OPTION_HW_VOLUME] = true;
     options->enabled[DM_OPTION_OUTPUT_VOIP_RX] = true;
+    options->enabled[DM_OPTION_STREAM_CACHE] = true;
 
 #if (ANDROID_VERSION_MAJOR >= 5) || defined(DROID_AUDIO_HAL_ATOI_FIX)
     options->enabled[DM_OPTION_INPUT_ATOI] = true;
@@ -738,6 +868,25 @@ static bool droid_options_parse(struct user_options *user_options, pa_modargs *m
         }
     }
 
+    if (pa_modargs_get_value_u32(ma, DM_MODARG_PARAMETER_CACHE_TTL, &user_options->parameter_cache_ttl_ms) < 0) {
+        pa_log("Failed to parse %s (needs time in milliseconds).", DM_MODARG_PARAMETER_CACHE_TTL);
+        return false;
+    }
+
+    user_options->mock_hal = pa_modargs_get_value(ma, DM_MODARG_MOCK_HAL, NULL);
+#ifndef DROID_MOCK_HAL
+    if (user_options->mock_hal) {
+        pa_log("%s given but mock audio HAL support is not compiled in.", DM_MODARG_MOCK_HAL);
+        return false;
+    }
+#endif
+#ifndef HAVE_HYBRIS
+    if (!user_options->mock_hal) {
+        pa_log("Built without libhardware, %s is required.", DM_MODARG_MOCK_HAL);
+        return false;
+    }
+#endif
+
     return true;
 }
 
@@ -839,36 +988,43 @@ static char *shared_name_get(const char *module_id) {
     return pa_sprintf_malloc("droid-hardware-module-%s", module_id);
 }
 
-static void option_audio_cal(pa_droid_hw_module *hw, uint32_t flags) {
-    struct group *grp;
+/* Record stream open as startup phase until card has finished starting up. */
+static void startup_trace_stream_open(pa_droid_hw_module *hw, const char *what,
+                                      const dm_config_port *mix_port, pa_usec_t begin) {
+    char *name;
 
+    if (!hw->startup_trace || dm_startup_trace_finished(hw->startup_trace))
+        return;
+
+    name = pa_sprintf_malloc("%s %s", what, mix_port->name);
+    dm_startup_trace_add(hw->startup_trace, name, begin);
+    pa_xfree(name);
+}
+
+static void audio_cal_done(pa_droid_hw_module *hw) {
     pa_assert(hw);
 
-    if (!pa_droid_option(hw, DM_OPTION_AUDIO_CAL_WAIT))
-        return;
+    if (hw->audio_cal.watch) {
+        dm_file_watch_free(hw->audio_cal.watch);
+        hw->audio_cal.watch = NULL;
+    }
 
-    if (access(DM_OPTION_AUDIO_CAL_FILE, F_OK) == 0) {
-        if (flags & AUDIO_OUTPUT_FLAG_PRIMARY) {
-            pa_log_info("Waiting for audio calibration to load.");
-            /* 1 second is enough, so let's double that. */
-            pa_msleep(2 * PA_MSEC_PER_SEC);
-        }
-        return;
+    if (hw->audio_cal.timer) {
+        hw->core->mainloop->time_free(hw->audio_cal.timer);
+        hw->audio_cal.timer = NULL;
     }
 
-    pa_log_info("Waiting for audio calibration to finish... (%d seconds)", DM_OPTION_AUDIO_CAL_WAIT_S);
+    hw->audio_cal.state = DM_AUDIO_CAL_DONE;
 
-    /* First wait until the calibration file appears on file system. */
-    for (int i = 0; i < DM_OPTION_AUDIO_CAL_WAIT_S; i++) {
-        pa_log_debug("%d...", DM_OPTION_AUDIO_CAL_WAIT_S - i);
-        pa_msleep(PA_MSEC_PER_SEC);
-        if (access(DM_OPTION_AUDIO_CAL_FILE, F_OK) == 0) {
-            pa_log_debug("Calibration file " DM_OPTION_AUDIO_CAL_FILE " appeared, wait one second more.");
-            /* Then wait for a bit more. */
-            pa_msleep(PA_MSEC_PER_SEC);
-            break;
-        }
-    }
+    if (hw->startup_trace)
+        dm_startup_trace_add(hw->startup_trace, "audio_cal", hw->audio_cal.started);
+
+    pa_hook_fire(&hw->audio_cal.done_hook, hw);
+}
+
+/* Calibration file has been written, fix permissions so that HAL can read it. */
+static void audio_cal_file_ready(pa_droid_hw_module *hw) {
+    struct group *grp;
 
     if (access(DM_OPTION_AUDIO_CAL_FILE, F_OK) != 0)
         goto fail;
@@ -889,6 +1045,7 @@ static void option_audio_cal(pa_droid_hw_module *hw, uint32_t flags) {
     }
 
     pa_log_info("Done waiting for audio calibration.");
+    audio_cal_done(hw);
 
     return;
 
@@ -897,6 +1054,223 @@ fail:
         unlink(DM_OPTION_AUDIO_CAL_FILE);
 
     pa_log("Audio calibration file generation failed! (" DM_OPTION_AUDIO_CAL_FILE " doesn't exist)");
+    audio_cal_done(hw);
+}
+
+static void audio_cal_watch_cb(dm_file_watch *watch, void *userdata) {
+    pa_droid_hw_module *hw = userdata;
+
+    pa_assert(hw);
+
+    if (access(DM_OPTION_AUDIO_CAL_FILE, F_OK) != 0)
+        return;
+
+    pa_log_debug("Calibration file " DM_OPTION_AUDIO_CAL_FILE " appeared.");
+    audio_cal_file_ready(hw);
+}
+
+static void audio_cal_timer_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_droid_hw_module *hw = userdata;
+
+    pa_assert(hw);
+
+    if (hw->audio_cal.state == DM_AUDIO_CAL_LOADING) {
+        pa_log_info("Audio calibration loaded.");
+        audio_cal_done(hw);
+    } else
+        audio_cal_file_ready(hw);
+}
+
+/* Certain HALs do audio calibration when first output is opened, and writing
+ * audio too early breaks the calibration. Instead of blocking, track
+ * calibration state and let sinks stay suspended while it is pending, see
+ * pa_droid_hw_audio_cal_pending(). */
+static void option_audio_cal(pa_droid_hw_module *hw, uint32_t flags) {
+    char *dir;
+
+    pa_assert(hw);
+
+    if (!pa_droid_option(hw, DM_OPTION_AUDIO_CAL_WAIT))
+        return;
+
+    if (hw->audio_cal.state != DM_AUDIO_CAL_IDLE)
+        return;
+
+    hw->audio_cal.started = pa_rtclock_now();
+
+    if (access(DM_OPTION_AUDIO_CAL_FILE, F_OK) == 0) {
+        if (flags & AUDIO_OUTPUT_FLAG_PRIMARY) {
+            pa_log_info("Waiting for audio calibration to load.");
+            hw->audio_cal.state = DM_AUDIO_CAL_LOADING;
+            /* 1 second is enough, so let's double that. */
+            hw->audio_cal.timer = pa_core_rttime_new(hw->core, pa_rtclock_now() + 2 * PA_USEC_PER_SEC,
+                                                     audio_cal_timer_cb, hw);
+        }
+        return;
+    }
+
+    pa_log_info("Waiting for audio calibration to finish... (%d seconds)", DM_OPTION_AUDIO_CAL_WAIT_S);
+
+    hw->audio_cal.state = DM_AUDIO_CAL_WAITING;
+
+    /* Wait until the calibration file is written, and then for one second more
+     * in case it is rewritten. If the directory cannot be watched the file is
+     * checked once the timeout expires. */
+    dir = pa_parent_dir(DM_OPTION_AUDIO_CAL_FILE);
+    hw->audio_cal.watch = dm_file_watch_new(hw->core, dir, pa_path_get_filename(DM_OPTION_AUDIO_CAL_FILE),
+                                            PA_USEC_PER_SEC, audio_cal_watch_cb, hw);
+    pa_xfree(dir);
+
+    hw->audio_cal.timer = pa_core_rttime_new(hw->core, pa_rtclock_now() + DM_OPTION_AUDIO_CAL_WAIT_S * PA_USEC_PER_SEC,
+                                             audio_cal_timer_cb, hw);
+}
+
+bool pa_droid_hw_audio_cal_pending(pa_droid_hw_module *hw) {
+    pa_assert(hw);
+
+    return hw->audio_cal.state == DM_AUDIO_CAL_LOADING || hw->audio_cal.state == DM_AUDIO_CAL_WAITING;
+}
+
+void pa_droid_hw_startup_phase(pa_droid_hw_module *hw, const char *name, pa_usec_t begin) {
+    pa_assert(hw);
+    pa_assert(name);
+
+    if (hw->startup_trace && !dm_startup_trace_finished(hw->startup_trace))
+        dm_startup_trace_add(hw->startup_trace, name, begin);
+}
+
+void pa_droid_hw_startup_finish(pa_droid_hw_module *hw) {
+    pa_assert(hw);
+
+    if (hw->startup_trace)
+        dm_startup_trace_finish(hw->startup_trace);
+}
+
+char *pa_droid_hw_startup_report(pa_droid_hw_module *hw) {
+    pa_assert(hw);
+
+    if (!hw->startup_trace)
+        return NULL;
+
+    return dm_startup_trace_to_string(hw->startup_trace);
+}
+
+static void hal_stats_streams_to_json(pa_idxset *streams, const char *direction, bool *first, pa_strbuf *buf) {
+    pa_droid_stream *s;
+    uint32_t idx;
+
+    PA_IDXSET_FOREACH(s, streams, idx) {
+        if (!s->hal_stats)
+            continue;
+
+        pa_strbuf_printf(buf, "%s{\"direction\":\"%s\",\"mix_port\":\"%s\",\"io_handle\":%d,\"calls\":",
+                         *first ? "" : ",", direction, s->mix_port->name, (int) s->io_handle);
+        pa_droid_hal_stats_to_json(s->hal_stats, buf);
+        pa_strbuf_putc(buf, '}');
+        *first = false;
+    }
+}
+
+/* {"module":{<calls>},"streams":[{"direction":"output","mix_port":"...","io_handle":N,"calls":{<calls>}},...]}
+ * Calls of closed streams are included in module calls. */
+char *pa_droid_hw_hal_stats_report(pa_droid_hw_module *hw) {
+    pa_strbuf *buf;
+    bool first = true;
+
+    pa_assert(hw);
+
+    if (!hw->hal_stats)
+        return NULL;
+
+    buf = pa_strbuf_new();
+
+    pa_strbuf_puts(buf, "{\"module\":");
+    pa_droid_hw_module_lock(hw);
+    pa_droid_hal_stats_to_json(hw->hal_stats, buf);
+    pa_droid_hw_module_unlock(hw);
+    pa_strbuf_puts(buf, ",\"streams\":[");
+
+    pa_mutex_lock(hw->output_mutex);
+    hal_stats_streams_to_json(hw->outputs, "output", &first, buf);
+    pa_mutex_unlock(hw->output_mutex);
+    hal_stats_streams_to_json(hw->inputs, "input", &first, buf);
+
+    pa_strbuf_puts(buf, "]}");
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+static void stream_stats_to_json(pa_idxset *streams, const char *direction, bool *first, pa_strbuf *buf) {
+    pa_droid_stream_stats snapshot;
+    pa_droid_stream *s;
+    uint32_t idx;
+
+    PA_IDXSET_FOREACH(s, streams, idx) {
+        pa_droid_stream_stats_get(s->stats, &snapshot);
+
+        pa_strbuf_printf(buf, "%s{\"direction\":\"%s\",\"mix_port\":\"%s\",\"io_handle\":%d,",
+                         *first ? "" : ",", direction, s->mix_port->name, (int) s->io_handle);
+        pa_droid_stream_stats_to_json(&snapshot, buf);
+        pa_strbuf_putc(buf, '}');
+        *first = false;
+    }
+}
+
+/* [{"direction":"output","mix_port":"...","io_handle":N,"frames":N,...},...] */
+char *pa_droid_hw_stream_stats_report(pa_droid_hw_module *hw) {
+    pa_strbuf *buf;
+    bool first = true;
+
+    pa_assert(hw);
+
+    buf = pa_strbuf_new();
+    pa_strbuf_putc(buf, '[');
+
+    pa_mutex_lock(hw->output_mutex);
+    stream_stats_to_json(hw->outputs, "output", &first, buf);
+    pa_mutex_unlock(hw->output_mutex);
+    stream_stats_to_json(hw->inputs, "input", &first, buf);
+
+    pa_strbuf_putc(buf, ']');
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+void pa_droid_hw_stream_stats_reset(pa_droid_hw_module *hw) {
+    pa_droid_stream *s;
+    uint32_t idx;
+
+    pa_assert(hw);
+
+    pa_mutex_lock(hw->output_mutex);
+    PA_IDXSET_FOREACH(s, hw->outputs, idx)
+        pa_droid_stream_stats_reset(s->stats);
+    pa_mutex_unlock(hw->output_mutex);
+
+    PA_IDXSET_FOREACH(s, hw->inputs, idx)
+        pa_droid_stream_stats_reset(s->stats);
+}
+
+void pa_droid_hw_hal_stats_reset(pa_droid_hw_module *hw) {
+    pa_droid_stream *s;
+    uint32_t idx;
+
+    pa_assert(hw);
+
+    if (!hw->hal_stats)
+        return;
+
+    pa_droid_hw_module_lock(hw);
+    pa_droid_hal_stats_reset(hw->hal_stats);
+    pa_droid_hw_module_unlock(hw);
+
+    pa_mutex_lock(hw->output_mutex);
+    PA_IDXSET_FOREACH(s, hw->outputs, idx)
+        pa_droid_hal_stats_reset(s->hal_stats);
+    pa_mutex_unlock(hw->output_mutex);
+
+    PA_IDXSET_FOREACH(s, hw->inputs, idx)
+        pa_droid_hal_stats_reset(s->hal_stats);
 }
 
 static int droid_set_parameters_v1_cb(void *handle, const char *key_value_pairs) {
@@ -909,37 +1283,193 @@ static int droid_set_parameters_v1_cb(void *handle, const char *key_value_pairs)
     pa_log_debug(DROID_SET_PARAMETERS_V1 "(\"%s\")", key_value_pairs);
 
     pa_droid_hw_module_lock(hw);
-    ret = hw->device->set_parameters(hw->device, key_value_pairs);
+    parameters_flush(hw);
+    PA_DROID_HAL_TIMED(hw->hal_stats, PA_DROID_HAL_CALL_SET_PARAMETERS,
+                       ret = hw->device->set_parameters(hw->device, key_value_pairs));
+    if (hw->parameter_cache)
+        dm_parameter_cache_invalidate(hw->parameter_cache, key_value_pairs);
     pa_droid_hw_module_unlock(hw);
 
     if (ret != 0)
         pa_log_warn(DROID_SET_PARAMETERS_V1 "(\"%s\") failed: %d", key_value_pairs, ret);
+    else if (hw->hal_api)
+        dm_hal_api_notify(hw->hal_api, key_value_pairs);
 
     return ret;
 }
 
 static char *droid_get_parameters_v1_cb(void *handle, const char *keys) {
     pa_droid_hw_module *hw = handle;
-    char *key_value_pairs = NULL;
+    char *key_value_pairs;
+    char *ret = NULL;
 
     pa_assert(hw);
     pa_assert(keys);
 
+    key_value_pairs = pa_droid_get_parameters(hw, keys);
+
+    pa_log_debug(DROID_GET_PARAMETERS_V1 "(\"%s\"): \"%s\"", keys, key_value_pairs ? key_value_pairs : "<null>");
+
+    /* Callers free the result with free() as with HAL get_parameters(). */
+    if (key_value_pairs) {
+        ret = strdup(key_value_pairs);
+        pa_xfree(key_value_pairs);
+    }
+
+    return ret;
+}
+
+/* Configuration files are often replaced with a few writes or renames in a
+ * row, wait for things to settle before parsing. */
+#define CONFIG_RELOAD_SETTLE_TIME   (500 * PA_USEC_PER_MSEC)
+
+static void config_changed_cb(dm_file_watch *watch, void *userdata) {
+    pa_droid_hw_module *hw = userdata;
+    dm_config_device *config;
+    dm_config_module *module;
+    bool changed;
+
+    pa_assert(hw);
+
+    pa_log_info("Configuration %s changed, reloading.", hw->config->filename);
+
+    if (!(config = pa_parse_droid_audio_config(hw->config->filename))) {
+        pa_log_warn("Failed to parse %s, keeping current configuration.", hw->config->filename);
+        return;
+    }
+
+    if (!(module = dm_config_find_module(config, hw->module_id))) {
+        pa_log_warn("Module %s missing from %s, keeping current configuration.", hw->module_id, hw->config->filename);
+        goto done;
+    }
+
     pa_droid_hw_module_lock(hw);
-    key_value_pairs = hw->device->get_parameters(hw->device, keys);
+    changed = dm_config_module_update(hw->enabled_module, module);
     pa_droid_hw_module_unlock(hw);
 
-    pa_log_debug(DROID_GET_PARAMETERS_V1 "(\"%s\"): \"%s\"", keys, key_value_pairs ? key_value_pairs : "<null>");
+    if (changed) {
+        pa_log_info("Configuration for module %s updated.", hw->module_id);
+        pa_hook_fire(&hw->config_changed_hook, hw);
+    } else
+        pa_log_debug("No changes to configuration of module %s.", hw->module_id);
+
+done:
+    dm_config_free(config);
+}
+
+/* Messages from IO threads to main thread */
+
+typedef void (*hw_main_cb_t)(pa_droid_hw_module *hw, void *userdata);
+
+typedef struct droid_hw_msg {
+    pa_msgobject parent;
+    pa_droid_hw_module *hw; /* NULL once hw module is closed */
+} droid_hw_msg;
+
+PA_DEFINE_PRIVATE_CLASS(droid_hw_msg, pa_msgobject);
+#define DROID_HW_MSG(o) (droid_hw_msg_cast(o))
+
+enum {
+    DROID_HW_MESSAGE_CALL,
+};
+
+struct hw_main_call {
+    hw_main_cb_t cb;
+    void *userdata;
+    pa_free_cb_t free_cb;
+};
+
+static void hw_main_call_free(void *p) {
+    struct hw_main_call *call = p;
+
+    if (call->free_cb)
+        call->free_cb(call->userdata);
+    pa_xfree(call);
+}
+
+/* Called from main thread. */
+static int droid_hw_msg_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    droid_hw_msg *msg = DROID_HW_MSG(o);
+    struct hw_main_call *call = data;
+
+    switch (code) {
+        case DROID_HW_MESSAGE_CALL:
+            if (msg->hw)
+                call->cb(msg->hw, call->userdata);
+            return 0;
+    }
+
+    return 0;
+}
+
+/* Run cb in main thread. When called from main thread cb is run right away,
+ * from IO threads it is posted to the main thread and run later. Userdata is
+ * freed with free_cb afterwards, also if cb never gets to run. */
+static void hw_run_in_main(pa_droid_hw_module *hw, hw_main_cb_t cb, void *userdata, pa_free_cb_t free_cb) {
+    pa_thread_mq *mq;
+    struct hw_main_call *call;
+
+    pa_assert(hw);
+    pa_assert(cb);
+
+    if (!(mq = pa_thread_mq_get())) {
+        cb(hw, userdata);
+        if (free_cb)
+            free_cb(userdata);
+        return;
+    }
+
+    call = pa_xnew(struct hw_main_call, 1);
+    call->cb = cb;
+    call->userdata = userdata;
+    call->free_cb = free_cb;
+    pa_asyncmsgq_post(mq->outq, hw->main_msg, DROID_HW_MESSAGE_CALL, call, 0, NULL, hw_main_call_free);
+}
+
+static void stream_cache_defer_cb(pa_mainloop_api *api, pa_defer_event *e, void *userdata) {
+    pa_droid_hw_module *hw = userdata;
+
+    api->defer_enable(e, 0);
+    dm_stream_cache_save(hw->stream_cache);
+}
+
+static void stream_cache_schedule_save(pa_droid_hw_module *hw, void *userdata) {
+    hw->core->mainloop->defer_enable(hw->stream_cache_defer, 1);
+}
+
+/* Called from the thread opening streams. */
+static void stream_cache_changed_cb(dm_stream_cache *cache, void *userdata) {
+    hw_run_in_main(userdata, stream_cache_schedule_save, NULL, NULL);
+}
+
+static void config_watch_start(pa_droid_hw_module *hw) {
+    char *directory;
+
+    if (!hw->config->filename) {
+        pa_log_info("Configuration file not known, config_reload disabled.");
+        return;
+    }
 
-    return key_value_pairs;
+    /* Watch the whole directory as included files are usually next to the
+     * main configuration file. */
+    directory = pa_parent_dir(hw->config->filename);
+    hw->config_watch = dm_file_watch_new(hw->core, directory, NULL, CONFIG_RELOAD_SETTLE_TIME,
+                                         config_changed_cb, hw);
+    pa_xfree(directory);
 }
 
+/* Takes ownership of trace, which may be NULL. */
 static pa_droid_hw_module *droid_hw_module_open(pa_core *core, dm_config_device *config,
-                                                const char *module_id, const struct user_options *user_options) {
+                                                const char *module_id, const struct user_options *user_options,
+                                                dm_startup_trace *trace) {
     const dm_config_module *module;
     pa_droid_hw_module *hw = NULL;
     struct hw_module_t *hwmod = NULL;
     audio_hw_device_t *device = NULL;
+#ifdef DROID_MOCK_HAL
+    bool mock = false;
+#endif
+    pa_usec_t begin;
     int ret;
 
     pa_assert(core);
@@ -957,7 +1487,20 @@ static pa_droid_hw_module *droid_hw_module_open(pa_core *core, dm_config_device
         goto fail;
     }
 
+    begin = pa_rtclock_now();
+#ifdef DROID_MOCK_HAL
+    if (user_options && user_options->mock_hal) {
+        ret = dm_mock_hal_get_module(module->name, user_options->mock_hal, (const hw_module_t**) &hwmod);
+        mock = true;
+    } else
+#endif
+#ifdef HAVE_HYBRIS
     ret = hw_get_module_by_class(AUDIO_HARDWARE_MODULE_ID, module->name, (const hw_module_t**) &hwmod);
+#else
+    ret = -ENOSYS;
+#endif
+    if (trace)
+        dm_startup_trace_add(trace, "hw_get_module_by_class", begin);
     if (ret) {
         pa_log("Failed to load audio hw module %s.%s : %s (%d)", AUDIO_HARDWARE_MODULE_ID, module->name,
                                                                  strerror(-ret), -ret);
@@ -966,7 +1509,10 @@ static pa_droid_hw_module *droid_hw_module_open(pa_core *core, dm_config_device
 
     pa_log_info("Loaded hw module %s.%s (%s)", AUDIO_HARDWARE_MODULE_ID, module->name, DROID_DEVICE_STRING);
 
+    begin = pa_rtclock_now();
     ret = audio_hw_device_open(hwmod, &device);
+    if (trace)
+        dm_startup_trace_add(trace, "audio_hw_device_open", begin);
     if (ret) {
         pa_log("Failed to open audio hw device : %s (%d).", strerror(-ret), -ret);
         goto fail;
@@ -977,7 +1523,11 @@ static pa_droid_hw_module *droid_hw_module_open(pa_core *core, dm_config_device
                 AUDIO_API_VERSION_MAJ, AUDIO_API_VERSION_MIN,
                 ANDROID_VERSION_MAJOR, ANDROID_VERSION_MINOR, ANDROID_VERSION_PATCH);
 
-    if ((ret = device->init_check(device)) != 0) {
+    begin = pa_rtclock_now();
+    ret = device->init_check(device);
+    if (trace)
+        dm_startup_trace_add(trace, "init_check", begin);
+    if (ret != 0) {
         pa_log("Failed init_check() : %s (%d)", strerror(-ret), -ret);
         goto fail;
     }
@@ -991,12 +1541,40 @@ static pa_droid_hw_module *droid_hw_module_open(pa_core *core, dm_config_device
     hw->output_mutex = pa_mutex_new(true, false);
     hw->input_mutex = pa_mutex_new(true, false);
     hw->device = device;
+    begin = pa_rtclock_now();
     hw->config = dm_config_dup(config);
+    if (trace)
+        dm_startup_trace_add(trace, "dm_config_dup", begin);
     hw->enabled_module = dm_config_find_module(hw->config, module_id);
     hw->module_id = hw->enabled_module->name;
     hw->shared_name = shared_name_get(hw->module_id);
     hw->outputs = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    hw->parameters_queue = dm_list_new();
+    hw->startup_trace = trace;
+    pa_hook_init(&hw->audio_cal.done_hook, hw);
+    pa_hook_init(&hw->config_changed_hook, hw);
     hw->inputs = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    hw->main_msg = PA_MSGOBJECT(pa_msgobject_new(droid_hw_msg));
+    hw->main_msg->process_msg = droid_hw_msg_process_msg;
+    DROID_HW_MSG(hw->main_msg)->hw = hw;
+
+    if (pa_droid_option(hw, DM_OPTION_STREAM_CACHE) &&
+        (hw->stream_cache = dm_stream_cache_new(hw->module_id, hwmod, device, stream_cache_changed_cb, hw))) {
+        hw->stream_cache_defer = core->mainloop->defer_new(core->mainloop, stream_cache_defer_cb, hw);
+        core->mainloop->defer_enable(hw->stream_cache_defer, 0);
+    }
+
+    if (pa_droid_option(hw, DM_OPTION_CONFIG_RELOAD))
+        config_watch_start(hw);
+
+    if (pa_droid_option(hw, DM_OPTION_HAL_STATS))
+        hw->hal_stats = pa_droid_hal_stats_new();
+
+    if (pa_droid_option(hw, DM_OPTION_TRACE))
+        pa_droid_trace_set_enabled(true);
+
+    if (pa_droid_option(hw, DM_OPTION_PARAMETER_CACHE))
+        hw->parameter_cache = dm_parameter_cache_new(user_options->parameter_cache_ttl_ms * PA_USEC_PER_MSEC);
 
     hw->sink_put_hook_slot      = pa_hook_connect(&core->hooks[PA_CORE_HOOK_SINK_PUT], PA_HOOK_EARLY-10,
                                                   sink_put_hook_cb, hw);
@@ -1011,6 +1589,7 @@ static pa_droid_hw_module *droid_hw_module_open(pa_core *core, dm_config_device
         pa_shared_set(core, DROID_HW_HANDLE_V1, hw);
         pa_shared_set(core, DROID_SET_PARAMETERS_V1, droid_set_parameters_v1_cb);
         pa_shared_set(core, DROID_GET_PARAMETERS_V1, droid_get_parameters_v1_cb);
+        hw->hal_api = dm_hal_api_new(hw);
     }
 
     return hw;
@@ -1018,10 +1597,17 @@ static pa_droid_hw_module *droid_hw_module_open(pa_core *core, dm_config_device
 fail:
     if (device)
         audio_hw_device_close(device);
+#ifdef DROID_MOCK_HAL
+    else if (mock && hwmod)
+        dm_mock_hal_free_module(hwmod);
+#endif
 
     if (hw)
         pa_xfree(hw);
 
+    if (trace)
+        dm_startup_trace_free(trace);
+
     return NULL;
 }
 
@@ -1046,6 +1632,8 @@ pa_droid_hw_module *pa_droid_hw_module_get2(pa_core *core, pa_modargs *ma, const
     pa_droid_hw_module *hw = NULL;
     dm_config_device *config = NULL;
     struct user_options user_options;
+    dm_startup_trace *trace;
+    pa_usec_t begin;
 
     pa_assert(core);
     pa_assert(ma);
@@ -1062,10 +1650,18 @@ pa_droid_hw_module *pa_droid_hw_module_get2(pa_core *core, pa_modargs *ma, const
     if (!droid_options_parse(&user_options, ma))
         return NULL;
 
-    if (!(config = dm_config_load(ma)))
+    trace = dm_startup_trace_new();
+
+    begin = pa_rtclock_now();
+    config = dm_config_load(ma);
+    dm_startup_trace_add(trace, "dm_config_load", begin);
+
+    if (!config) {
+        dm_startup_trace_free(trace);
         return NULL;
+    }
 
-    hw = droid_hw_module_open(core, config, module_id, &user_options);
+    hw = droid_hw_module_open(core, config, module_id, &user_options, trace);
 
     dm_config_free(config);
 
@@ -1076,7 +1672,7 @@ pa_droid_hw_module *pa_droid_hw_module_get(pa_core *core, dm_config_device *conf
     pa_droid_hw_module *hw;
 
     if (!(hw = droid_hw_module_shared_get(core, module_id)))
-        hw = droid_hw_module_open(core, config, module_id, NULL);
+        hw = droid_hw_module_open(core, config, module_id, NULL, NULL);
 
     return hw;
 }
@@ -1100,13 +1696,59 @@ static void droid_hw_module_close(pa_droid_hw_module *hw) {
         pa_shared_remove(hw->core, DROID_GET_PARAMETERS_V1);
     }
 
-    if (hw->sink_put_hook_slot)
-        pa_hook_slot_free(hw->sink_put_hook_slot);
-    if (hw->sink_unlink_hook_slot)
-        pa_hook_slot_free(hw->sink_unlink_hook_slot);
+    if (hw->hal_api) {
+        dm_hal_api_free(hw->hal_api);
+        hw->hal_api = NULL;
+    }
+
+    if (hw->sink_put_hook_slot)
+        pa_hook_slot_free(hw->sink_put_hook_slot);
+    if (hw->sink_unlink_hook_slot)
+        pa_hook_slot_free(hw->sink_unlink_hook_slot);
+
+    if (hw->config)
+        dm_config_free(hw->config);
+
+    if (hw->stream_cache_defer)
+        hw->core->mainloop->defer_free(hw->stream_cache_defer);
+
+    if (hw->stream_cache)
+        dm_stream_cache_free(hw->stream_cache);
+
+    if (hw->main_msg) {
+        DROID_HW_MSG(hw->main_msg)->hw = NULL;
+        pa_msgobject_unref(hw->main_msg);
+    }
+
+    if (hw->config_watch)
+        dm_file_watch_free(hw->config_watch);
+
+    if (hw->parameter_cache)
+        dm_parameter_cache_free(hw->parameter_cache);
+
+    if (hw->audio_cal.watch)
+        dm_file_watch_free(hw->audio_cal.watch);
+
+    if (hw->audio_cal.timer)
+        hw->core->mainloop->time_free(hw->audio_cal.timer);
+
+    pa_hook_done(&hw->audio_cal.done_hook);
+    pa_hook_done(&hw->config_changed_hook);
+
+    if (hw->startup_trace)
+        dm_startup_trace_free(hw->startup_trace);
 
-    if (hw->config)
-        dm_config_free(hw->config);
+    if (hw->hal_stats)
+        pa_droid_hal_stats_free(hw->hal_stats);
+
+    if (hw->parameters_queue) {
+        if (hw->device)
+            parameters_flush(hw);
+        dm_list_free(hw->parameters_queue, (pa_free_cb_t) pa_droid_parameters_free);
+    }
+
+    if (hw->parameters_defer)
+        hw->core->mainloop->defer_free(hw->parameters_defer);
 
     if (hw->device) {
         if (pa_droid_option(hw, DM_OPTION_UNLOAD_CALL_EXIT))
@@ -1180,6 +1822,11 @@ static pa_droid_stream *droid_stream_new(pa_droid_hw_module *module,
     s->module = pa_droid_hw_module_ref(module);
     s->mix_port = mix_port;
 
+    if (module->hal_stats)
+        s->hal_stats = pa_droid_hal_stats_new();
+
+    s->stats = pa_droid_stream_stats_new();
+
     return s;
 }
 
@@ -1213,11 +1860,13 @@ static int stream_standby(pa_droid_stream *s) {
 
     if (s->output) {
         pa_mutex_lock(s->module->output_mutex);
-        ret = s->output->stream->common.standby(&s->output->stream->common);
+        PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_STANDBY,
+                           ret = s->output->stream->common.standby(&s->output->stream->common));
         pa_mutex_unlock(s->module->output_mutex);
     } else {
         pa_mutex_lock(s->module->input_mutex);
-        ret = s->input->stream->common.standby(&s->input->stream->common);
+        PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_STANDBY,
+                           ret = s->input->stream->common.standby(&s->input->stream->common));
         pa_mutex_unlock(s->module->input_mutex);
     }
 
@@ -1523,7 +2172,10 @@ pa_droid_stream *pa_droid_open_output_stream(pa_droid_hw_module *module,
     int ret;
     pa_channel_map channel_map;
     pa_sample_spec sample_spec;
+    struct audio_config config_req;
     struct audio_config config_out;
+    bool cached = false;
+    pa_usec_t begin;
 
     pa_assert(module);
     pa_assert(spec);
@@ -1550,18 +2202,51 @@ pa_droid_stream *pa_droid_open_output_stream(pa_droid_hw_module *module,
 
     pa_log_info("Open output stream \"%s\"->\"%s\".", mix_port->name, device_port->name);
 
-    if (!stream_config_fill(module, stream->mix_port, device_port, &sample_spec, &channel_map, &config_out))
+    if (!stream_config_fill(module, stream->mix_port, device_port, &sample_spec, &channel_map, &config_req))
         goto fail;
 
-    pa_droid_hw_module_lock(module);
-    ret = module->device->open_output_stream(module->device,
-                                             ++module->stream_id,
-                                             device_port->type,
-                                             mix_port->flags,
-                                             &config_out,
-                                             &output->stream,
-                                             device_port->address);
-    pa_droid_hw_module_unlock(module);
+    config_out = config_req;
+
+    /* Output streams may end up running with different sample rate than requested,
+     * if we have seen that happening before ask for the real rate right away. */
+    if (module->stream_cache &&
+        (cached = dm_stream_cache_get(module->stream_cache, mix_port->name, device_port->type,
+                                      AUDIO_SOURCE_DEFAULT, &config_req, &config_out))) {
+        pa_log_debug("Using cached sample rate %u for mix port \"%s\"", config_out.sample_rate, mix_port->name);
+        config_out.channel_mask = config_req.channel_mask;
+        config_out.format = config_req.format;
+        sample_spec.rate = config_out.sample_rate;
+    }
+
+    begin = pa_rtclock_now();
+
+    while (true) {
+        pa_droid_hw_module_lock(module);
+        PA_DROID_HAL_TIMED(module->hal_stats, PA_DROID_HAL_CALL_OPEN_OUTPUT_STREAM,
+                           ret = module->device->open_output_stream(module->device,
+                                                                    ++module->stream_id,
+                                                                    device_port->type,
+                                                                    mix_port->flags,
+                                                                    &config_out,
+                                                                    &output->stream,
+                                                                    device_port->address));
+        pa_droid_hw_module_unlock(module);
+
+        if ((ret < 0 || !output->stream) && cached) {
+            pa_log_info("Failed to open output stream with cached config, retrying with requested config.");
+            dm_stream_cache_remove(module->stream_cache, mix_port->name, device_port->type,
+                                   AUDIO_SOURCE_DEFAULT, &config_req);
+            config_out = config_req;
+            sample_spec.rate = config_req.sample_rate;
+            output->stream = NULL;
+            cached = false;
+            continue;
+        }
+
+        break;
+    }
+
+    startup_trace_stream_open(module, "open_output_stream", mix_port, begin);
 
     if (ret < 0 || !output->stream) {
         pa_log("Failed to open output stream: %d", ret);
@@ -1578,11 +2263,25 @@ pa_droid_stream *pa_droid_open_output_stream(pa_droid_hw_module *module,
     if ((output->sample_spec.rate = output->stream->common.get_sample_rate(&output->stream->common)) != sample_spec.rate)
         pa_log_warn("Requested sample rate %u but got %u instead.", sample_spec.rate, output->sample_spec.rate);
 
+    if (module->stream_cache) {
+        struct audio_config config_accepted = config_out;
+
+        config_accepted.sample_rate = output->sample_spec.rate;
+        dm_stream_cache_put(module->stream_cache, mix_port->name, device_port->type,
+                            AUDIO_SOURCE_DEFAULT, &config_req, &config_accepted);
+    }
+
+    pa_mutex_lock(module->output_mutex);
     pa_idxset_put(module->outputs, stream, NULL);
+    pa_mutex_unlock(module->output_mutex);
 
     stream->buffer_size = output->stream->common.get_buffer_size(&output->stream->common);
 
-    if ((primary_stream = pa_droid_hw_primary_output_stream(module))) {
+    /* With independent routing every output holds its own route, otherwise
+     * new outputs follow the primary output. */
+    if (pa_droid_option(module, DM_OPTION_INDEPENDENT_ROUTING))
+        pa_droid_stream_set_route(stream, device_port);
+    else if ((primary_stream = pa_droid_hw_primary_output_stream(module))) {
         pa_droid_stream_set_route(primary_stream, device_port);
     }
 
@@ -1729,8 +2428,11 @@ static int input_stream_open(pa_droid_stream *stream, bool resume_from_suspend)
     dm_config_port *mix_port;
     size_t buffer_size;
     bool try_defaults = true;
+    bool cached = false;
     int ret = -1;
+    pa_usec_t begin;
 
+    struct audio_config config_req;
     struct audio_config config_try;
     struct audio_config config_in;
 
@@ -1757,12 +2459,30 @@ static int input_stream_open(pa_droid_stream *stream, bool resume_from_suspend)
         channel_map = input->req_channel_map;
     }
 
+    /* Configuration lists may be replaced on config reload, keep the module
+     * locked while they are being referred to. */
+    pa_droid_hw_module_lock(hw_module);
+
     mix_port = stream_select_mix_port(stream);
 
-    if (!stream_config_fill(hw_module, mix_port, stream->active_device_port, &sample_spec, &channel_map, &config_try))
+    if (!stream_config_fill(hw_module, mix_port, stream->active_device_port, &sample_spec, &channel_map, &config_req))
         goto done;
 
-    pa_droid_hw_module_lock(stream->module);
+    config_try = config_req;
+
+    /* If HAL has accepted different config for the same request before, start from that. */
+    if (hw_module->stream_cache &&
+        dm_stream_cache_get(hw_module->stream_cache, mix_port->name, stream->active_device_port->type,
+                            input->audio_source, &config_req, &config_try)) {
+        if (stream_config_convert(PA_DIRECTION_INPUT, &config_try, &sample_spec, &channel_map)) {
+            pa_log_debug("Using cached config for mix port \"%s\"", mix_port->name);
+            cached = true;
+        } else
+            config_try = config_req;
+    }
+
+    begin = pa_rtclock_now();
+
     while (true) {
         config_in = config_try;
 
@@ -1774,17 +2494,30 @@ static int input_stream_open(pa_droid_stream *stream, bool resume_from_suspend)
                        &config_in,
                        0);
 
-        ret = hw_module->device->open_input_stream(hw_module->device,
-                                                   ++hw_module->stream_id,
-                                                   stream->active_device_port->type,
-                                                   &config_in,
-                                                   &input->stream,
-                                                   mix_port->flags,
-                                                   stream->active_device_port->address,
-                                                   input->audio_source
-                                                   );
+        PA_DROID_HAL_TIMED(hw_module->hal_stats, PA_DROID_HAL_CALL_OPEN_INPUT_STREAM,
+                           ret = hw_module->device->open_input_stream(hw_module->device,
+                                                                      ++hw_module->stream_id,
+                                                                      stream->active_device_port->type,
+                                                                      &config_in,
+                                                                      &input->stream,
+                                                                      mix_port->flags,
+                                                                      stream->active_device_port->address,
+                                                                      input->audio_source
+                                                                      ));
         if (ret < 0) {
-            if (config_diff(&config_in, &config_try, &diff_sample_rate, &diff_channel_mask, &diff_format)) {
+            if (cached) {
+                pa_log_info("Could not open input stream with cached config, retrying with requested config.");
+                dm_stream_cache_remove(hw_module->stream_cache, mix_port->name, stream->active_device_port->type,
+                                       input->audio_source, &config_req);
+                cached = false;
+
+                sample_spec = input->first ? input->default_sample_spec : input->req_sample_spec;
+                channel_map = input->first ? input->default_channel_map : input->req_channel_map;
+                if (!stream_config_fill(hw_module, mix_port, stream->active_device_port, &sample_spec, &channel_map, &config_try))
+                    goto open_done;
+
+                continue;
+            } else if (config_diff(&config_in, &config_try, &diff_sample_rate, &diff_channel_mask, &diff_format)) {
                 pa_log_info("Could not open input stream, differences in%s%s%s",
                             diff_sample_rate ? " sample_rate" : "",
                             diff_channel_mask ? " channel_mask" : "",
@@ -1824,8 +2557,10 @@ static int input_stream_open(pa_droid_stream *stream, bool resume_from_suspend)
                         diff_format ? " format" : "");
             if (!stream_config_convert(PA_DIRECTION_INPUT, &config_in, &sample_spec, &channel_map)) {
                 pa_log_warn("Failed to update PulseAudio structures from received config values.");
-                input->stream->common.standby(&input->stream->common);
-                hw_module->device->close_input_stream(hw_module->device, input->stream);
+                PA_DROID_HAL_TIMED(stream->hal_stats, PA_DROID_HAL_CALL_STANDBY,
+                                   input->stream->common.standby(&input->stream->common));
+                PA_DROID_HAL_TIMED(hw_module->hal_stats, PA_DROID_HAL_CALL_CLOSE_INPUT_STREAM,
+                                   hw_module->device->close_input_stream(hw_module->device, input->stream));
                 input->stream = NULL;
                 ret = -1;
             }
@@ -1834,7 +2569,10 @@ static int input_stream_open(pa_droid_stream *stream, bool resume_from_suspend)
         goto open_done;
     }
 open_done:
-    pa_droid_hw_module_unlock(stream->module);
+    /* Resuming from suspend is done in IO thread, only record opens done from
+     * main thread. */
+    if (!resume_from_suspend)
+        startup_trace_stream_open(hw_module, "open_input_stream", mix_port, begin);
 
     if (ret < 0 || !input->stream) {
         log_input_open(resume_from_suspend ? PA_LOG_INFO : PA_LOG_ERROR, "Failed to open",
@@ -1856,6 +2594,10 @@ open_done:
                    &config_in,
                    ret);
 
+    if (hw_module->stream_cache)
+        dm_stream_cache_put(hw_module->stream_cache, mix_port->name, stream->active_device_port->type,
+                            input->audio_source, &config_req, &config_in);
+
     stream->mix_port = mix_port;
     input->req_sample_spec = input->sample_spec = sample_spec;
     input->req_channel_map = input->channel_map = channel_map;
@@ -1873,6 +2615,8 @@ open_done:
     pa_log_debug("Opened input stream %p", (void *) stream);
 
 done:
+    pa_droid_hw_module_unlock(hw_module);
+
     return ret;
 }
 
@@ -1886,8 +2630,10 @@ static void input_stream_close(pa_droid_stream *s) {
     audio_patch_release(s);
 
     pa_mutex_lock(s->module->input_mutex);
-    s->input->stream->common.standby(&s->input->stream->common);
-    s->module->device->close_input_stream(s->module->device, s->input->stream);
+    PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_STANDBY,
+                       s->input->stream->common.standby(&s->input->stream->common));
+    PA_DROID_HAL_TIMED(s->module->hal_stats, PA_DROID_HAL_CALL_CLOSE_INPUT_STREAM,
+                       s->module->device->close_input_stream(s->module->device, s->input->stream));
     s->input->stream = NULL;
     pa_log_debug("Closed input stream %p", (void *) s);
     pa_mutex_unlock(s->module->input_mutex);
@@ -1928,6 +2674,7 @@ bool pa_droid_stream_reconfigure_input(pa_droid_stream *stream,
         dm_config_port *device_port;
         void *state;
 
+        pa_droid_hw_module_lock(stream->module);
         DM_LIST_FOREACH_DATA(device_port, stream->module->enabled_module->attached_devices, state) {
             if (device_port->role == DM_CONFIG_ROLE_SOURCE) {
                 pa_log_debug("Select initial input device port \"%s\".", device_port->name);
@@ -1935,6 +2682,7 @@ bool pa_droid_stream_reconfigure_input(pa_droid_stream *stream,
                 break;
             }
         }
+        pa_droid_hw_module_unlock(stream->module);
 
         pa_assert(stream->active_device_port);
     }
@@ -2021,8 +2769,10 @@ pa_droid_stream *pa_droid_open_input_stream(pa_droid_hw_module *hw_module,
     if (!pa_droid_stream_reconfigure_input(stream, default_sample_spec, default_channel_map, NULL)) {
         pa_droid_stream_unref(stream);
         stream = NULL;
-    } else
+    } else {
         stream->input->first = false;
+        pa_idxset_put(hw_module->inputs, stream, NULL);
+    }
 
     return stream;
 }
@@ -2047,7 +2797,8 @@ void pa_droid_stream_unref(pa_droid_stream *s) {
         pa_log_debug("Destroy output stream %p", (void *) s);
         pa_mutex_lock(s->module->output_mutex);
         pa_idxset_remove_by_data(s->module->outputs, s, NULL);
-        s->module->device->close_output_stream(s->module->device, s->output->stream);
+        PA_DROID_HAL_TIMED(s->module->hal_stats, PA_DROID_HAL_CALL_CLOSE_OUTPUT_STREAM,
+                           s->module->device->close_output_stream(s->module->device, s->output->stream));
         pa_mutex_unlock(s->module->output_mutex);
         pa_xfree(s->output);
     } else {
@@ -2057,6 +2808,14 @@ void pa_droid_stream_unref(pa_droid_stream *s) {
         pa_xfree(s->input);
     }
 
+    if (s->hal_stats) {
+        pa_droid_hw_module_lock(s->module);
+        pa_droid_hal_stats_merge(s->module->hal_stats, s->hal_stats);
+        pa_droid_hw_module_unlock(s->module);
+        pa_droid_hal_stats_free(s->hal_stats);
+    }
+
+    pa_droid_stream_stats_free(s->stats);
     pa_droid_hw_module_unref(s->module);
 
     pa_xfree(s);
@@ -2107,8 +2866,11 @@ static void audio_patch_release(pa_droid_stream *stream) {
     pa_assert(stream);
 
     if (stream->audio_patch != AUDIO_PATCH_HANDLE_NONE) {
-        ret = stream->module->device->release_audio_patch(stream->module->device, stream->audio_patch);
+        PA_DROID_HAL_TIMED(stream->module->hal_stats, PA_DROID_HAL_CALL_RELEASE_AUDIO_PATCH,
+                           ret = stream->module->device->release_audio_patch(stream->module->device,
+                                                                             stream->audio_patch));
         stream->audio_patch = AUDIO_PATCH_HANDLE_NONE;
+        stream->n_patch_device_ports = 0;
         if (ret < 0)
             pa_log_info("Release %s audio patch %s:%s (%d)",
                         stream->mix_port->role == DM_CONFIG_ROLE_SINK ? "output" : "input",
@@ -2118,113 +2880,201 @@ static void audio_patch_release(pa_droid_stream *stream) {
     }
 }
 
-static int audio_patch_update_output(pa_droid_stream *stream, const dm_config_port *device_port) {
-    pa_droid_output_stream *output;
-    struct audio_port_config sink, source;
+static void audio_patch_device_config(struct audio_port_config *config,
+                                      audio_port_role_t role,
+                                      uint32_t sample_rate,
+                                      const dm_config_port *device_port) {
+    memset(config, 0, sizeof(*config));
+
+    config->role = role;
+    config->type = AUDIO_PORT_TYPE_DEVICE;
+    config->sample_rate = sample_rate;
+    config->format = AUDIO_FORMAT_PCM_16_BIT;
+    config->ext.device.address[0] = '\0';
+    if (strlen(device_port->address))
+        strncpy(config->ext.device.address, device_port->address, AUDIO_DEVICE_MAX_ADDRESS_LEN - 1);
+    config->ext.device.type = device_port->type;
+}
+
+static char *audio_patch_device_names(const dm_config_port **device_ports, unsigned n_device_ports) {
+    pa_strbuf *buf;
+    unsigned i;
+
+    buf = pa_strbuf_new();
+
+    for (i = 0; i < n_device_ports; i++)
+        pa_strbuf_printf(buf, "%s\"%s\"", i ? "," : "", device_ports[i]->name);
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+/* Create audio patch between stream mix port and one or more device ports.
+ * For output streams device ports are patch sinks, for input streams
+ * sources. */
+static int audio_patch_create(pa_droid_stream *stream, const dm_config_port **device_ports, unsigned n_device_ports) {
+    struct audio_port_config mix;
+    struct audio_port_config devices[AUDIO_PATCH_PORTS_MAX];
+    uint32_t sample_rate;
+    char *names;
+    unsigned i;
     int ret;
 
-    output = stream->output;
+    pa_assert(n_device_ports > 0);
+    pa_assert(n_device_ports <= AUDIO_PATCH_PORTS_MAX);
 
-    memset(&sink, 0, sizeof(sink));
-    memset(&source, 0, sizeof(source));
+    sample_rate = stream->output ? stream->output->sample_spec.rate : stream->input->sample_spec.rate;
 
-    source.type = AUDIO_PORT_TYPE_MIX;
-    source.role = AUDIO_PORT_ROLE_SOURCE;
-    source.sample_rate = output->sample_spec.rate;
-    source.format = AUDIO_FORMAT_PCM_16_BIT;
-    source.ext.mix.handle = stream->io_handle;
+    memset(&mix, 0, sizeof(mix));
+    mix.type = AUDIO_PORT_TYPE_MIX;
+    mix.role = stream->output ? AUDIO_PORT_ROLE_SOURCE : AUDIO_PORT_ROLE_SINK;
+    mix.sample_rate = sample_rate;
+    mix.format = AUDIO_FORMAT_PCM_16_BIT;
+    mix.ext.mix.handle = stream->io_handle;
 
-    sink.role = AUDIO_PORT_ROLE_SINK;
-    sink.type = AUDIO_PORT_TYPE_DEVICE;
-    sink.sample_rate = output->sample_spec.rate;
-    sink.format = AUDIO_FORMAT_PCM_16_BIT;
-    sink.ext.device.address[0] = '\0';
-    if (strlen(device_port->address))
-        strncpy(sink.ext.device.address, device_port->address, AUDIO_DEVICE_MAX_ADDRESS_LEN - 1);
-    sink.ext.device.type = device_port->type;
+    for (i = 0; i < n_device_ports; i++)
+        audio_patch_device_config(&devices[i],
+                                  stream->output ? AUDIO_PORT_ROLE_SINK : AUDIO_PORT_ROLE_SOURCE,
+                                  sample_rate,
+                                  device_ports[i]);
 
-    ret = stream->module->device->create_audio_patch(stream->module->device, 1, &source, 1, &sink, &stream->audio_patch);
-    if (ret < 0)
-        pa_log_warn("Failed to create output audio patch \"%s\"->\"%s\" (%d)", stream->mix_port->name, device_port->name, -ret);
-    else
-        pa_log_info("Created output audio patch \"%s\"->\"%s\"", stream->mix_port->name, device_port->name);
+    names = audio_patch_device_names(device_ports, n_device_ports);
+
+    if (stream->output) {
+        PA_DROID_HAL_TIMED(stream->module->hal_stats, PA_DROID_HAL_CALL_CREATE_AUDIO_PATCH,
+                           ret = stream->module->device->create_audio_patch(stream->module->device,
+                                                                            1, &mix,
+                                                                            n_device_ports, devices,
+                                                                            &stream->audio_patch));
+        if (ret < 0)
+            pa_log_warn("Failed to create output audio patch \"%s\"->%s (%d)", stream->mix_port->name, names, -ret);
+        else
+            pa_log_info("Created output audio patch \"%s\"->%s", stream->mix_port->name, names);
+    } else {
+        PA_DROID_HAL_TIMED(stream->module->hal_stats, PA_DROID_HAL_CALL_CREATE_AUDIO_PATCH,
+                           ret = stream->module->device->create_audio_patch(stream->module->device,
+                                                                            n_device_ports, devices,
+                                                                            1, &mix,
+                                                                            &stream->audio_patch));
+        if (ret < 0)
+            pa_log_warn("Failed to create input audio patch \"%s\"<-%s (%d)", stream->mix_port->name, names, -ret);
+        else
+            pa_log_info("Created input audio patch \"%s\"<-%s", stream->mix_port->name, names);
+    }
 
-    stream->active_device_port = device_port;
+    pa_xfree(names);
+
+    if (ret >= 0) {
+        for (i = 0; i < n_device_ports; i++)
+            stream->patch_device_ports[i] = device_ports[i];
+        stream->n_patch_device_ports = n_device_ports;
+    }
+
+    stream->active_device_port = device_ports[0];
 
     return ret;
 }
 
-static int audio_patch_update_input(pa_droid_stream *stream, const dm_config_port *device_port) {
-    pa_droid_input_stream *input;
-    struct audio_port_config sink, source;
-    int ret;
+/* Audio patches are tracked per stream as the mix handle -> device ports
+ * set of the stream. Only streams whose devices actually change get their
+ * patch released and recreated, as every patch operation is a slow HAL
+ * round trip and glitches the stream. */
+static bool audio_patch_is_current(pa_droid_stream *stream, const dm_config_port **device_ports, unsigned n_device_ports) {
+    unsigned i, j;
 
-    input = stream->input;
+    if (stream->audio_patch == AUDIO_PATCH_HANDLE_NONE || stream->n_patch_device_ports != n_device_ports)
+        return false;
 
-    memset(&sink, 0, sizeof(sink));
-    memset(&source, 0, sizeof(source));
+    for (i = 0; i < n_device_ports; i++) {
+        for (j = 0; j < stream->n_patch_device_ports; j++) {
+            if (dm_config_port_equal(stream->patch_device_ports[j], device_ports[i]))
+                break;
+        }
 
-    sink.type = AUDIO_PORT_TYPE_MIX;
-    sink.role = AUDIO_PORT_ROLE_SINK;
-    sink.sample_rate = input->sample_spec.rate;
-    sink.format = AUDIO_FORMAT_PCM_16_BIT;
-    sink.ext.mix.handle = stream->io_handle;
+        if (j == stream->n_patch_device_ports)
+            return false;
+    }
 
-    source.role = AUDIO_PORT_ROLE_SOURCE;
-    source.type = AUDIO_PORT_TYPE_DEVICE;
-    source.sample_rate = input->sample_spec.rate;
-    source.format = AUDIO_FORMAT_PCM_16_BIT;
-    source.ext.device.address[0] = '\0';
-    if (strlen(device_port->address))
-        strncpy(source.ext.device.address, device_port->address, AUDIO_DEVICE_MAX_ADDRESS_LEN - 1);
-    source.ext.device.type = device_port->type;
+    return true;
+}
 
-    ret = stream->module->device->create_audio_patch(stream->module->device, 1, &source, 1, &sink, &stream->audio_patch);
-    if (ret < 0)
-        pa_log_warn("Failed to create input audio patch \"%s\"<-\"%s\" (%d)", stream->mix_port->name, device_port->name, -ret);
-    else
-        pa_log_info("Created input audio patch \"%s\"<-\"%s\"", stream->mix_port->name, device_port->name);
+static int audio_patch_set(pa_droid_stream *stream, const dm_config_port **device_ports, unsigned n_device_ports) {
+    pa_assert(stream);
+    pa_assert(device_ports);
 
-    stream->active_device_port = device_port;
+    if (audio_patch_is_current(stream, device_ports, n_device_ports)) {
+        pa_log_debug("Audio patch for \"%s\" unchanged.", stream->mix_port->name);
+        return 0;
+    }
 
-    return ret;
+    audio_patch_release(stream);
+
+    return audio_patch_create(stream, device_ports, n_device_ports);
 }
 
-static int droid_output_stream_audio_patch_update(pa_droid_stream *primary_stream, dm_config_port *device_port) {
-    pa_droid_stream *stream;
-    uint32_t idx;
+int pa_droid_hw_create_device_patch(pa_droid_hw_module *hw,
+                                    const dm_config_port *source,
+                                    const dm_config_port **sinks,
+                                    unsigned n_sinks,
+                                    audio_patch_handle_t *handle) {
+    struct audio_port_config source_config;
+    struct audio_port_config sink_configs[AUDIO_PATCH_PORTS_MAX];
+    char *names;
+    unsigned i;
     int ret;
 
-    pa_assert(primary_stream);
-    pa_assert(primary_stream->output);
-    pa_assert(primary_stream->mix_port);
-    pa_assert(primary_stream->mix_port->port_type == DM_CONFIG_TYPE_MIX_PORT);
-    pa_assert(primary_stream->mix_port->flags & AUDIO_OUTPUT_FLAG_PRIMARY);
-    pa_assert(device_port);
-    pa_assert(device_port->role == DM_CONFIG_ROLE_SINK);
+    pa_assert(hw);
+    pa_assert(source);
+    pa_assert(source->role == DM_CONFIG_ROLE_SOURCE);
+    pa_assert(sinks);
+    pa_assert(n_sinks > 0 && n_sinks <= AUDIO_PATCH_PORTS_MAX);
+    pa_assert(handle);
 
-    PA_IDXSET_FOREACH(stream, primary_stream->module->outputs, idx) {
-        audio_patch_release(stream);
+    if (!hw->device->create_audio_patch) {
+        pa_log_info("HAL doesn't support audio patches.");
+        return -ENOSYS;
     }
 
-    ret = audio_patch_update_output(primary_stream, device_port);
+    audio_patch_device_config(&source_config, AUDIO_PORT_ROLE_SOURCE, 0, source);
+    for (i = 0; i < n_sinks; i++)
+        audio_patch_device_config(&sink_configs[i], AUDIO_PORT_ROLE_SINK, 0, sinks[i]);
 
-    if (ret == 0) {
-        PA_IDXSET_FOREACH(stream, primary_stream->module->outputs, idx) {
-            if (primary_stream == stream)
-                continue;
+    names = audio_patch_device_names(sinks, n_sinks);
 
-            audio_patch_update_output(stream, device_port);
-        }
-    }
+    *handle = AUDIO_PATCH_HANDLE_NONE;
 
-    if (ret < 0) {
-        pa_log_warn("Failed to update output stream audio patch (%d)", -ret);
-    }
+    pa_droid_hw_module_lock(hw);
+    parameters_flush(hw);
+    PA_DROID_HAL_TIMED(hw->hal_stats, PA_DROID_HAL_CALL_CREATE_AUDIO_PATCH,
+                       ret = hw->device->create_audio_patch(hw->device, 1, &source_config, n_sinks, sink_configs, handle));
+    pa_droid_hw_module_unlock(hw);
+
+    if (ret < 0)
+        pa_log_warn("Failed to create device audio patch \"%s\"->%s (%d)", source->name, names, -ret);
+    else
+        pa_log_info("Created device audio patch \"%s\"->%s", source->name, names);
+
+    pa_xfree(names);
 
     return ret;
 }
 
+void pa_droid_hw_release_device_patch(pa_droid_hw_module *hw, audio_patch_handle_t handle) {
+    int ret;
+
+    pa_assert(hw);
+
+    if (handle == AUDIO_PATCH_HANDLE_NONE)
+        return;
+
+    pa_droid_hw_module_lock(hw);
+    PA_DROID_HAL_TIMED(hw->hal_stats, PA_DROID_HAL_CALL_RELEASE_AUDIO_PATCH,
+                       ret = hw->device->release_audio_patch(hw->device, handle));
+    pa_droid_hw_module_unlock(hw);
+
+    if (ret < 0)
+        pa_log_info("Release device audio patch %d failed (%d)", (int) handle, -ret);
+}
+
 int input_stream_set_parameter(pa_droid_stream *s, const dm_config_port *device_port){
     pa_droid_input_stream *input;
     audio_devices_t device;
@@ -2250,7 +3100,8 @@ int input_stream_set_parameter(pa_droid_stream *s, const dm_config_port *device_
                  (void *) s, parameters, device, source);
 
     pa_mutex_lock(hw_module->input_mutex);
-    ret = input->stream->common.set_parameters(&input->stream->common, parameters);
+    PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_STREAM_SET_PARAMETERS,
+                       ret = input->stream->common.set_parameters(&input->stream->common, parameters));
     pa_mutex_unlock(hw_module->input_mutex);
 
     if (ret < 0) {
@@ -2267,20 +3118,27 @@ done:
 
 }
 
-int output_stream_set_parameter(pa_droid_stream *s, const dm_config_port *device_port){
+int output_stream_set_parameter(pa_droid_stream *s, const dm_config_port **device_ports, unsigned n_device_ports) {
     pa_droid_output_stream *output;
     char *parameters = NULL;
     int ret = 0;
-    audio_devices_t device;
+    audio_devices_t device = 0;
+    const dm_config_port *device_port;
     int set_bt_sco = -1;
+    unsigned i;
 
     pa_assert(s);
     pa_assert(s->output);
     pa_assert(s->module);
     pa_assert(s->module->output_mutex);
+    pa_assert(n_device_ports > 0);
 
     output = s->output;
-    device = device_port->type;
+    device_port = device_ports[0];
+
+    /* Legacy routing takes the combination of all devices. */
+    for (i = 0; i < n_device_ports; i++)
+        device |= device_ports[i]->type;
 
     pa_mutex_lock(s->module->output_mutex);
 
@@ -2296,7 +3154,8 @@ int output_stream_set_parameter(pa_droid_stream *s, const dm_config_port *device
         droid_set_parameters(s->module, AUDIO_PARAMETER_BT_SCO_ON);
 
     pa_log_debug("output stream %p set_parameters(%s) %#010x", (void *) s, parameters, device);
-    ret = output->stream->common.set_parameters(&output->stream->common, parameters);
+    PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_STREAM_SET_PARAMETERS,
+                       ret = output->stream->common.set_parameters(&output->stream->common, parameters));
 
     if (set_bt_sco == 0 && device_port->flags & AUDIO_OUTPUT_FLAG_PRIMARY)
         droid_set_parameters(s->module, AUDIO_PARAMETER_BT_SCO_OFF);
@@ -2331,8 +3190,7 @@ static int input_stream_set_route(pa_droid_stream *stream, const dm_config_port
     }
 
     if (!pa_droid_option(stream->module, DM_OPTION_USE_LEGACY_STREAM_SET_PARAMETERS)) {
-        audio_patch_release(stream);
-        ret = audio_patch_update_input(stream, device_port);
+        ret = audio_patch_set(stream, &device_port, 1);
     } else {
         ret = input_stream_set_parameter(stream, device_port);
     }
@@ -2346,24 +3204,100 @@ done:
     return ret;
 }
 
+/* Routing and mode changes may change values of any parameter. */
+static void parameter_cache_invalidate_all(pa_droid_hw_module *hw) {
+    if (!hw->parameter_cache)
+        return;
+
+    pa_mutex_lock(hw->hw_mutex);
+    dm_parameter_cache_invalidate_all(hw->parameter_cache);
+    pa_mutex_unlock(hw->hw_mutex);
+}
+
+/* Other output streams follow the primary output. Output list is modified only
+ * with output_mutex held, so this is safe from IO threads as well. */
+static void output_streams_follow_primary(pa_droid_stream *primary_stream,
+                                          const dm_config_port **device_ports, unsigned n_device_ports) {
+    pa_droid_stream *stream;
+    uint32_t idx;
+
+    pa_mutex_lock(primary_stream->module->output_mutex);
+    PA_IDXSET_FOREACH(stream, primary_stream->module->outputs, idx) {
+        if (stream != primary_stream)
+            audio_patch_set(stream, device_ports, n_device_ports);
+    }
+    pa_mutex_unlock(primary_stream->module->output_mutex);
+}
+
 int pa_droid_stream_set_route(pa_droid_stream *s, dm_config_port *device_port) {
     pa_assert(s);
+    pa_assert(device_port);
+
+    return pa_droid_stream_set_route_devices(s, (const dm_config_port **) &device_port, 1);
+}
+
+int pa_droid_stream_set_route_devices(pa_droid_stream *s, const dm_config_port **device_ports, unsigned n_device_ports) {
+    pa_droid_stream *primary_stream;
+    int ret;
+
+    pa_assert(s);
+    pa_assert(device_ports);
+    pa_assert(n_device_ports > 0);
+
+    if (n_device_ports > AUDIO_PATCH_PORTS_MAX) {
+        pa_log_warn("Too many devices for route (%u > %u), ignoring extra devices.", n_device_ports, AUDIO_PATCH_PORTS_MAX);
+        n_device_ports = AUDIO_PATCH_PORTS_MAX;
+    }
+
+    pa_droid_hw_module_lock(s->module);
+
+    /* HAL needs to know about connected and disconnected devices before
+     * anything is routed to them. */
+    parameters_flush(s->module);
 
     if (s->output) {
-        int ret;
         if (!pa_droid_option(s->module, DM_OPTION_USE_LEGACY_STREAM_SET_PARAMETERS)) {
+            /* BT SCO needs to be enabled before patching primary output to
+             * SCO device. */
             if (pa_droid_stream_is_primary(s))
-                stream_update_bt_sco(s->module, device_port);
+                stream_update_bt_sco(s->module, device_ports[0]);
 
-            ret = droid_output_stream_audio_patch_update(s, device_port);
+            if (pa_droid_option(s->module, DM_OPTION_INDEPENDENT_ROUTING))
+                ret = audio_patch_set(s, device_ports, n_device_ports);
+            else if (pa_droid_stream_is_primary(s)) {
+                if ((ret = audio_patch_set(s, device_ports, n_device_ports)) < 0)
+                    pa_log_warn("Failed to update output stream audio patch (%d)", -ret);
+                else
+                    output_streams_follow_primary(s, device_ports, n_device_ports);
+            } else {
+                pa_mutex_lock(s->module->output_mutex);
+                primary_stream = pa_droid_hw_primary_output_stream(s->module);
+                pa_mutex_unlock(s->module->output_mutex);
+
+                if (!primary_stream)
+                    ret = audio_patch_set(s, device_ports, n_device_ports);
+                else {
+                    pa_log_debug("Primary output stream exists, not routing output \"%s\".", s->mix_port->name);
+                    ret = 0;
+                }
+            }
         } else {
-            ret = output_stream_set_parameter(s, device_port);
+            ret = output_stream_set_parameter(s, device_ports, n_device_ports);
         }
-        return ret;
     } else {
-        pa_droid_hw_set_input_device(s, device_port);
-        return 0;
+        if (n_device_ports > 1)
+            pa_log_debug("Input stream can be routed only from one device, using \"%s\".", device_ports[0]->name);
+        pa_droid_hw_set_input_device(s, (dm_config_port *) device_ports[0]);
+        ret = 0;
     }
+
+    /* Cache is invalidated only after HAL has the new route, so that values
+     * read during the route change don't stay in the cache. */
+    parameter_cache_invalidate_all(s->module);
+
+    pa_droid_hw_module_unlock(s->module);
+
+    return ret;
 }
 
 int pa_droid_stream_set_parameters(pa_droid_stream *s, const char *parameters) {
@@ -2376,12 +3310,14 @@ int pa_droid_stream_set_parameters(pa_droid_stream *s, const char *parameters) {
     if (s->output) {
         pa_log_debug("output stream %p set_parameters(%s)", (void *) s, parameters);
         pa_mutex_lock(s->module->output_mutex);
-        ret = s->output->stream->common.set_parameters(&s->output->stream->common, parameters);
+        PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_STREAM_SET_PARAMETERS,
+                           ret = s->output->stream->common.set_parameters(&s->output->stream->common, parameters));
         pa_mutex_unlock(s->module->output_mutex);
     } else {
         pa_log_debug("input stream %p set_parameters(%s)", (void *) s, parameters);
         pa_mutex_lock(s->module->input_mutex);
-        ret = s->input->stream->common.set_parameters(&s->input->stream->common, parameters);
+        PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_STREAM_SET_PARAMETERS,
+                           ret = s->input->stream->common.set_parameters(&s->input->stream->common, parameters));
         pa_mutex_unlock(s->module->input_mutex);
     }
 
@@ -2389,6 +3325,12 @@ int pa_droid_stream_set_parameters(pa_droid_stream *s, const char *parameters) {
         pa_log("%s stream %p set_parameters(%s) failed: %d",
                s->output ? "output" : "input", (void *) s, parameters, ret);
 
+    if (s->module->parameter_cache) {
+        pa_mutex_lock(s->module->hw_mutex);
+        dm_parameter_cache_invalidate(s->module->parameter_cache, parameters);
+        pa_mutex_unlock(s->module->hw_mutex);
+    }
+
     return ret;
 }
 
@@ -2399,7 +3341,11 @@ static int droid_set_parameters(pa_droid_hw_module *hw, const char *parameters)
     pa_assert(parameters);
 
     pa_log_debug("hw %p set_parameters(%s)", (void *) hw, parameters);
-    ret = hw->device->set_parameters(hw->device, parameters);
+    PA_DROID_HAL_TIMED(hw->hal_stats, PA_DROID_HAL_CALL_SET_PARAMETERS,
+                       ret = hw->device->set_parameters(hw->device, parameters));
+
+    if (hw->parameter_cache)
+        dm_parameter_cache_invalidate(hw->parameter_cache, parameters);
 
     if (ret < 0)
         pa_log("hw module %p set_parameters(%s) failed: %d", (void *) hw, parameters, ret);
@@ -2414,12 +3360,218 @@ int pa_droid_set_parameters(pa_droid_hw_module *hw, const char *parameters) {
     pa_assert(parameters);
 
     pa_mutex_lock(hw->hw_mutex);
+    parameters_flush(hw);
     ret = droid_set_parameters(hw, parameters);
     pa_mutex_unlock(hw->hw_mutex);
 
+    if (ret == 0 && hw->hal_api)
+        dm_hal_api_notify(hw->hal_api, parameters);
+
+    return ret;
+}
+
+char *pa_droid_get_parameters(pa_droid_hw_module *hw, const char *keys) {
+    char *hal_value;
+    char *value = NULL;
+
+    pa_assert(hw);
+    pa_assert(keys);
+
+    pa_mutex_lock(hw->hw_mutex);
+
+    if (hw->parameter_cache && (value = dm_parameter_cache_get(hw->parameter_cache, keys))) {
+        pa_mutex_unlock(hw->hw_mutex);
+        pa_log_debug("hw %p get_parameters(%s): %s (cached)", (void *) hw, keys, value);
+        return value;
+    }
+
+    PA_DROID_HAL_TIMED(hw->hal_stats, PA_DROID_HAL_CALL_GET_PARAMETERS,
+                       hal_value = hw->device->get_parameters(hw->device, keys));
+
+    if (hal_value) {
+        value = pa_xstrdup(hal_value);
+        free(hal_value);
+
+        if (hw->parameter_cache)
+            dm_parameter_cache_put(hw->parameter_cache, keys, value);
+    }
+
+    pa_mutex_unlock(hw->hw_mutex);
+
+    pa_log_debug("hw %p get_parameters(%s): %s", (void *) hw, keys, value ? value : "<null>");
+
+    return value;
+}
+
+int pa_droid_hw_set_parameters(pa_droid_hw_module *hw, const pa_droid_parameters *parameters) {
+    char *str;
+    int ret;
+
+    pa_assert(hw);
+    pa_assert(parameters);
+
+    str = pa_droid_parameters_to_string(parameters);
+    ret = pa_droid_set_parameters(hw, str);
+    pa_xfree(str);
+
     return ret;
 }
 
+/* Returns true for parameters notifying device connection state change. */
+static bool parameters_is_connection(const pa_droid_parameters *p, bool *connect) {
+    const char *key;
+
+    if (!(key = pa_droid_parameters_first_key(p)))
+        return false;
+
+    if (pa_streq(key, AUDIO_PARAMETER_DEVICE_CONNECT))
+        *connect = true;
+    else if (pa_streq(key, AUDIO_PARAMETER_DEVICE_DISCONNECT))
+        *connect = false;
+    else
+        return false;
+
+    return true;
+}
+
+/* Connect and disconnect of the same device cancel each other. */
+static bool parameters_cancel(const pa_droid_parameters *a, const pa_droid_parameters *b) {
+    const char *a_verb, *b_verb;
+    const char *key, *value, *other;
+    bool a_connect, b_connect;
+    void *state = NULL;
+
+    if (!parameters_is_connection(a, &a_connect) ||
+        !parameters_is_connection(b, &b_connect) ||
+        a_connect == b_connect ||
+        pa_droid_parameters_size(a) != pa_droid_parameters_size(b))
+        return false;
+
+    a_verb = pa_droid_parameters_first_key(a);
+    b_verb = pa_droid_parameters_first_key(b);
+
+    if (!pa_streq(pa_droid_parameters_get(a, a_verb), pa_droid_parameters_get(b, b_verb)))
+        return false;
+
+    /* Rest of the pairs, like card and device for USB devices, need to match. */
+    while (pa_droid_parameters_iterate(a, &state, &key, &value)) {
+        if (pa_streq(key, a_verb))
+            continue;
+
+        if (!(other = pa_droid_parameters_get(b, key)) || !pa_streq(value, other))
+            return false;
+    }
+
+    return true;
+}
+
+static void parameters_notify_cb(pa_droid_hw_module *hw, void *userdata) {
+    if (hw->hal_api)
+        dm_hal_api_notify(hw->hal_api, userdata);
+}
+
+static void parameters_send(pa_droid_hw_module *hw, pa_droid_parameters *parameters) {
+    char *str;
+
+    str = pa_droid_parameters_to_string(parameters);
+    if (droid_set_parameters(hw, str) == 0 && hw->hal_api)
+        hw_run_in_main(hw, parameters_notify_cb, str, pa_xfree);
+    else
+        pa_xfree(str);
+}
+
+/* Called with hw_mutex held, also from IO threads before routing. Device
+ * connection changes are always sent alone, other parameters are merged
+ * into as few calls as possible. */
+static void parameters_flush(pa_droid_hw_module *hw) {
+    pa_droid_parameters *batch = NULL;
+    pa_droid_parameters *p;
+    bool connect;
+
+    while ((p = dm_list_steal_first(hw->parameters_queue))) {
+        if (parameters_is_connection(p, &connect)) {
+            if (batch) {
+                parameters_send(hw, batch);
+                pa_droid_parameters_free(batch);
+                batch = NULL;
+            }
+
+            parameters_send(hw, p);
+            pa_droid_parameters_free(p);
+            continue;
+        }
+
+        if (batch && pa_droid_parameters_intersect(p, batch)) {
+            parameters_send(hw, batch);
+            pa_droid_parameters_free(batch);
+            batch = NULL;
+        }
+
+        if (!batch) {
+            batch = p;
+            continue;
+        }
+
+        pa_droid_parameters_merge(batch, p);
+        pa_droid_parameters_free(p);
+    }
+
+    if (batch) {
+        parameters_send(hw, batch);
+        pa_droid_parameters_free(batch);
+    }
+}
+
+static void parameters_defer_cb(pa_mainloop_api *api, pa_defer_event *e, void *userdata) {
+    pa_droid_hw_module *hw = userdata;
+
+    pa_assert(hw);
+
+    api->defer_enable(e, 0);
+
+    pa_mutex_lock(hw->hw_mutex);
+    parameters_flush(hw);
+    pa_mutex_unlock(hw->hw_mutex);
+}
+
+void pa_droid_hw_queue_parameters(pa_droid_hw_module *hw, pa_droid_parameters *parameters) {
+    dm_list_entry *i;
+    bool connect;
+
+    pa_assert(hw);
+    pa_assert(parameters);
+    pa_assert_ctl_context();
+
+    pa_mutex_lock(hw->hw_mutex);
+
+    DM_LIST_FOREACH(i, hw->parameters_queue) {
+        if (parameters_cancel(i->data, parameters)) {
+            pa_log_debug("Queued parameters cancel each other, dropping both.");
+            pa_droid_parameters_free(i->data);
+            dm_list_remove(hw->parameters_queue, i);
+            pa_droid_parameters_free(parameters);
+            goto done;
+        }
+
+        if (!parameters_is_connection(parameters, &connect) &&
+            pa_droid_parameters_equal(i->data, parameters, false)) {
+            pa_droid_parameters_free(i->data);
+            dm_list_remove(hw->parameters_queue, i);
+            break;
+        }
+    }
+
+    dm_list_push_back(hw->parameters_queue, parameters);
+
+    if (!hw->parameters_defer)
+        hw->parameters_defer = hw->core->mainloop->defer_new(hw->core->mainloop, parameters_defer_cb, hw);
+    else
+        hw->core->mainloop->defer_enable(hw->parameters_defer, 1);
+
+done:
+    pa_mutex_unlock(hw->hw_mutex);
+}
+
 bool pa_droid_stream_is_primary(pa_droid_stream *s) {
     pa_assert(s);
     pa_assert(s->output || s->input);
@@ -2467,12 +3619,15 @@ size_t pa_droid_stream_buffer_size(pa_droid_stream *s) {
 }
 
 pa_usec_t pa_droid_stream_get_latency(pa_droid_stream *s) {
+    uint32_t latency = 0;
+
     pa_assert(s);
 
     if (s->output && s->output->stream)
-        return s->output->stream->get_latency(s->output->stream) * PA_USEC_PER_MSEC;
+        PA_DROID_HAL_TIMED(s->hal_stats, PA_DROID_HAL_CALL_GET_LATENCY,
+                           latency = s->output->stream->get_latency(s->output->stream));
 
-    return 0;
+    return latency * PA_USEC_PER_MSEC;
 }
 
 void pa_droid_stream_set_data(pa_droid_stream *s, void *data) {
@@ -2537,13 +3692,16 @@ bool pa_droid_hw_has_mic_control(pa_droid_hw_module *hw) {
 
 int pa_droid_hw_mic_get_mute(pa_droid_hw_module *hw_module, bool *muted) {
     int ret = 0;
+    int hal_ret;
 
     pa_assert(hw_module);
     pa_assert(hw_module->device);
     pa_assert(hw_module->device->get_mic_mute);
 
     pa_droid_hw_module_lock(hw_module);
-    if (hw_module->device->get_mic_mute(hw_module->device, muted) < 0) {
+    PA_DROID_HAL_TIMED(hw_module->hal_stats, PA_DROID_HAL_CALL_GET_MIC_MUTE,
+                       hal_ret = hw_module->device->get_mic_mute(hw_module->device, muted));
+    if (hal_ret < 0) {
         pa_log("Failed to get mute state.");
         ret = -1;
     }
@@ -2553,18 +3711,23 @@ int pa_droid_hw_mic_get_mute(pa_droid_hw_module *hw_module, bool *muted) {
 }
 
 void pa_droid_hw_mic_set_mute(pa_droid_hw_module *hw_module, bool muted) {
+    int hal_ret;
+
     pa_assert(hw_module);
     pa_assert(hw_module->device);
     pa_assert(hw_module->device->set_mic_mute);
 
     pa_droid_hw_module_lock(hw_module);
-    if (hw_module->device->set_mic_mute(hw_module->device, muted) < 0)
+    PA_DROID_HAL_TIMED(hw_module->hal_stats, PA_DROID_HAL_CALL_SET_MIC_MUTE,
+                       hal_ret = hw_module->device->set_mic_mute(hw_module->device, muted));
+    if (hal_ret < 0)
         pa_log("Failed to set mute state to %smuted.", muted ? "" : "un");
     pa_droid_hw_module_unlock(hw_module);
 }
 
 bool pa_droid_hw_set_mode(pa_droid_hw_module *hw_module, audio_mode_t mode) {
     bool ret = true;
+    int hal_ret;
 
     pa_assert(hw_module);
     pa_assert(hw_module->device);
@@ -2585,7 +3748,10 @@ bool pa_droid_hw_set_mode(pa_droid_hw_module *hw_module, audio_mode_t mode) {
     }
 
     pa_droid_hw_module_lock(hw_module);
-    if (hw_module->device->set_mode(hw_module->device, mode) < 0) {
+    parameter_cache_invalidate_all(hw_module);
+    PA_DROID_HAL_TIMED(hw_module->hal_stats, PA_DROID_HAL_CALL_SET_MODE,
+                       hal_ret = hw_module->device->set_mode(hw_module->device, mode));
+    if (hal_ret < 0) {
         ret = false;
         pa_log_warn("Failed to set mode.");
     } else {
@@ -2692,6 +3858,11 @@ bool pa_droid_hw_set_input_device(pa_droid_stream *stream,
 
     source_changed = droid_set_audio_source(stream, stream->input->audio_source);
 
+    /* Audio patch doesn't change with the audio source, recreate it anyway so
+     * that HAL sees the new source. */
+    if (source_changed && !pa_droid_option(stream->module, DM_OPTION_USE_LEGACY_STREAM_SET_PARAMETERS))
+        audio_patch_release(stream);
+
     if (stream->active_device_port && (device_changed || source_changed))
         input_stream_set_route(stream, device_port);
 
@@ -2720,7 +3891,7 @@ pa_modargs *pa_droid_modargs_new(const char *args, const char* const keys[]) {
 
     for (count = 0; keys[count]; count++) ;
 
-    full_keys = pa_xnew0(const char *, count + DM_OPTION_COUNT + 1);
+    full_keys = pa_xnew0(const char *, count + DM_OPTION_COUNT + 3);
 
     for (i = 0; keys[i]; i++)
         full_keys[i] = keys[i];
@@ -2728,6 +3899,9 @@ pa_modargs *pa_droid_modargs_new(const char *args, const char* const keys[]) {
     for (k = 0; k < DM_OPTION_COUNT; k++)
         full_keys[i++] = valid_options[k].name;
 
+    full_keys[i++] = DM_MODARG_PARAMETER_CACHE_TTL;
+    full_keys[i++] = DM_MODARG_MOCK_HAL;
+
     ma = pa_modargs_new(args, full_keys);
 
     pa_xfree(full_keys);
@@ -107,9 +107,12 @@ struct dm_config_module {
     dm_list *mix_ports; /* dm_config_port* */
     dm_list *device_ports; /* dm_config_port* */
     dm_list *routes; /* dm_config_route* */
+    dm_list *removed_ports; /* dm_config_port* removed by dm_config_module_update(), kept
+                             * alive until the module is freed as streams may still use them. */
 };
 
 struct dm_config_device {
+    char *filename; /* file configuration was parsed from */
     dm_list *global_config; /* dm_config_global* */
     dm_list *modules; /* dm_config_module* */
 };
@@ -130,6 +133,13 @@ char *dm_config_escape_string(const char *string);
 
 bool dm_config_port_equal(const dm_config_port *a, const dm_config_port *b);
 
+/* Apply changes from update to module in place. Existing port objects stay
+ * valid, ports missing from update are moved to module->removed_ports. Lists,
+ * routes and port profiles may be freed, so the hw module owning the config
+ * must be locked both here and wherever the lists are walked outside of the
+ * main thread. Returns true if anything changed. */
+bool dm_config_module_update(dm_config_module *module, const dm_config_module *update);
+
 dm_config_port *dm_config_find_mix_port(dm_config_module *module, const char *name);
 
 #endif
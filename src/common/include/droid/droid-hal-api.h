@@ -0,0 +1,57 @@
+#ifndef foodroidhalapifoo
+#define foodroidhalapifoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <droid/droid-util.h>
+
+/* Version 2 of the HAL API other modules can use through PulseAudio shared
+ * map, see README. All functions are called from main context and complete
+ * asynchronously from main loop. Requests made during the same main loop
+ * iteration are batched into as few HAL calls as possible. */
+
+#define DROID_SET_PARAMETERS_V2     "droid.set_parameters.v2"
+#define DROID_GET_PARAMETERS_V2     "droid.get_parameters.v2"
+#define DROID_SUBSCRIBE_V2          "droid.subscribe_parameters.v2"
+#define DROID_UNSUBSCRIBE_V2        "droid.unsubscribe_parameters.v2"
+
+typedef struct dm_hal_api dm_hal_api;
+
+/* Completion and notification callback. For set requests key_value_pairs are
+ * the pairs that were set, for get requests the pairs HAL returned and for
+ * subscriptions the pairs that changed. result is negative on error, in which
+ * case key_value_pairs may be NULL. */
+typedef void (*dm_hal_api_cb_t)(void *handle, int result, const char *key_value_pairs, void *userdata);
+
+dm_hal_api *dm_hal_api_new(pa_droid_hw_module *hw);
+/* Pending requests are completed with error and subscriptions are dropped. */
+void dm_hal_api_free(dm_hal_api *api);
+
+/* Notify subscribers about parameters set outside of the v2 API. */
+void dm_hal_api_notify(dm_hal_api *api, const char *key_value_pairs);
+
+#endif
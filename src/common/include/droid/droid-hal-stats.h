@@ -0,0 +1,132 @@
+#ifndef foodroidhalstatsfoo
+#define foodroidhalstatsfoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+/* HAL call latency statistics. Calls to audio_hw_device_t and stream
+ * functions are wrapped with PA_DROID_HAL_TIMED(), which records call count,
+ * total and worst case time and a log-scale histogram per entry point when
+ * statistics are enabled (hal_stats option). With statistics disabled the
+ * stats pointer is NULL and the wrapper only costs a branch.
+ *
+ * Statistics are updated by one thread at a time, device calls with hw
+ * module lock held and stream calls mostly from the stream IO thread.
+ * Reading them from another thread may give slightly inconsistent values,
+ * which is fine for statistics. */
+
+typedef enum pa_droid_hal_call {
+    /* audio_hw_device_t */
+    PA_DROID_HAL_CALL_SET_PARAMETERS,
+    PA_DROID_HAL_CALL_GET_PARAMETERS,
+    PA_DROID_HAL_CALL_OPEN_OUTPUT_STREAM,
+    PA_DROID_HAL_CALL_CLOSE_OUTPUT_STREAM,
+    PA_DROID_HAL_CALL_OPEN_INPUT_STREAM,
+    PA_DROID_HAL_CALL_CLOSE_INPUT_STREAM,
+    PA_DROID_HAL_CALL_CREATE_AUDIO_PATCH,
+    PA_DROID_HAL_CALL_RELEASE_AUDIO_PATCH,
+    PA_DROID_HAL_CALL_SET_MODE,
+    PA_DROID_HAL_CALL_SET_VOICE_VOLUME,
+    PA_DROID_HAL_CALL_SET_MIC_MUTE,
+    PA_DROID_HAL_CALL_GET_MIC_MUTE,
+    /* audio_stream_out_t and audio_stream_in_t */
+    PA_DROID_HAL_CALL_WRITE,
+    PA_DROID_HAL_CALL_READ,
+    PA_DROID_HAL_CALL_STANDBY,
+    PA_DROID_HAL_CALL_GET_LATENCY,
+    PA_DROID_HAL_CALL_SET_VOLUME,
+    PA_DROID_HAL_CALL_STREAM_SET_PARAMETERS,
+    PA_DROID_HAL_CALL_MAX
+} pa_droid_hal_call_t;
+
+/* Bucket 0 counts calls taking less than 1us, bucket n calls taking
+ * [2^(n-1), 2^n) us and the last bucket everything longer. */
+#define PA_DROID_HAL_STATS_BUCKETS (24)
+
+typedef struct pa_droid_hal_stat {
+    uint64_t count;
+    uint64_t total_usec;
+    pa_usec_t max_usec;
+    uint64_t buckets[PA_DROID_HAL_STATS_BUCKETS];
+} pa_droid_hal_stat;
+
+typedef struct pa_droid_hal_stats {
+    pa_droid_hal_stat calls[PA_DROID_HAL_CALL_MAX];
+} pa_droid_hal_stats;
+
+pa_droid_hal_stats *pa_droid_hal_stats_new(void);
+void pa_droid_hal_stats_free(pa_droid_hal_stats *stats);
+void pa_droid_hal_stats_reset(pa_droid_hal_stats *stats);
+/* Add statistics of src to dst. */
+void pa_droid_hal_stats_merge(pa_droid_hal_stats *dst, const pa_droid_hal_stats *src);
+/* Append statistics as JSON object, entry points without calls are left out. */
+void pa_droid_hal_stats_to_json(const pa_droid_hal_stats *stats, pa_strbuf *buf);
+const char *pa_droid_hal_call_to_string(pa_droid_hal_call_t call);
+
+static inline void pa_droid_hal_stats_record(pa_droid_hal_stats *stats, pa_droid_hal_call_t call, pa_usec_t usec) {
+    pa_droid_hal_stat *s = &stats->calls[call];
+    unsigned bucket = 0;
+
+    if (usec > 0) {
+        bucket = 64 - __builtin_clzll(usec);
+        if (bucket >= PA_DROID_HAL_STATS_BUCKETS)
+            bucket = PA_DROID_HAL_STATS_BUCKETS - 1;
+    }
+
+    s->count++;
+    s->total_usec += usec;
+    if (usec > s->max_usec)
+        s->max_usec = usec;
+    s->buckets[bucket]++;
+}
+
+/* Run statement, which calls HAL function, and record time it took to stats,
+ * if stats is not NULL. For example
+ *
+ *   PA_DROID_HAL_TIMED(hw->hal_stats, PA_DROID_HAL_CALL_SET_MODE,
+ *                      ret = hw->device->set_mode(hw->device, mode));
+ */
+#define PA_DROID_HAL_TIMED(stats, call, ...)                                    \
+    do {                                                                        \
+        pa_droid_hal_stats *_stats = (stats);                                   \
+        if (PA_LIKELY(!_stats)) {                                               \
+            __VA_ARGS__;                                                        \
+        } else {                                                                \
+            pa_usec_t _begin = pa_rtclock_now();                                \
+            __VA_ARGS__;                                                        \
+            pa_droid_hal_stats_record(_stats, (call), pa_rtclock_now() - _begin); \
+        }                                                                       \
+    } while (0)
+
+#endif
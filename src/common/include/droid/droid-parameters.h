@@ -0,0 +1,68 @@
+#ifndef foodroidparametersfoo
+#define foodroidparametersfoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Ordered set of HAL parameter key value pairs. Setting a key which already
+ * exists replaces the value in place. Converted to "k1=v1;k2=v2" string for
+ * set_parameters() calls. */
+
+typedef struct pa_droid_parameters pa_droid_parameters;
+
+pa_droid_parameters *pa_droid_parameters_new(void);
+/* Parse key value pairs separated with ';'. Malformed pairs are ignored. */
+pa_droid_parameters *pa_droid_parameters_from_string(const char *str);
+pa_droid_parameters *pa_droid_parameters_copy(const pa_droid_parameters *p);
+void pa_droid_parameters_free(pa_droid_parameters *p);
+
+void pa_droid_parameters_set(pa_droid_parameters *p, const char *key, const char *value);
+void pa_droid_parameters_set_int(pa_droid_parameters *p, const char *key, int32_t value);
+void pa_droid_parameters_set_uint(pa_droid_parameters *p, const char *key, uint32_t value);
+/* Add all pairs from src to p. */
+void pa_droid_parameters_merge(pa_droid_parameters *p, const pa_droid_parameters *src);
+
+/* Returns NULL if key doesn't exist. */
+const char *pa_droid_parameters_get(const pa_droid_parameters *p, const char *key);
+/* Key of the first pair, NULL if empty. */
+const char *pa_droid_parameters_first_key(const pa_droid_parameters *p);
+unsigned pa_droid_parameters_size(const pa_droid_parameters *p);
+/* Iterate over pairs in order. Initialize state to NULL before first call.
+ * Returns false when there are no more pairs. */
+bool pa_droid_parameters_iterate(const pa_droid_parameters *p, void **state,
+                                 const char **key, const char **value);
+/* Returns true if any of the keys in a exists in b. */
+bool pa_droid_parameters_intersect(const pa_droid_parameters *a, const pa_droid_parameters *b);
+/* Returns true if a and b have same keys in same order. Values are not compared
+ * unless compare_values is true. */
+bool pa_droid_parameters_equal(const pa_droid_parameters *a, const pa_droid_parameters *b, bool compare_values);
+
+char *pa_droid_parameters_to_string(const pa_droid_parameters *p);
+
+#endif
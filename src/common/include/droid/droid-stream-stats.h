@@ -0,0 +1,157 @@
+#ifndef foodroidstreamstatsfoo
+#define foodroidstreamstatsfoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/strbuf.h>
+
+/* Runtime IO statistics of a droid stream. Statistics are written only by the
+ * IO thread of the sink or source owning the stream, all updates are done
+ * between pa_droid_stream_stats_begin() and pa_droid_stream_stats_end().
+ * Other threads take a consistent snapshot with pa_droid_stream_stats_get()
+ * without locking, retrying if the IO thread was updating at the same time.
+ * Resetting is likewise only requested by other threads, and done by the IO
+ * thread on its next update. */
+
+#define PA_DROID_STREAM_STATS_ALIGN (64)
+
+typedef struct pa_droid_stream_stats {
+    pa_atomic_t seq;                /* odd while update is in progress */
+    pa_atomic_t reset;              /* reset requested */
+
+    pa_usec_t started;              /* when statistics were created or reset */
+
+    uint64_t frames;                /* frames written to or read from HAL */
+    uint64_t io_count;              /* write or read rounds */
+    pa_usec_t io_time_min;
+    pa_usec_t io_time_max;
+    pa_usec_t io_time_total;
+    uint64_t wakeups;               /* timer wakeups */
+    pa_usec_t wakeup_late_max;      /* wakeup time after rtpoll timer deadline */
+    pa_usec_t wakeup_late_total;
+    uint64_t wakeup_late_sq_total;  /* for jitter, in usec^2 */
+    uint64_t late_wakeups;          /* wakeups later than stream buffer length */
+    uint64_t underruns;             /* renders where a playing sink input ran out of data */
+    pa_usec_t cpu_time_max;         /* IO thread CPU time used per wakeup */
+    pa_usec_t cpu_time_total;
+    uint64_t cpu_count;
+    pa_usec_t device_latency;       /* latency of the device as last reported to PulseAudio,
+                                     * HAL latency for sinks, fixed latency for sources */
+    pa_usec_t device_latency_max;
+    uint64_t short_writes;
+    uint64_t errors;                /* failed writes or reads */
+    uint64_t silence_periods;       /* silence posted while input stream is not valid */
+    uint64_t silence_frames;
+    uint64_t rewinds;
+    uint64_t suspends;
+    uint64_t resumes;
+} __attribute__((aligned(PA_DROID_STREAM_STATS_ALIGN))) pa_droid_stream_stats;
+
+pa_droid_stream_stats *pa_droid_stream_stats_new(void);
+void pa_droid_stream_stats_free(pa_droid_stream_stats *stats);
+/* Request reset of stats, can be called from any thread. */
+void pa_droid_stream_stats_reset(pa_droid_stream_stats *stats);
+/* Called from IO thread, use pa_droid_stream_stats_begin(). */
+void pa_droid_stream_stats_do_reset(pa_droid_stream_stats *stats);
+/* Copy consistent snapshot of stats, can be called from any thread. */
+void pa_droid_stream_stats_get(const pa_droid_stream_stats *stats, pa_droid_stream_stats *snapshot);
+/* Append snapshot as JSON object members, without enclosing braces. */
+void pa_droid_stream_stats_to_json(const pa_droid_stream_stats *snapshot, pa_strbuf *buf);
+
+/* Called from IO thread. */
+static inline void pa_droid_stream_stats_begin(pa_droid_stream_stats *stats) {
+    pa_atomic_inc(&stats->seq);
+
+    if (PA_UNLIKELY(pa_atomic_load(&stats->reset)))
+        pa_droid_stream_stats_do_reset(stats);
+}
+
+/* Called from IO thread. */
+static inline void pa_droid_stream_stats_end(pa_droid_stream_stats *stats) {
+    pa_atomic_inc(&stats->seq);
+}
+
+/* Called from IO thread between begin and end. */
+static inline void pa_droid_stream_stats_io(pa_droid_stream_stats *stats, uint64_t frames, pa_usec_t io_time) {
+    if (stats->io_count == 0 || io_time < stats->io_time_min)
+        stats->io_time_min = io_time;
+    if (io_time > stats->io_time_max)
+        stats->io_time_max = io_time;
+    stats->io_time_total += io_time;
+    stats->io_count++;
+    stats->frames += frames;
+}
+
+/* Called from IO thread between begin and end. Wakeup later than
+ * buffer_time after deadline is counted as late, 0 buffer_time disables. */
+static inline void pa_droid_stream_stats_wakeup(pa_droid_stream_stats *stats, pa_usec_t deadline, pa_usec_t now,
+                                                pa_usec_t buffer_time) {
+    pa_usec_t late = now > deadline ? now - deadline : 0;
+
+    if (late > stats->wakeup_late_max)
+        stats->wakeup_late_max = late;
+    stats->wakeup_late_total += late;
+    stats->wakeup_late_sq_total += (uint64_t) late * late;
+    if (buffer_time > 0 && late > buffer_time)
+        stats->late_wakeups++;
+    stats->wakeups++;
+}
+
+/* CPU time used by the calling thread. */
+static inline pa_usec_t pa_droid_stream_stats_cpu_now(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0)
+        return 0;
+
+    return (pa_usec_t) ts.tv_sec * PA_USEC_PER_SEC + (pa_usec_t) ts.tv_nsec / PA_NSEC_PER_USEC;
+}
+
+/* Called from IO thread between begin and end with CPU time spent handling
+ * one wakeup, measured with pa_droid_stream_stats_cpu_now(). */
+static inline void pa_droid_stream_stats_cpu(pa_droid_stream_stats *stats, pa_usec_t cpu_time) {
+    if (cpu_time > stats->cpu_time_max)
+        stats->cpu_time_max = cpu_time;
+    stats->cpu_time_total += cpu_time;
+    stats->cpu_count++;
+}
+
+/* Called from IO thread between begin and end. */
+static inline void pa_droid_stream_stats_latency(pa_droid_stream_stats *stats, pa_usec_t latency) {
+    if (latency > stats->device_latency_max)
+        stats->device_latency_max = latency;
+    stats->device_latency = latency;
+}
+
+#endif
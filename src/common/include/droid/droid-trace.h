@@ -0,0 +1,88 @@
+#ifndef foodroidtracefoo
+#define foodroidtracefoo
+
+/*
+ * Copyright (C) 2026 Jolla Mobile Ltd
+ *
+ * Contact: Enni Hämäläinen <enni.hamalainen@jolla.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pulse/gccmacro.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* Timeline tracing to ftrace trace_marker, in the format used by systrace,
+ * so that IO thread activity can be viewed together with kernel scheduling:
+ *
+ *   PA_DROID_TRACE_BEGIN("%s write", name);
+ *   ...
+ *   PA_DROID_TRACE_END();
+ *
+ * Tracing is disabled by default and can be toggled at runtime with
+ * pa_droid_trace_set_enabled(). When disabled each tracepoint costs one
+ * atomic load and a branch. */
+
+extern pa_atomic_t pa_droid_trace_enabled_flag;
+
+/* Called from main thread. Returns false if trace_marker couldn't be opened
+ * when enabling. */
+bool pa_droid_trace_set_enabled(bool enabled);
+
+static inline bool pa_droid_trace_enabled(void) {
+    return PA_UNLIKELY(pa_atomic_load(&pa_droid_trace_enabled_flag));
+}
+
+void pa_droid_trace_begin(const char *format, ...) PA_GCC_PRINTF_ATTR(1,2);
+void pa_droid_trace_end(void);
+void pa_droid_trace_instant(const char *format, ...) PA_GCC_PRINTF_ATTR(1,2);
+void pa_droid_trace_counter(const char *name, int64_t value);
+
+#define PA_DROID_TRACE_BEGIN(...)                                               \
+    do {                                                                        \
+        if (pa_droid_trace_enabled())                                           \
+            pa_droid_trace_begin(__VA_ARGS__);                                  \
+    } while (0)
+
+#define PA_DROID_TRACE_END()                                                    \
+    do {                                                                        \
+        if (pa_droid_trace_enabled())                                           \
+            pa_droid_trace_end();                                               \
+    } while (0)
+
+#define PA_DROID_TRACE_INSTANT(...)                                             \
+    do {                                                                        \
+        if (pa_droid_trace_enabled())                                           \
+            pa_droid_trace_instant(__VA_ARGS__);                                \
+    } while (0)
+
+#define PA_DROID_TRACE_COUNTER(name, value)                                     \
+    do {                                                                        \
+        if (pa_droid_trace_enabled())                                           \
+            pa_droid_trace_counter(name, value);                                \
+    } while (0)
+
+#endif
@@ -31,9 +31,14 @@
 #include <pulsecore/strlist.h>
 #include <pulsecore/atomic.h>
 #include <pulsecore/modargs.h>
+#include <pulsecore/hook-list.h>
+#include <pulsecore/msgobject.h>
 
 #include <droid/version.h>
 #include <droid/droid-config.h>
+#include <droid/droid-parameters.h>
+#include <droid/droid-hal-stats.h>
+#include <droid/droid-stream-stats.h>
 
 #define PROP_DROID_DEVICES    "droid.devices"
 #define PROP_DROID_FLAGS      "droid.flags"
@@ -76,6 +81,13 @@ enum pa_droid_option_type {
     DM_OPTION_RECORD_VOICE_16K,
     DM_OPTION_USE_LEGACY_STREAM_SET_PARAMETERS,
     DM_OPTION_USB_DEVICES,
+    DM_OPTION_STREAM_CACHE,
+    DM_OPTION_CONFIG_RELOAD,
+    DM_OPTION_INDEPENDENT_ROUTING,
+    DM_OPTION_PARAMETER_CACHE,
+    DM_OPTION_DEFERRED_SINKS,
+    DM_OPTION_HAL_STATS,
+    DM_OPTION_TRACE,
     DM_OPTION_COUNT
 };
 
@@ -111,6 +123,42 @@ struct pa_droid_hw_module {
     pa_atomic_t active_outputs;
 
     pa_droid_options options;
+    struct dm_stream_cache *stream_cache;
+    pa_defer_event *stream_cache_defer;
+    /* Target for messages from IO threads to be handled in main thread. */
+    pa_msgobject *main_msg;
+    struct dm_file_watch *config_watch;
+    /* Fired from main loop after configuration reload changed enabled_module,
+     * call data is pa_droid_hw_module. */
+    pa_hook config_changed_hook;
+
+    /* pa_droid_parameters queued with pa_droid_hw_queue_parameters() */
+    dm_list *parameters_queue;
+    pa_defer_event *parameters_defer;
+
+    struct dm_hal_api *hal_api;
+    struct dm_parameter_cache *parameter_cache;
+    /* NULL if module wasn't opened with pa_droid_hw_module_get2() */
+    struct dm_startup_trace *startup_trace;
+    /* HAL call statistics of device calls and closed streams, NULL unless
+     * hal_stats option is enabled. */
+    pa_droid_hal_stats *hal_stats;
+
+    /* Audio calibration wait, see audio_cal_wait option. */
+    struct {
+        enum {
+            DM_AUDIO_CAL_IDLE,
+            DM_AUDIO_CAL_LOADING,
+            DM_AUDIO_CAL_WAITING,
+            DM_AUDIO_CAL_DONE,
+        } state;
+        pa_usec_t started;
+        struct dm_file_watch *watch;
+        pa_time_event *timer;
+        /* Fired from main loop when calibration is done, call data is
+         * pa_droid_hw_module. */
+        pa_hook done_hook;
+    } audio_cal;
 
     /* Mode and input control */
     struct _state {
@@ -153,10 +201,17 @@ struct pa_droid_stream {
 
     audio_io_handle_t io_handle;
     audio_patch_handle_t audio_patch;
+    const dm_config_port *patch_device_ports[AUDIO_PATCH_PORTS_MAX]; /* devices audio_patch is connected to */
+    unsigned n_patch_device_ports;
     const dm_config_port *active_device_port;
 
     pa_droid_output_stream *output;
     pa_droid_input_stream *input;
+
+    /* HAL call statistics of this stream, NULL unless hal_stats option is enabled. */
+    pa_droid_hal_stats *hal_stats;
+    /* IO statistics, updated by the IO thread using the stream. */
+    pa_droid_stream_stats *stats;
 };
 
 struct pa_droid_card_data {
@@ -235,6 +290,9 @@ struct pa_droid_profile_set {
     pa_hashmap *output_mappings;
     pa_hashmap *input_mappings;
     pa_hashmap *profiles;
+    /* Mappings removed with pa_droid_profile_set_update(), kept until the
+     * profile set is freed. */
+    dm_list *removed_mappings;
 };
 
 #define PA_DROID_OUTPUT_PARKING "output-parking"
@@ -264,9 +322,26 @@ bool pa_droid_hw_has_mic_control(pa_droid_hw_module *hw);
 int pa_droid_hw_mic_get_mute(pa_droid_hw_module *hw_module, bool *muted);
 void pa_droid_hw_mic_set_mute(pa_droid_hw_module *hw_module, bool muted);
 
+/* Device to device audio patches. Audio flows from source device port to sink
+ * device ports inside HAL without being processed by PulseAudio. */
+int pa_droid_hw_create_device_patch(pa_droid_hw_module *hw,
+                                    const dm_config_port *source,
+                                    const dm_config_port **sinks,
+                                    unsigned n_sinks,
+                                    audio_patch_handle_t *handle);
+void pa_droid_hw_release_device_patch(pa_droid_hw_module *hw, audio_patch_handle_t handle);
+
 /* Profiles */
 pa_droid_profile_set *pa_droid_profile_set_default_new(dm_config_module *module);
 void pa_droid_profile_set_free(pa_droid_profile_set *ps);
+/* Update profile set created from module after dm_config_module_update()
+ * changed the module. Mappings are added to default profile for new mix ports
+ * and removed from all profiles for removed mix ports, except primary output
+ * mapping. Other mappings are not changed. Added and removed mappings are
+ * put to added and removed. Removed mappings stay valid until the profile set
+ * is freed. Call from main thread. */
+void pa_droid_profile_set_update(pa_droid_profile_set *ps, dm_config_module *module,
+                                 pa_idxset *added, pa_idxset *removed);
 
 void pa_droid_profile_free(pa_droid_profile *p);
 
@@ -285,7 +360,43 @@ void pa_droid_add_card_ports(pa_card_profile *cp, pa_hashmap *ports, pa_droid_ma
 
 /* Module operations */
 int pa_droid_set_parameters(pa_droid_hw_module *hw, const char *parameters);
+/* Get parameters from hw module. Returned string needs to be freed with pa_xfree().
+ * Returns NULL on failure. */
+char *pa_droid_get_parameters(pa_droid_hw_module *hw, const char *keys);
+/* Set parameters immediately. Any queued parameters are set before. */
+int pa_droid_hw_set_parameters(pa_droid_hw_module *hw, const pa_droid_parameters *parameters);
+/* Queue parameters to be set from main loop on next iteration. Queued parameters
+ * are coalesced, connect and disconnect of the same device cancel each other
+ * and parameters with the same keys replace earlier queued ones. Device
+ * connection changes are set each with their own call, the rest are merged to
+ * as few set_parameters() calls as possible without repeating keys within one
+ * call. The queue is also flushed before any stream routing or audio patch is
+ * changed and before other set_parameters() calls. Takes ownership of
+ * parameters. Called from main context. */
+void pa_droid_hw_queue_parameters(pa_droid_hw_module *hw, pa_droid_parameters *parameters);
 pa_droid_stream *pa_droid_hw_primary_output_stream(pa_droid_hw_module *hw);
+/* Returns true while audio calibration is running and audio shouldn't be
+ * written yet. done_hook in audio_cal is fired when calibration is done. */
+bool pa_droid_hw_audio_cal_pending(pa_droid_hw_module *hw);
+/* Startup phase tracing. Loading configuration, opening the HAL, stream opens
+ * and audio calibration are recorded automatically, pa_droid_hw_startup_phase()
+ * adds phase which started at begin and ended now. Phases are recorded until
+ * pa_droid_hw_startup_finish() is called, which also logs the report. */
+void pa_droid_hw_startup_phase(pa_droid_hw_module *hw, const char *name, pa_usec_t begin);
+void pa_droid_hw_startup_finish(pa_droid_hw_module *hw);
+/* Returns startup report as JSON object, free with pa_xfree(). Returns NULL
+ * if startup wasn't traced. */
+char *pa_droid_hw_startup_report(pa_droid_hw_module *hw);
+/* Returns HAL call statistics of the module and its open streams as JSON
+ * object, free with pa_xfree(). Returns NULL if hal_stats option isn't
+ * enabled. */
+char *pa_droid_hw_hal_stats_report(pa_droid_hw_module *hw);
+void pa_droid_hw_hal_stats_reset(pa_droid_hw_module *hw);
+/* Returns IO statistics of open streams as JSON array, free with pa_xfree(). */
+char *pa_droid_hw_stream_stats_report(pa_droid_hw_module *hw);
+/* Request reset of IO statistics of open streams. Each stream is reset by its
+ * IO thread on the next update. */
+void pa_droid_hw_stream_stats_reset(pa_droid_hw_module *hw);
 
 /* Stream operations */
 pa_droid_stream *pa_droid_stream_ref(pa_droid_stream *s);
@@ -306,10 +417,16 @@ pa_droid_stream *pa_droid_open_output_stream(pa_droid_hw_module *module,
  *   open streams as well
  * - if routing is set to non-primary stream and primary stream exists, do nothing
  * - if routing is set to non-primary stream and primary stream doesn't exist, set routing
+ * - with independent_routing option only the given output stream is routed
+ * All of the above is done before returning, also when called from IO thread.
  * Input:
  * - buffer size or channel count may change
  */
 int pa_droid_stream_set_route(pa_droid_stream *s, dm_config_port *device_port);
+/* Same as above, but route output stream to several devices at once. With audio
+ * patches HAL renders the stream to all devices, with legacy routing the device
+ * types are combined. Input streams use only the first device. */
+int pa_droid_stream_set_route_devices(pa_droid_stream *s, const dm_config_port **device_ports, unsigned n_device_ports);
 
 /* Open input stream with currently active routing, sample_spec and channel_map
  * are requests and may change when opening the stream. */
@@ -344,11 +461,21 @@ static inline int pa_droid_output_stream_any_active(pa_droid_stream *s) {
 }
 
 static inline ssize_t pa_droid_stream_write(pa_droid_stream *stream, const void *buffer, size_t bytes) {
-    return stream->output->stream->write(stream->output->stream, buffer, bytes);
+    ssize_t ret;
+
+    PA_DROID_HAL_TIMED(stream->hal_stats, PA_DROID_HAL_CALL_WRITE,
+                       ret = stream->output->stream->write(stream->output->stream, buffer, bytes));
+
+    return ret;
 }
 
 static inline ssize_t pa_droid_stream_read(pa_droid_stream *stream, void *buffer, size_t bytes) {
-    return stream->input->stream->read(stream->input->stream, buffer, bytes);
+    ssize_t ret;
+
+    PA_DROID_HAL_TIMED(stream->hal_stats, PA_DROID_HAL_CALL_READ,
+                       ret = stream->input->stream->read(stream->input->stream, buffer, bytes));
+
+    return ret;
 }
 
 void pa_droid_stream_set_data(pa_droid_stream *s, void *data);
@@ -26,7 +26,11 @@
 #include <config.h>
 #endif
 
+#include <pulsecore/strbuf.h>
+
 void dm_replace_in_place(char **string, const char *a, const char *b);
 bool dm_strcasestr(const char *haystack, const char *needle);
+/* Append string to buf as quoted and escaped JSON string. */
+void dm_json_append_string(pa_strbuf *buf, const char *s);
 
 #endif
@@ -60,6 +60,7 @@ bool dm_list_remove(dm_list *list, dm_list_entry *entry) {
             if (entry->prev)
                 entry->prev->next = entry->next;
             pa_xfree(entry);
+            list->size--;
             break;
         }
     }
@@ -62,3 +62,18 @@ bool dm_strcasestr(const char *haystack, const char *needle) {
 
     return false;
 }
+
+void dm_json_append_string(pa_strbuf *buf, const char *s) {
+    pa_strbuf_putc(buf, '"');
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            pa_strbuf_putc(buf, '\\');
+        if ((unsigned char) *s < 0x20)
+            pa_strbuf_printf(buf, "\\u%04x", (unsigned char) *s);
+        else
+            pa_strbuf_putc(buf, *s);
+    }
+
+    pa_strbuf_putc(buf, '"');
+}
@@ -25,6 +25,7 @@
 
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
@@ -54,13 +55,30 @@
 #include <pulsecore/time-smoother.h>
 #include <pulsecore/hashmap.h>
 #include <pulsecore/core-subscribe.h>
+#include <pulsecore/strbuf.h>
 #include <pulse/util.h>
 #include <pulse/version.h>
 
 #include "droid-sink.h"
 #include <droid/droid-util.h>
 #include <droid/conversion.h>
+#include <droid/droid-trace.h>
 #include <droid/sllist.h>
+#include <droid/utils.h>
+
+#define EXTRA_DEVICES_MAX (sizeof(audio_devices_t) * 8)
+
+struct route_request {
+    const dm_config_port *device_ports[AUDIO_PATCH_PORTS_MAX];
+    unsigned n_device_ports;
+};
+
+struct route_switch_stat {
+    unsigned count;
+    pa_usec_t min;
+    pa_usec_t max;
+    pa_usec_t total;
+};
 
 struct userdata {
     pa_core *core;
@@ -80,10 +98,12 @@ struct userdata {
     pa_usec_t buffer_time;
     pa_usec_t write_time;
     pa_usec_t write_threshold;
+    pa_usec_t wakeup_deadline; /* when rtpoll timer was set to elapse, 0 if not set */
 
     dm_config_port *active_device_port;
-    dm_config_port *override_device_port;
-    dm_list *extra_devices_stack;
+    audio_devices_t override_devices;
+    unsigned extra_devices[EXTRA_DEVICES_MAX]; /* reference count per device bit */
+    pa_hashmap *extra_devices_inputs; /* pa_sink_input -> audio_devices_t */
 
     bool use_hw_volume;
     bool use_voice_volume;
@@ -96,20 +116,43 @@ struct userdata {
     pa_hook_slot *sink_input_put_hook_slot;
     pa_hook_slot *sink_input_unlink_hook_slot;
     pa_hook_slot *sink_proplist_changed_hook_slot;
+    pa_hook_slot *audio_cal_done_hook_slot;
     pa_hashmap *parameters;
+    uint32_t parameters_generation;
 
     pa_droid_card_data *card_data;
     pa_droid_hw_module *hw_module;
     pa_droid_stream *stream;
+
+    /* Route switching in IO thread, see route_switch_*() */
+    struct {
+        enum {
+            ROUTE_SWITCH_IDLE,
+            ROUTE_SWITCH_FADE_OUT,
+            ROUTE_SWITCH_FADE_IN,
+        } state;
+        struct route_request request;
+        char *route_name;
+        pa_hashmap *stats; /* "from -> to" -> struct route_switch_stat */
+    } route_switch;
 };
 
 #define DEFAULT_MODULE_ID "primary"
 
+/* Length of fade out before and fade in after route switch. */
+#define ROUTE_SWITCH_RAMP_USEC  (5 * PA_USEC_PER_MSEC)
+
+enum {
+    SINK_MESSAGE_DO_ROUTING = PA_SINK_MESSAGE_MAX,
+    SINK_MESSAGE_GET_ROUTE_SWITCH_STATS,
+};
+
 /* sink properties */
 #define PROP_DROID_PARAMETER_PREFIX "droid.parameter."
 typedef struct droid_parameter_mapping {
     char *key;
     char *value;
+    uint32_t generation;
 } droid_parameter_mapping;
 
 /* sink-input properties */
@@ -128,109 +171,350 @@ static void set_voice_volume(struct userdata *u, pa_sink_input *i);
 static void apply_volume(pa_sink *s);
 static pa_sink_input *find_volume_control_sink_input(struct userdata *u);
 
-static bool add_extra_devices(struct userdata *u, audio_devices_t device) {
-    dm_list_entry *prev;
+/* Resolve output device mask to device ports. Returns number of device ports
+ * found or 0 if any of the devices is unknown. */
+static unsigned resolve_device_ports(struct userdata *u, audio_devices_t devices,
+                                     const dm_config_port **device_ports, unsigned max) {
     dm_config_port *device_port;
+    audio_devices_t device;
+    unsigned n = 0;
+    unsigned bit;
 
     pa_assert(u);
-    pa_assert(u->extra_devices_stack);
+    pa_assert(u->active_device_port);
 
-    if (!(device_port = dm_config_find_device_port(u->active_device_port, device))) {
-        pa_log("Unknown device port %u", device);
-        return false;
+    for (bit = 0; bit < sizeof(audio_devices_t) * 8 && n < max; bit++) {
+        if (!(devices & (1U << bit)))
+            continue;
+
+        device = 1U << bit;
+
+        if (!(device_port = dm_config_find_device_port(u->active_device_port, device))) {
+            pa_log("Unknown device port %#010x", device);
+            return 0;
+        }
+
+        device_ports[n++] = device_port;
     }
 
-    prev = dm_list_last(u->extra_devices_stack);
+    return n;
+}
 
-    dm_list_push_back(u->extra_devices_stack, device_port);
+/* Take reference to each device in devices mask for sink-input. Returns true
+ * if override devices changed. */
+static bool add_extra_devices(struct userdata *u, pa_sink_input *sink_input, audio_devices_t devices) {
+    const dm_config_port *device_ports[AUDIO_PATCH_PORTS_MAX];
+    audio_devices_t added = 0;
+    unsigned bit;
+
+    pa_assert(u);
+    pa_assert(sink_input);
+    pa_assert(u->extra_devices_inputs);
 
-    if (prev) {
-        dm_config_port *last_port = prev->data;
-        if (dm_config_port_equal(last_port, device_port))
-            return false;
+    if (!resolve_device_ports(u, devices, device_ports, AUDIO_PATCH_PORTS_MAX))
+        return false;
+
+    if (pa_hashmap_put(u->extra_devices_inputs, sink_input, PA_UINT32_TO_PTR(devices)) < 0)
+        return false;
+
+    for (bit = 0; bit < EXTRA_DEVICES_MAX; bit++) {
+        if ((devices & (1U << bit)) && u->extra_devices[bit]++ == 0)
+            added |= 1U << bit;
     }
 
-    u->override_device_port = device_port;
+    u->override_devices |= added;
 
-    return true;
+    return !!added;
 }
 
-static bool remove_extra_devices(struct userdata *u, audio_devices_t device) {
-    dm_config_port *device_port;
-    dm_list_entry *remove = NULL, *i = NULL;
-    bool need_update = false;
+/* Release references sink-input holds to devices. Returns true if override
+ * devices changed. */
+static bool remove_extra_devices(struct userdata *u, pa_sink_input *sink_input) {
+    audio_devices_t devices;
+    audio_devices_t removed = 0;
+    unsigned bit;
 
     pa_assert(u);
-    pa_assert(u->extra_devices_stack);
+    pa_assert(sink_input);
+    pa_assert(u->extra_devices_inputs);
 
-    if (!(device_port = dm_config_find_device_port(u->active_device_port, device))) {
-        pa_log("Unknown device port %u", device);
+    if (!(devices = PA_PTR_TO_UINT32(pa_hashmap_remove(u->extra_devices_inputs, sink_input))))
         return false;
-    }
 
-    DM_LIST_FOREACH(i, u->extra_devices_stack) {
-        if (dm_config_port_equal(i->data, device_port)) {
-            remove = i;
-            break;
-        }
-    }
+    pa_log_debug("Remove extra route %#010x.", devices);
 
-    if (remove && dm_list_last(u->extra_devices_stack) == remove)
-        need_update = true;
+    for (bit = 0; bit < EXTRA_DEVICES_MAX; bit++) {
+        if ((devices & (1U << bit)) && --u->extra_devices[bit] == 0)
+            removed |= 1U << bit;
+    }
 
-    if (remove)
-        dm_list_remove(u->extra_devices_stack, remove);
+    u->override_devices &= ~removed;
 
-    return need_update;
+    return !!removed;
 }
 
 static void clear_extra_devices(struct userdata *u) {
     pa_assert(u);
-    pa_assert(u->extra_devices_stack);
+    pa_assert(u->extra_devices_inputs);
 
-    while (dm_list_steal_first(u->extra_devices_stack));
-    u->override_device_port = NULL;
+    pa_hashmap_remove_all(u->extra_devices_inputs);
+    memset(u->extra_devices, 0, sizeof(u->extra_devices));
+    u->override_devices = 0;
 }
 
-/* Called from main context during voice calls, and from IO context during media operation. */
+/* Called from IO context, or from main context before IO thread is running. */
+static void route_apply(struct userdata *u, struct route_request *request) {
+    pa_assert(u);
+    pa_assert(u->stream);
+    pa_assert(request);
+
+    pa_droid_hw_module_lock(u->hw_module);
+    pa_droid_stream_set_route_devices(u->stream, request->device_ports, request->n_device_ports);
+    pa_droid_hw_module_unlock(u->hw_module);
+}
+
+/* Called from main context. Routing is always done in IO context when the IO
+ * thread is running. During voice calls, or when sink is not opened, routing
+ * is done immediately and the call blocks until the route is applied.
+ * Otherwise the route change is queued, and IO thread fades out the output,
+ * switches the route and fades the output back in. */
 static void do_routing(struct userdata *u) {
-    dm_config_port *routing = NULL;
+    struct route_request *request;
+    unsigned n = 0;
 
     pa_assert(u);
     pa_assert(u->stream);
 
-    if (u->use_voice_volume && u->override_device_port)
+    if (u->use_voice_volume && u->override_devices)
         clear_extra_devices(u);
 
-    if (u->override_device_port)
-        routing = u->override_device_port;
+    request = pa_xnew0(struct route_request, 1);
+
+    /* Extra devices may contain several devices, all of them are routed to
+     * with a single audio patch. */
+    if (u->override_devices)
+        n = resolve_device_ports(u, u->override_devices, request->device_ports, AUDIO_PATCH_PORTS_MAX);
+
+    if (n == 0) {
+        request->device_ports[0] = u->active_device_port;
+        n = 1;
+    }
+
+    request->n_device_ports = n;
+
+    if (!u->thread || !u->sink) {
+        route_apply(u, request);
+        pa_xfree(request);
+    } else if (u->use_voice_volume || !PA_SINK_IS_OPENED(u->sink->state)) {
+        pa_asyncmsgq_send(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_DO_ROUTING, request, true, NULL);
+        pa_xfree(request);
+    } else
+        pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_DO_ROUTING, request, false, NULL,
+                          pa_xfree);
+}
+
+/* Called from IO context */
+static char *route_request_to_string(const struct route_request *request) {
+    pa_strbuf *buf;
+    unsigned i;
+
+    buf = pa_strbuf_new();
+
+    for (i = 0; i < request->n_device_ports; i++)
+        pa_strbuf_printf(buf, "%s%s", i ? "+" : "", request->device_ports[i]->name);
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+/* Called from IO context */
+static void route_switch_update_stats(struct userdata *u, const char *to, pa_usec_t elapsed) {
+    struct route_switch_stat *stat;
+    char *key;
+
+    key = pa_sprintf_malloc("%s -> %s", u->route_switch.route_name ? u->route_switch.route_name : "(none)", to);
+
+    if (!(stat = pa_hashmap_get(u->route_switch.stats, key))) {
+        stat = pa_xnew0(struct route_switch_stat, 1);
+        stat->min = elapsed;
+        pa_hashmap_put(u->route_switch.stats, key, stat);
+    } else
+        pa_xfree(key);
+
+    stat->count++;
+    stat->total += elapsed;
+    stat->min = PA_MIN(stat->min, elapsed);
+    stat->max = PA_MAX(stat->max, elapsed);
+
+    pa_log_info("Route switch %s -> %s took %0.2f ms (%u switches, min %0.2f ms, avg %0.2f ms, max %0.2f ms)",
+                u->route_switch.route_name ? u->route_switch.route_name : "(none)", to,
+                (double) elapsed / PA_USEC_PER_MSEC,
+                stat->count,
+                (double) stat->min / PA_USEC_PER_MSEC,
+                (double) stat->total / stat->count / PA_USEC_PER_MSEC,
+                (double) stat->max / PA_USEC_PER_MSEC);
+}
+
+/* Called from IO context, or from main context before IO thread is running.
+ * {"from -> to":{"count":N,"min_usec":N,"avg_usec":N,"max_usec":N},...} */
+static void route_switch_stats_to_json(struct userdata *u, pa_strbuf *buf) {
+    struct route_switch_stat *stat;
+    const void *key;
+    void *state = NULL;
+    bool first = true;
+
+    pa_strbuf_putc(buf, '{');
+
+    PA_HASHMAP_FOREACH_KV(key, stat, u->route_switch.stats, state) {
+        if (!first)
+            pa_strbuf_putc(buf, ',');
+        dm_json_append_string(buf, key);
+        pa_strbuf_printf(buf, ":{\"count\":%u,\"min_usec\":%llu,\"avg_usec\":%llu,\"max_usec\":%llu}",
+                         stat->count,
+                         (unsigned long long) stat->min,
+                         (unsigned long long) (stat->total / stat->count),
+                         (unsigned long long) stat->max);
+        first = false;
+    }
+
+    pa_strbuf_putc(buf, '}');
+}
+
+/* Called from IO context */
+static void route_switch_execute(struct userdata *u, struct route_request *request) {
+    pa_usec_t start;
+    char *to;
+
+    pa_assert(u);
+    pa_assert(request);
+
+    to = route_request_to_string(request);
+
+    PA_DROID_TRACE_BEGIN("%s route %s", u->sink->name, to);
+    start = pa_rtclock_now();
+    route_apply(u, request);
+    route_switch_update_stats(u, to, pa_rtclock_now() - start);
+    PA_DROID_TRACE_END();
+
+    pa_xfree(u->route_switch.route_name);
+    u->route_switch.route_name = to;
+}
+
+/* Called from IO context. Apply pending route switch immediately, if any. */
+static void route_switch_flush(struct userdata *u) {
+    pa_assert(u);
+
+    if (u->route_switch.state == ROUTE_SWITCH_FADE_OUT)
+        route_switch_execute(u, &u->route_switch.request);
+
+    u->route_switch.state = ROUTE_SWITCH_IDLE;
+}
+
+/* Called from IO context */
+static void route_switch_request(struct userdata *u, struct route_request *request, bool immediate) {
+    pa_assert(u);
+    pa_assert(request);
+
+    if (immediate || !PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+        u->route_switch.state = ROUTE_SWITCH_IDLE;
+        route_switch_execute(u, request);
+        return;
+    }
+
+    /* If previous request is still waiting for fade out, the newer request
+     * just replaces it. */
+    u->route_switch.request = *request;
+    u->route_switch.state = ROUTE_SWITCH_FADE_OUT;
+}
+
+/* Called from IO context. Progress route switch after chunk has been written. */
+static void route_switch_advance(struct userdata *u) {
+    pa_assert(u);
+
+    switch (u->route_switch.state) {
+        case ROUTE_SWITCH_FADE_OUT:
+            route_switch_execute(u, &u->route_switch.request);
+            u->route_switch.state = ROUTE_SWITCH_FADE_IN;
+            break;
+
+        case ROUTE_SWITCH_FADE_IN:
+            u->route_switch.state = ROUTE_SWITCH_IDLE;
+            break;
+
+        case ROUTE_SWITCH_IDLE:
+            break;
+    }
+}
+
+#define RAMP_SAMPLES(type)                                          \
+    do {                                                            \
+        type *d = (type *) p;                                       \
+        for (f = 0; f < frames; f++) {                              \
+            float gain = ramp_gain(f, frames, ramp, fade_in);       \
+            for (ch = 0; ch < channels; ch++, d++)                  \
+                *d = (type) (*d * gain);                            \
+        }                                                           \
+    } while (0)
+
+static inline float ramp_gain(size_t f, size_t frames, size_t ramp, bool fade_in) {
+    if (fade_in)
+        return f < ramp ? (float) f / ramp : 1.0f;
     else
-        routing = u->active_device_port;
+        return f + ramp >= frames ? (float) (frames - f - 1) / ramp : 1.0f;
+}
+
+/* Called from IO context. Fade in the start or fade out the end of the chunk.
+ * Formats other than native endian S16, S32 and float are left unmodified. */
+static void route_switch_ramp(struct userdata *u, pa_memchunk *c, bool fade_in) {
+    const pa_sample_spec *ss = &u->sink->sample_spec;
+    size_t frame_size, frames, ramp, f;
+    unsigned channels, ch;
+    void *p;
+
+    if (ss->format != PA_SAMPLE_S16NE &&
+        ss->format != PA_SAMPLE_S32NE &&
+        ss->format != PA_SAMPLE_FLOAT32NE)
+        return;
+
+    frame_size = pa_frame_size(ss);
+    channels = ss->channels;
+    frames = c->length / frame_size;
+    ramp = PA_MIN(pa_usec_to_bytes(ROUTE_SWITCH_RAMP_USEC, ss) / frame_size, frames);
 
-    pa_droid_stream_set_route(u->stream, routing);
+    if (ramp == 0)
+        return;
+
+    pa_memchunk_make_writable(c, 0);
+    p = pa_memblock_acquire_chunk(c);
+
+    switch (ss->format) {
+        case PA_SAMPLE_S16NE:
+            RAMP_SAMPLES(int16_t);
+            break;
+        case PA_SAMPLE_S32NE:
+            RAMP_SAMPLES(int32_t);
+            break;
+        case PA_SAMPLE_FLOAT32NE:
+            RAMP_SAMPLES(float);
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    pa_memblock_release(c->memblock);
 }
 
 static bool parse_device_list(const char *str, audio_devices_t *dst) {
     pa_assert(str);
     pa_assert(dst);
 
-    char *dev;
-    const char *state = NULL;
+    char *unknown = NULL;
 
-    *dst = 0;
+    pa_conversion_parse_list(CONV_STRING_OUTPUT_DEVICE, "|", str, dst, &unknown);
 
-    while ((dev = pa_split(str, "|", &state))) {
-        audio_devices_t d;
-
-        if (!pa_string_convert_output_device_str_to_num(dev, &d)) {
-            pa_log_warn("Unknown device %s", dev);
-            pa_xfree(dev);
-            return false;
-        }
-
-        *dst |= d;
-
-        pa_xfree(dev);
+    if (unknown) {
+        pa_log_warn("Unknown device %s", unknown);
+        pa_xfree(unknown);
+        return false;
     }
 
     return true;
@@ -240,13 +524,19 @@ static int thread_write(struct userdata *u) {
     pa_memchunk c;
     const void *p;
     ssize_t wrote;
+    size_t length;
 
     pa_memblockq_peek_fixed_size(u->memblockq, u->buffer_size, &c);
 
+    if (PA_UNLIKELY(u->route_switch.state != ROUTE_SWITCH_IDLE))
+        route_switch_ramp(u, &c, u->route_switch.state == ROUTE_SWITCH_FADE_IN);
+
     /* We should be able to write everything in one go as long as memblock size
      * is multiples of buffer_size. */
 
+    PA_DROID_TRACE_BEGIN("%s write %zu", u->sink->name, c.length);
     u->write_time = pa_rtclock_now();
+    length = c.length;
 
     for (;;) {
         p = pa_memblock_acquire_chunk(&c);
@@ -258,12 +548,20 @@ static int thread_write(struct userdata *u) {
             pa_memblock_unref(c.memblock);
             u->write_time = 0;
             pa_log("failed to write stream (%zd)", wrote);
+            pa_droid_stream_stats_begin(u->stream->stats);
+            u->stream->stats->errors++;
+            pa_droid_stream_stats_end(u->stream->stats);
+            PA_DROID_TRACE_END();
+            route_switch_advance(u);
             return -1;
         }
 
         if (wrote < (ssize_t) c.length) {
             c.index += wrote;
             c.length -= wrote;
+            pa_droid_stream_stats_begin(u->stream->stats);
+            u->stream->stats->short_writes++;
+            pa_droid_stream_stats_end(u->stream->stats);
             continue;
         }
 
@@ -274,9 +572,38 @@ static int thread_write(struct userdata *u) {
     }
 
     u->write_time = pa_rtclock_now() - u->write_time;
+    PA_DROID_TRACE_END();
+
+    pa_droid_stream_stats_begin(u->stream->stats);
+    pa_droid_stream_stats_io(u->stream->stats, length / pa_frame_size(&u->sink->sample_spec), u->write_time);
+    pa_droid_stream_stats_end(u->stream->stats);
+
+    route_switch_advance(u);
 
     return 0;
 }
+/* Called from IO context after rendering length bytes. Sink inputs which have
+ * played before and ran out of data during this render are counted as
+ * underruns, silence rendered for them afterwards is not counted again. */
+static void count_underruns(struct userdata *u, size_t length) {
+    pa_sink_input *i;
+    void *state = NULL;
+    unsigned n = 0;
+
+    PA_HASHMAP_FOREACH(i, u->sink->thread_info.inputs, state) {
+        if (i->thread_info.underrun_for != (uint64_t) -1 &&
+            i->thread_info.underrun_for_sink > 0 &&
+            i->thread_info.underrun_for_sink <= length)
+            n++;
+    }
+
+    if (n > 0) {
+        pa_droid_stream_stats_begin(u->stream->stats);
+        u->stream->stats->underruns += n;
+        pa_droid_stream_stats_end(u->stream->stats);
+    }
+}
+
 static void thread_render(struct userdata *u) {
     size_t length;
     size_t missing;
@@ -289,6 +616,7 @@ static void thread_render(struct userdata *u) {
         pa_sink_render_full(u->sink, missing, &c);
         pa_memblockq_push_align(u->memblockq, &c);
         pa_memblock_unref(c.memblock);
+        count_underruns(u, missing);
     }
 }
 
@@ -310,6 +638,12 @@ static void process_rewind(struct userdata *u) {
     pa_assert(rewind_nbytes > 0);
     pa_log_debug("Requested to rewind %lu bytes.", (unsigned long) rewind_nbytes);
 
+    pa_droid_stream_stats_begin(u->stream->stats);
+    u->stream->stats->rewinds++;
+    pa_droid_stream_stats_end(u->stream->stats);
+
+    PA_DROID_TRACE_INSTANT("%s rewind %zu", u->sink->name, rewind_nbytes);
+
     queue_length = pa_memblockq_get_length(u->memblockq);
     if (queue_length <= u->buffer_size)
         goto do_nothing;
@@ -358,26 +692,47 @@ static void thread_func(void *userdata) {
 
             if (pa_rtpoll_timer_elapsed(u->rtpoll)) {
                 pa_usec_t sleept = 0;
+                pa_usec_t cpu_time = pa_droid_stream_stats_cpu_now();
+
+                if (u->wakeup_deadline) {
+                    pa_droid_stream_stats_begin(u->stream->stats);
+                    pa_droid_stream_stats_wakeup(u->stream->stats, u->wakeup_deadline, pa_rtclock_now(), u->buffer_time);
+                    pa_droid_stream_stats_end(u->stream->stats);
+                }
 
                 if (u->use_hw_volume)
                     pa_sink_volume_change_apply(u->sink, NULL);
 
+                PA_DROID_TRACE_BEGIN("%s render", u->sink->name);
                 thread_render(u);
+                PA_DROID_TRACE_END();
                 thread_write(u);
 
                 if (u->write_time > u->write_threshold)
                     sleept = u->buffer_time;
 
                 pa_rtpoll_set_timer_relative(u->rtpoll, sleept);
+                u->wakeup_deadline = pa_rtclock_now() + sleept;
 
                 if (u->use_hw_volume)
                     pa_sink_volume_change_apply(u->sink, NULL);
+
+                cpu_time = pa_droid_stream_stats_cpu_now() - cpu_time;
+                pa_droid_stream_stats_begin(u->stream->stats);
+                pa_droid_stream_stats_cpu(u->stream->stats, cpu_time);
+                pa_droid_stream_stats_end(u->stream->stats);
             }
-        } else
+        } else {
             pa_rtpoll_set_timer_disabled(u->rtpoll);
+            u->wakeup_deadline = 0;
+        }
 
         /* Sleep */
-        if ((ret = pa_rtpoll_run(u->rtpoll)) < 0)
+        PA_DROID_TRACE_BEGIN("%s sleep", u->sink->name);
+        ret = pa_rtpoll_run(u->rtpoll);
+        PA_DROID_TRACE_END();
+
+        if (ret < 0)
             goto fail;
 
         if (ret == 0)
@@ -402,8 +757,14 @@ static int suspend(struct userdata *u) {
     pa_assert(u);
     pa_assert(u->sink);
 
+    route_switch_flush(u);
+
     ret = pa_droid_stream_suspend(u->stream, true);
 
+    pa_droid_stream_stats_begin(u->stream->stats);
+    u->stream->stats->suspends++;
+    pa_droid_stream_stats_end(u->stream->stats);
+
     if (ret == 0) {
         pa_sink_set_max_request_within_thread(u->sink, 0);
         pa_log_info("Device suspended.");
@@ -431,6 +792,10 @@ static int unsuspend(struct userdata *u) {
 
     pa_droid_stream_suspend(u->stream, false);
 
+    pa_droid_stream_stats_begin(u->stream->stats);
+    u->stream->stats->resumes++;
+    pa_droid_stream_stats_end(u->stream->stats);
+
     return 0;
 }
 
@@ -449,10 +814,11 @@ static int sink_set_state_in_io_thread_cb(pa_sink *s, pa_sink_state_t new_state,
 
     switch (new_state) {
         case PA_SINK_SUSPENDED:
-            pa_assert(PA_SINK_IS_OPENED(u->sink->thread_info.state));
-
-            if ((r = suspend(u)) < 0)
-                return r;
+            /* Sink may be created suspended, see audio calibration wait. */
+            if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+                if ((r = suspend(u)) < 0)
+                    return r;
+            }
 
             break;
 
@@ -487,7 +853,23 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
     switch (code) {
         case PA_SINK_MESSAGE_GET_LATENCY: {
-            *((pa_usec_t*) data) = pa_droid_stream_get_latency(u->stream);
+            pa_usec_t latency = pa_droid_stream_get_latency(u->stream);
+
+            pa_droid_stream_stats_begin(u->stream->stats);
+            pa_droid_stream_stats_latency(u->stream->stats, latency);
+            pa_droid_stream_stats_end(u->stream->stats);
+
+            *((pa_usec_t*) data) = latency;
+            return 0;
+        }
+
+        case SINK_MESSAGE_DO_ROUTING: {
+            route_switch_request(u, data, !!offset);
+            return 0;
+        }
+
+        case SINK_MESSAGE_GET_ROUTE_SWITCH_STATS: {
+            route_switch_stats_to_json(u, data);
             return 0;
         }
     }
@@ -524,6 +906,7 @@ static void apply_volume(pa_sink *s) {
     struct userdata *u = s->userdata;
     pa_cvolume r;
     float val;
+    int ret;
 
     if (u->use_voice_volume)
         return;
@@ -541,7 +924,9 @@ static void apply_volume(pa_sink *s) {
 
     pa_log_debug("Set %s volume -> %f", s->name, val);
     pa_droid_hw_module_lock(u->hw_module);
-    if (u->stream->output->stream->set_volume(u->stream->output->stream, val, val) < 0)
+    PA_DROID_HAL_TIMED(u->stream->hal_stats, PA_DROID_HAL_CALL_SET_VOLUME,
+                       ret = u->stream->output->stream->set_volume(u->stream->output->stream, val, val));
+    if (ret < 0)
         pa_log_warn("Failed to set volume.");
     pa_droid_hw_module_unlock(u->hw_module);
 }
@@ -559,6 +944,7 @@ static void sink_write_volume_cb(pa_sink *s) {
 static void set_voice_volume(struct userdata *u, pa_sink_input *i) {
     pa_cvolume vol;
     float val;
+    int ret;
 
     pa_assert_ctl_context();
     pa_assert(u);
@@ -570,7 +956,9 @@ static void set_voice_volume(struct userdata *u, pa_sink_input *i) {
     pa_log_debug("Set voice volume %f", val);
 
     pa_droid_hw_module_lock(u->hw_module);
-    if (u->hw_module->device->set_voice_volume(u->hw_module->device, val) < 0)
+    PA_DROID_HAL_TIMED(u->hw_module->hal_stats, PA_DROID_HAL_CALL_SET_VOICE_VOLUME,
+                       ret = u->hw_module->device->set_voice_volume(u->hw_module->device, val));
+    if (ret < 0)
         pa_log_warn("Failed to set voice volume.");
     pa_droid_hw_module_unlock(u->hw_module);
 }
@@ -741,6 +1129,28 @@ static void destroy_voice_virtual_stream(struct userdata *u) {
     pa_log_debug("Removed virtual stream.");
 }
 
+/* Called from main thread */
+char *pa_droid_sink_route_switch_stats(pa_sink *sink) {
+    struct userdata *u;
+    pa_strbuf *buf;
+
+    pa_assert_ctl_context();
+    pa_assert(sink);
+
+    u = sink->userdata;
+    pa_assert(u);
+    pa_assert(u->sink == sink);
+
+    buf = pa_strbuf_new();
+
+    if (u->thread)
+        pa_asyncmsgq_send(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_GET_ROUTE_SWITCH_STATS, buf, 0, NULL);
+    else
+        route_switch_stats_to_json(u, buf);
+
+    return pa_strbuf_to_string_free(buf);
+}
+
 /* Called from main thread */
 void pa_droid_sink_set_voice_control(pa_sink* sink, bool enable) {
     pa_sink_input *i;
@@ -819,8 +1229,8 @@ static pa_hook_result_t sink_input_put_hook_cb(pa_core *c, pa_sink_input *sink_i
 
             pa_log_debug("%s: Add extra route %s (%u).", u->sink->name, dev_str, devices);
 
-            /* if this device was not routed to previously post routing change */
-            if (add_extra_devices(u, devices))
+            /* if any of the devices was not routed to previously post routing change */
+            if (add_extra_devices(u, sink_input, devices))
                 do_routing(u);
         }
     }
@@ -828,47 +1238,45 @@ static pa_hook_result_t sink_input_put_hook_cb(pa_core *c, pa_sink_input *sink_i
     return PA_HOOK_OK;
 }
 
-/* Remove extra routing when sink-inputs disappear. */
+/* Remove extra routing when sink-inputs disappear. Devices parsed when sink-input
+ * was put are used, so proplist doesn't need to be parsed again. */
 static pa_hook_result_t sink_input_unlink_hook_cb(pa_core *c, pa_sink_input *sink_input, struct userdata *u) {
-    const char *dev_str;
-    const char *media_str;
-    audio_devices_t devices;
-
-    /* Dynamic routing changes do not apply during active voice call. */
-    if (u->use_voice_volume)
-        return PA_HOOK_OK;
+    /* if any of the devices is no longer used post routing change, but
+     * dynamic routing changes do not apply during active voice call. */
+    if (remove_extra_devices(u, sink_input) && !u->use_voice_volume)
+        do_routing(u);
 
-    if ((dev_str = pa_proplist_gets(sink_input->proplist, PROP_DROID_ROUTE))) {
+    return PA_HOOK_OK;
+}
 
-        /* Do not change routing for gstreamer pulsesink probe. Workaround for unnecessary routing changes when gst-plugin
-         * pulsesink connects to our sink. Not the best fix or the best place for a fix, but let's have this here
-         * for now anyway. */
-        if ((media_str = pa_proplist_gets(sink_input->proplist, PA_PROP_MEDIA_NAME)) && pa_streq(media_str, "pulsesink probe"))
-            return PA_HOOK_OK;
+static pa_hook_result_t audio_cal_done_hook_cb(pa_droid_hw_module *hw, pa_droid_hw_module *call_data, struct userdata *u) {
+    pa_assert(u);
 
-        if (parse_device_list(dev_str, &devices) && devices) {
+    pa_log_info("Audio calibration done, resume %s.", u->sink->name);
 
-            pa_log_debug("Remove extra route %s (%u).", dev_str, devices);
+    pa_hook_slot_free(u->audio_cal_done_hook_slot);
+    u->audio_cal_done_hook_slot = NULL;
 
-            /* if this device no longer exists in extra devices map post routing change */
-            if (remove_extra_devices(u, devices))
-                do_routing(u);
-        }
-    }
+    pa_sink_suspend(u->sink, false, PA_SUSPEND_INTERNAL);
 
     return PA_HOOK_OK;
 }
 
 /* Watch for properties starting with droid.parameter. and translate them directly to
- * HAL set_parameters() calls. */
+ * HAL set_parameters() calls. All changed parameters are sent with a single call.
+ * Parameters seen during the latest update are stamped with the update generation,
+ * parameters removed from proplist are forgotten so that setting them again is
+ * passed to HAL even if the value is the same as before. */
 static pa_hook_result_t sink_proplist_changed_hook_cb(pa_core *c, pa_sink *sink, struct userdata *u) {
-    bool changed = false;
     const char *pkey;
     const char *key;
     const char *value;
     char *tmp;
     void *state = NULL;
     droid_parameter_mapping *parameter = NULL;
+    pa_strbuf *changed = NULL;
+    uint32_t generation;
+    unsigned seen = 0;
 
     pa_assert(sink);
     pa_assert(u);
@@ -876,38 +1284,55 @@ static pa_hook_result_t sink_proplist_changed_hook_cb(pa_core *c, pa_sink *sink,
     if (u->sink != sink)
         return PA_HOOK_OK;
 
+    generation = ++u->parameters_generation;
+
     while ((key = pa_proplist_iterate(sink->proplist, &state))) {
         if (!pa_startswith(key, PROP_DROID_PARAMETER_PREFIX))
             continue;
 
         pkey = key + strlen(PROP_DROID_PARAMETER_PREFIX);
-        if (pkey[0] == '\0')
+        if (pkey[0] == '\0' || !(value = pa_proplist_gets(sink->proplist, key)))
             continue;
 
-        changed = false;
-
         if (!(parameter = pa_hashmap_get(u->parameters, pkey))) {
             parameter = pa_xnew0(droid_parameter_mapping, 1);
             parameter->key = pa_xstrdup(pkey);
-            parameter->value = pa_xstrdup(pa_proplist_gets(sink->proplist, key));
+            parameter->value = pa_xstrdup(value);
             pa_hashmap_put(u->parameters, parameter->key, parameter);
-            changed = true;
+        } else if (!pa_streq(parameter->value, value)) {
+            pa_xfree(parameter->value);
+            parameter->value = pa_xstrdup(value);
         } else {
-            value = pa_proplist_gets(sink->proplist, key);
-            if (!pa_streq(parameter->value, value)) {
-                pa_xfree(parameter->value);
-                parameter->value = pa_xstrdup(value);
-                changed = true;
-            }
+            parameter->generation = generation;
+            seen++;
+            continue;
         }
 
-        if (changed) {
-            pa_assert(parameter);
-            tmp = pa_sprintf_malloc("%s=%s;", parameter->key, parameter->value);
-            pa_log_debug("set_parameters(): %s", tmp);
-            pa_droid_stream_set_parameters(u->stream, tmp);
-            pa_xfree(tmp);
+        parameter->generation = generation;
+        seen++;
+
+        if (!changed)
+            changed = pa_strbuf_new();
+        pa_strbuf_printf(changed, "%s=%s;", parameter->key, parameter->value);
+    }
+
+    /* Forget parameters which are no longer in proplist. */
+    while (seen < pa_hashmap_size(u->parameters)) {
+        PA_HASHMAP_FOREACH(parameter, u->parameters, state) {
+            if (parameter->generation != generation)
+                break;
         }
+
+        pa_assert(parameter);
+        pa_log_debug("Parameter %s removed from proplist.", parameter->key);
+        pa_hashmap_remove_and_free(u->parameters, parameter->key);
+    }
+
+    if (changed) {
+        tmp = pa_strbuf_to_string_free(changed);
+        pa_log_debug("set_parameters(): %s", tmp);
+        pa_droid_stream_set_parameters(u->stream, tmp);
+        pa_xfree(tmp);
     }
 
     return PA_HOOK_OK;
@@ -935,6 +1360,7 @@ pa_sink *pa_droid_sink_new(pa_module *m,
     pa_sample_spec sample_spec;
     pa_channel_map channel_map;
     bool namereg_fail = false;
+    bool audio_cal_wait;
     pa_usec_t latency;
     uint32_t sink_buffer = 0;
     char *sink_name = NULL;
@@ -1030,7 +1456,9 @@ pa_sink *pa_droid_sink_new(pa_module *m,
     u->voice_virtual_stream = voice_virtual_stream;
     u->voice_property_key   = pa_xstrdup(pa_modargs_get_value(ma, "voice_property_key", DEFAULT_VOICE_CONTROL_PROPERTY_KEY));
     u->voice_property_value = pa_xstrdup(pa_modargs_get_value(ma, "voice_property_value", DEFAULT_VOICE_CONTROL_PROPERTY_VALUE));
-    u->extra_devices_stack = dm_list_new();
+    u->extra_devices_inputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    u->route_switch.stats = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                                                pa_xfree, pa_xfree);
 
     if (card_data) {
         u->card_data = card_data;
@@ -1087,6 +1515,11 @@ pa_sink *pa_droid_sink_new(pa_module *m,
     data.module = m;
     data.card = card;
 
+    /* Audio written too early may break calibration, create primary sink
+     * suspended and keep it so until calibration is done. */
+    if ((audio_cal_wait = pa_droid_stream_is_primary(u->stream) && pa_droid_hw_audio_cal_pending(u->hw_module)))
+        data.suspend_cause = PA_SUSPEND_INTERNAL;
+
     sink_name = dm_config_escape_string(module_id);
     set_sink_name(ma, &data, am, sink_name);
     pa_proplist_sets(data.proplist, PA_PROP_DEVICE_CLASS, "sound");
@@ -1168,14 +1601,22 @@ pa_sink *pa_droid_sink_new(pa_module *m,
                 (pa_hook_cb_t) sink_input_unlink_hook_cb, u);
         u->sink_proplist_changed_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_PROPLIST_CHANGED], PA_HOOK_EARLY,
                 (pa_hook_cb_t) sink_proplist_changed_hook_cb, u);
+    }
 
-        /* Port changes are done only in primary sink. */
+    /* Port changes are done only in primary sink, unless every sink has
+     * its own route. */
+    if (pa_droid_stream_is_primary(u->stream) || pa_droid_option(u->hw_module, DM_OPTION_INDEPENDENT_ROUTING))
         u->sink->set_port = sink_set_port_cb;
-    }
 
     update_volumes(u);
 
-    pa_droid_stream_suspend(u->stream, false);
+    if (audio_cal_wait) {
+        pa_log_info("Keep %s suspended until audio calibration is done.", u->sink->name);
+        u->audio_cal_done_hook_slot = pa_hook_connect(&u->hw_module->audio_cal.done_hook, PA_HOOK_NORMAL,
+                                                      (pa_hook_cb_t) audio_cal_done_hook_cb, u);
+    } else
+        pa_droid_stream_suspend(u->stream, false);
+
     pa_droid_stream_set_data(u->stream, u->sink);
     pa_sink_put(u->sink);
 
@@ -1234,6 +1675,9 @@ static void userdata_free(struct userdata *u) {
     if (u->sink_proplist_changed_hook_slot)
         pa_hook_slot_free(u->sink_proplist_changed_hook_slot);
 
+    if (u->audio_cal_done_hook_slot)
+        pa_hook_slot_free(u->audio_cal_done_hook_slot);
+
     if (u->sink)
         pa_sink_unref(u->sink);
 
@@ -1257,8 +1701,13 @@ static void userdata_free(struct userdata *u) {
     if (u->voice_property_value)
         pa_xfree(u->voice_property_value);
 
-    if (u->extra_devices_stack)
-        dm_list_free(u->extra_devices_stack, NULL);
+    if (u->extra_devices_inputs)
+        pa_hashmap_free(u->extra_devices_inputs);
+
+    if (u->route_switch.stats)
+        pa_hashmap_free(u->route_switch.stats);
+
+    pa_xfree(u->route_switch.route_name);
 
     pa_xfree(u);
 }
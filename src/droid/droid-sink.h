@@ -53,5 +53,8 @@ pa_sink *pa_droid_sink_new(pa_module *m,
 void pa_droid_sink_free(pa_sink *s);
 
 void pa_droid_sink_set_voice_control(pa_sink* sink, bool enable);
+/* Route switch durations per "from -> to" route pair as JSON object,
+ * free with pa_xfree(). */
+char *pa_droid_sink_route_switch_stats(pa_sink *sink);
 
 #endif
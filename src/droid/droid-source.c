@@ -57,6 +57,7 @@
 #include "droid-source.h"
 #include <droid/droid-util.h>
 #include <droid/conversion.h>
+#include <droid/droid-trace.h>
 
 struct userdata {
     pa_core *core;
@@ -105,6 +106,7 @@ static int thread_read(struct userdata *u) {
     void *p;
     ssize_t readd;
     pa_memchunk chunk;
+    pa_usec_t read_time;
 
     chunk.index = 0;
     chunk.memblock = pa_memblock_new(u->core->mempool, (size_t) u->buffer_size);
@@ -116,16 +118,34 @@ static int thread_read(struct userdata *u) {
             p = pa_memblock_acquire(chunk.memblock);
             chunk.length = pa_memblock_get_length(chunk.memblock);
             pa_silence_memory(p, chunk.length, &u->source->sample_spec);
+            PA_DROID_TRACE_INSTANT("%s silence %zu", u->source->name, chunk.length);
             pa_source_post(u->source, &chunk);
             pa_memblock_release(chunk.memblock);
+            if (u->stream) {
+                pa_droid_stream_stats_begin(u->stream->stats);
+                u->stream->stats->silence_periods++;
+                u->stream->stats->silence_frames += chunk.length / pa_frame_size(&u->source->sample_spec);
+                pa_droid_stream_stats_end(u->stream->stats);
+            }
             goto end;
         }
     }
 
     p = pa_memblock_acquire(chunk.memblock);
+    PA_DROID_TRACE_BEGIN("%s read %zu", u->source->name, pa_memblock_get_length(chunk.memblock));
+    read_time = pa_rtclock_now();
     readd = pa_droid_stream_read(u->stream, p, pa_memblock_get_length(chunk.memblock));
+    read_time = pa_rtclock_now() - read_time;
+    PA_DROID_TRACE_END();
     pa_memblock_release(chunk.memblock);
 
+    pa_droid_stream_stats_begin(u->stream->stats);
+    if (readd < 0)
+        u->stream->stats->errors++;
+    else
+        pa_droid_stream_stats_io(u->stream->stats, readd / pa_frame_size(pa_droid_stream_sample_spec(u->stream)), read_time);
+    pa_droid_stream_stats_end(u->stream->stats);
+
     if (readd < 0) {
         pa_log("Failed to read from stream. (err %zd)", readd);
         goto end;
@@ -180,14 +200,33 @@ static void thread_func(void *userdata) {
         int ret;
 
         if (PA_SOURCE_IS_OPENED(u->source->thread_info.state)) {
+            pa_usec_t cpu_time = pa_droid_stream_stats_cpu_now();
+
+            if (pa_rtpoll_timer_elapsed(u->rtpoll)) {
+                pa_droid_stream_stats_begin(u->stream->stats);
+                pa_droid_stream_stats_wakeup(u->stream->stats, u->timestamp, pa_rtclock_now(),
+                                             u->source->thread_info.fixed_latency);
+                pa_droid_stream_stats_end(u->stream->stats);
+            }
+
             thread_read(u);
 
+            cpu_time = pa_droid_stream_stats_cpu_now() - cpu_time;
+            pa_droid_stream_stats_begin(u->stream->stats);
+            pa_droid_stream_stats_cpu(u->stream->stats, cpu_time);
+            pa_droid_stream_stats_latency(u->stream->stats, u->source->thread_info.fixed_latency);
+            pa_droid_stream_stats_end(u->stream->stats);
+
             pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp);
         } else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
         /* Sleep */
-        if ((ret = pa_rtpoll_run(u->rtpoll)) < 0)
+        PA_DROID_TRACE_BEGIN("%s sleep", u->source->name);
+        ret = pa_rtpoll_run(u->rtpoll);
+        PA_DROID_TRACE_END();
+
+        if (ret < 0)
             goto fail;
 
         if (ret == 0)
@@ -214,6 +253,10 @@ static int suspend(struct userdata *u) {
 
     ret = pa_droid_stream_suspend(u->stream, true);
 
+    pa_droid_stream_stats_begin(u->stream->stats);
+    u->stream->stats->suspends++;
+    pa_droid_stream_stats_end(u->stream->stats);
+
     if (ret == 0)
         pa_log_info("Device suspended.");
 
@@ -229,6 +272,9 @@ static void unsuspend(struct userdata *u) {
     } else if (pa_droid_stream_suspend(u->stream, false) >= 0) {
         u->stream_valid = true;
         pa_log_info("Resuming...");
+        pa_droid_stream_stats_begin(u->stream->stats);
+        u->stream->stats->resumes++;
+        pa_droid_stream_stats_end(u->stream->stats);
     } else
         u->stream_valid = false;
 }
@@ -449,7 +495,8 @@ static pa_hook_result_t source_output_new_hook_callback(void *hook_data,
 
     pa_log_info("New source-output connecting and our source needs to be reconfigured.");
 
-    /* Workaround for fm-radio loopback */
+    /* Workaround for fm-radio loopback done through PulseAudio. With audio patch
+     * capable HALs fmradio card profile patches the tuner directly to output. */
     if (pa_safe_streq(pa_proplist_gets(new_data->proplist, "media.name"), "fmradio-loopback-source") &&
         (primary_output = pa_droid_hw_primary_output_stream(u->hw_module))) {
         pa_log_debug("Workaround for fm-radio loopback.");
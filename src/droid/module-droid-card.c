@@ -25,6 +25,7 @@
 
 #include <inttypes.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 
 #ifdef HAVE_VALGRIND_MEMCHECK_H
@@ -35,6 +36,7 @@
 #include <pulse/timeval.h>
 #include <pulse/volume.h>
 #include <pulse/xmalloc.h>
+#include <pulse/version.h>
 
 #include <pulsecore/core.h>
 #include <pulsecore/i18n.h>
@@ -56,12 +58,17 @@
 #include <pulsecore/device-port.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/strlist.h>
+#include <pulsecore/strbuf.h>
+#if PA_CHECK_VERSION(15,0,0)
+#include <pulsecore/message-handler.h>
+#endif
 
 //#include <droid/hardware/audio_policy.h>
 //#include <droid/system/audio_policy.h>
 
 #include <droid/conversion.h>
 #include <droid/droid-util.h>
+#include <droid/droid-trace.h>
 #include <droid/sllist.h>
 #include <droid/utils.h>
 #include "droid-sink.h"
@@ -126,10 +133,16 @@ static const char* const valid_modargs[] = {
 #define RINGTONE_PROFILE_DESC       "Ringtone mode"
 #define COMMUNICATION_PROFILE_NAME  "communication"
 #define COMMUNICATION_PROFILE_DESC  "Communication mode"
+#define FMRADIO_PROFILE_NAME        "fmradio"
+#define FMRADIO_PROFILE_DESC        "FM radio mode"
+#define LINE_IN_PROFILE_NAME        "linein"
+#define LINE_IN_PROFILE_DESC        "Line in mode"
 
 #define VENDOR_EXT_REALCALL_ON      "realcall=on"
 #define VENDOR_EXT_REALCALL_OFF     "realcall=off"
 
+#define PROFILE_SWITCH_HISTORY      (16)
+
 struct userdata;
 
 typedef bool (*virtual_profile_event_cb)(struct userdata *u, pa_droid_profile *p, bool enabling);
@@ -140,6 +153,22 @@ struct virtual_profile {
     virtual_profile_event_cb event_cb;
 };
 
+struct profile_switch_step {
+    char *name;
+    pa_usec_t start;
+    pa_usec_t duration;
+};
+
+/* Timing of one card profile change, recorded step by step. */
+struct profile_switch {
+    char *from;
+    char *to;
+    int result;
+    pa_usec_t begin;
+    pa_usec_t total;
+    dm_list *steps;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -161,6 +190,21 @@ struct userdata {
 
     pa_modargs *modargs;
     pa_card *card;
+
+    /* Device to device loopback, active when loopback_device is set. */
+    audio_devices_t loopback_device;
+    audio_patch_handle_t loopback_patch;
+
+    /* Non-primary output mappings whose sinks are created after init, see
+     * deferred_sinks option. */
+    pa_idxset *pending_sinks;
+    pa_defer_event *pending_sinks_event;
+    /* Object path of the card message handler, /card/<card name>/droid */
+    char *message_handler_path;
+
+    /* Profile change in progress and last PROFILE_SWITCH_HISTORY finished ones. */
+    struct profile_switch *profile_switch;
+    dm_list *profile_switches;
 };
 
 struct profile_data {
@@ -218,6 +262,8 @@ static bool voicecall_voicemmode2_vsid_profile_event_cb(struct userdata *u, pa_d
 
 #endif /* DROID_AUDIO_HAL_DEBUG_VSID */
 
+static pa_droid_profile *card_get_droid_profile(pa_card_profile *cp);
+
 static void add_disabled_profile(pa_hashmap *profiles) {
     pa_card_profile *cp;
     struct profile_data *d;
@@ -403,6 +449,73 @@ static void add_profiles(struct userdata *u, pa_hashmap *h, pa_hashmap *ports) {
     }
 }
 
+static pa_droid_profile *current_droid_profile(struct userdata *u) {
+    struct profile_data *d;
+
+    d = PA_CARD_PROFILE_DATA(u->card->active_profile);
+
+    if (d->virtual_profile && u->real_profile)
+        return card_get_droid_profile(u->real_profile);
+
+    return d->droid_profile;
+}
+
+/* Create one pending sink per main loop iteration so that module loading
+ * doesn't wait for all output streams to open, and clients can be served
+ * between stream opens. */
+static void pending_sinks_cb(pa_mainloop_api *a, pa_defer_event *e, void *userdata) {
+    struct userdata *u = userdata;
+    pa_droid_profile *dp;
+    pa_droid_mapping *am;
+
+    pa_assert(u);
+
+    if ((am = pa_idxset_steal_first(u->pending_sinks, NULL))) {
+        dp = current_droid_profile(u);
+
+        if (!am->sink && dp && pa_idxset_get_by_data(dp->output_mappings, am, NULL)) {
+            pa_usec_t begin = pa_rtclock_now();
+            char *phase;
+
+            pa_log_debug("Create deferred sink for %s.", am->name);
+            am->sink = pa_droid_sink_new(u->module, u->modargs, __FILE__, &u->card_data, 0, am, u->card);
+
+            phase = pa_sprintf_malloc("deferred sink %s", am->name);
+            pa_droid_hw_startup_phase(u->hw_module, phase, begin);
+            pa_xfree(phase);
+        }
+    }
+
+    if (pa_idxset_isempty(u->pending_sinks)) {
+        a->defer_enable(e, 0);
+        pa_droid_hw_startup_finish(u->hw_module);
+    }
+}
+
+static void pending_sinks_add(struct userdata *u, pa_droid_mapping *am) {
+    pa_assert(u);
+    pa_assert(am);
+
+    if (!u->pending_sinks) {
+        u->pending_sinks = pa_idxset_new(NULL, NULL);
+        u->pending_sinks_event = u->core->mainloop->defer_new(u->core->mainloop, pending_sinks_cb, u);
+    }
+
+    pa_idxset_put(u->pending_sinks, am, NULL);
+    u->core->mainloop->defer_enable(u->pending_sinks_event, 1);
+}
+
+static void pending_sinks_clear(struct userdata *u) {
+    pa_assert(u);
+
+    if (!u->pending_sinks)
+        return;
+
+    while (pa_idxset_steal_first(u->pending_sinks, NULL));
+    u->core->mainloop->defer_enable(u->pending_sinks_event, 0);
+    pa_droid_hw_startup_finish(u->hw_module);
+}
+
 static void init_profile(struct userdata *u) {
     pa_droid_mapping *am;
     struct profile_data *d;
@@ -419,6 +532,11 @@ static void init_profile(struct userdata *u) {
             if (!output_enabled(u, am))
                 continue;
 
+            if (pa_droid_option(u->hw_module, DM_OPTION_DEFERRED_SINKS) && !pa_droid_mapping_is_primary(am)) {
+                pending_sinks_add(u, am);
+                continue;
+            }
+
             am->sink = pa_droid_sink_new(u->module, u->modargs, __FILE__, &u->card_data, 0, am, u->card);
         }
     }
@@ -433,6 +551,228 @@ static void init_profile(struct userdata *u) {
     }
 }
 
+static void remove_mapping_sink(struct userdata *u, pa_droid_profile *dp, pa_droid_mapping *am) {
+    pa_droid_mapping *primary;
+    pa_queue *sink_inputs;
+
+    if (u->pending_sinks)
+        pa_idxset_remove_by_data(u->pending_sinks, am, NULL);
+
+    if (!am->sink)
+        return;
+
+    pa_log_info("Mix port \"%s\" removed, remove sink %s.", am->name, am->sink->name);
+
+    sink_inputs = pa_sink_move_all_start(am->sink, NULL);
+    pa_droid_sink_free(am->sink);
+    am->sink = NULL;
+
+    if ((primary = pa_droid_idxset_get_primary(dp->output_mappings)) && primary->sink)
+        pa_sink_move_all_finish(primary->sink, sink_inputs, false);
+    else
+        pa_sink_move_all_fail(sink_inputs);
+}
+
+static void remove_mapping_source(struct userdata *u, pa_droid_profile *dp, pa_droid_mapping *am) {
+    pa_droid_mapping *other;
+    pa_queue *source_outputs;
+    uint32_t idx;
+
+    if (!am->source)
+        return;
+
+    pa_log_info("Mix port \"%s\" removed, remove source %s.", am->name, am->source->name);
+
+    source_outputs = pa_source_move_all_start(am->source, NULL);
+    pa_droid_source_free(am->source);
+    am->source = NULL;
+
+    PA_IDXSET_FOREACH(other, dp->input_mappings, idx) {
+        if (other->source) {
+            pa_source_move_all_finish(other->source, source_outputs, false);
+            return;
+        }
+    }
+
+    pa_source_move_all_fail(source_outputs);
+}
+
+/* Configuration was reloaded. Create sinks and sources for new mix ports of
+ * the active profile and remove the ones whose mix port was removed, streams
+ * of removed ones are moved to primary sink or remaining source. Other sinks
+ * and sources are left alone. */
+static pa_hook_result_t config_changed_hook_cb(pa_droid_hw_module *hw, pa_droid_hw_module *call_data, struct userdata *u) {
+    pa_droid_profile *dp;
+    pa_droid_mapping *am;
+    pa_idxset *added, *removed;
+    uint32_t idx;
+
+    pa_assert(u);
+
+    added = pa_idxset_new(NULL, NULL);
+    removed = pa_idxset_new(NULL, NULL);
+
+    pa_droid_profile_set_update(u->profile_set, u->hw_module->enabled_module, added, removed);
+
+    if (!(dp = current_droid_profile(u)))
+        goto done;
+
+    PA_IDXSET_FOREACH(am, removed, idx) {
+        if (am->direction == PA_DIRECTION_OUTPUT)
+            remove_mapping_sink(u, dp, am);
+        else
+            remove_mapping_source(u, dp, am);
+    }
+
+    PA_IDXSET_FOREACH(am, added, idx) {
+        if (am->direction == PA_DIRECTION_OUTPUT) {
+            if (!am->sink && pa_idxset_get_by_data(dp->output_mappings, am, NULL) && output_enabled(u, am)) {
+                pa_log_info("Mix port \"%s\" added, create sink.", am->name);
+                am->sink = pa_droid_sink_new(u->module, u->modargs, __FILE__, &u->card_data, 0, am, u->card);
+            }
+        } else {
+            if (!am->source && pa_idxset_get_by_data(dp->input_mappings, am, NULL) && input_enabled(u, am)) {
+                pa_log_info("Mix port \"%s\" added, create source.", am->name);
+                am->source = pa_droid_source_new(u->module, u->modargs, __FILE__, &u->card_data, am, u->card);
+            }
+        }
+    }
+
+done:
+    pa_idxset_free(added, NULL);
+    pa_idxset_free(removed, NULL);
+
+    return PA_HOOK_OK;
+}
+
+static void profile_switch_step_free(struct profile_switch_step *step) {
+    pa_assert(step);
+
+    pa_xfree(step->name);
+    pa_xfree(step);
+}
+
+static void profile_switch_free(struct profile_switch *ps) {
+    pa_assert(ps);
+
+    dm_list_free(ps->steps, (pa_free_cb_t) profile_switch_step_free);
+    pa_xfree(ps->from);
+    pa_xfree(ps->to);
+    pa_xfree(ps);
+}
+
+static void profile_switch_begin(struct userdata *u, pa_card_profile *from, pa_card_profile *to) {
+    struct profile_switch *ps;
+
+    pa_assert(u);
+    pa_assert(!u->profile_switch);
+
+    ps = pa_xnew0(struct profile_switch, 1);
+    ps->from = pa_xstrdup(from->name);
+    ps->to = pa_xstrdup(to->name);
+    ps->begin = pa_rtclock_now();
+    ps->steps = dm_list_new();
+
+    u->profile_switch = ps;
+}
+
+static void profile_switch_step(struct userdata *u, pa_usec_t begin, const char *format, ...) PA_GCC_PRINTF_ATTR(3,4);
+
+/* Add step of profile change in progress which started at begin and ended now. */
+static void profile_switch_step(struct userdata *u, pa_usec_t begin, const char *format, ...) {
+    struct profile_switch_step *step;
+    va_list ap;
+
+    pa_assert(u);
+
+    if (!u->profile_switch)
+        return;
+
+    step = pa_xnew0(struct profile_switch_step, 1);
+    va_start(ap, format);
+    step->name = pa_vsprintf_malloc(format, ap);
+    va_end(ap);
+    step->start = begin - u->profile_switch->begin;
+    step->duration = pa_rtclock_now() - begin;
+
+    dm_list_push_back(u->profile_switch->steps, step);
+}
+
+static void profile_switch_end(struct userdata *u, int result) {
+    struct profile_switch *ps;
+    struct profile_switch_step *step;
+    void *state = NULL;
+
+    pa_assert(u);
+    pa_assert_se((ps = u->profile_switch));
+
+    ps->result = result;
+    ps->total = pa_rtclock_now() - ps->begin;
+    u->profile_switch = NULL;
+
+    pa_log_info("Profile change %s -> %s %s in %0.1f ms:", ps->from, ps->to,
+                result < 0 ? "failed" : "done", (double) ps->total / PA_USEC_PER_MSEC);
+
+    DM_LIST_FOREACH_DATA(step, ps->steps, state)
+        pa_log_info("  %8.1f ms %8.1f ms  %s",
+                    (double) step->start / PA_USEC_PER_MSEC,
+                    (double) step->duration / PA_USEC_PER_MSEC,
+                    step->name);
+
+    if (!u->profile_switches)
+        u->profile_switches = dm_list_new();
+
+    dm_list_push_back(u->profile_switches, ps);
+
+    if (dm_list_size(u->profile_switches) > PROFILE_SWITCH_HISTORY)
+        profile_switch_free(dm_list_steal_first(u->profile_switches));
+}
+
+/* [{"from":"...","to":"...","result":0,"total_usec":N,
+ *   "steps":[{"name":"...","start_usec":N,"duration_usec":N},...]},...] */
+static char *profile_switches_to_string(struct userdata *u) {
+    struct profile_switch *ps;
+    struct profile_switch_step *step;
+    pa_strbuf *buf;
+    void *state = NULL, *state2;
+    bool first = true, first_step;
+
+    pa_assert(u);
+
+    buf = pa_strbuf_new();
+    pa_strbuf_putc(buf, '[');
+
+    if (u->profile_switches) {
+        DM_LIST_FOREACH_DATA(ps, u->profile_switches, state) {
+            /* Profile names come from configuration, escape them. */
+            pa_strbuf_puts(buf, first ? "{\"from\":" : ",{\"from\":");
+            dm_json_append_string(buf, ps->from);
+            pa_strbuf_puts(buf, ",\"to\":");
+            dm_json_append_string(buf, ps->to);
+            pa_strbuf_printf(buf, ",\"result\":%d,\"total_usec\":%llu,\"steps\":[",
+                             ps->result, (unsigned long long) ps->total);
+
+            first_step = true;
+            state2 = NULL;
+            DM_LIST_FOREACH_DATA(step, ps->steps, state2) {
+                pa_strbuf_puts(buf, first_step ? "{\"name\":" : ",{\"name\":");
+                dm_json_append_string(buf, step->name);
+                pa_strbuf_printf(buf, ",\"start_usec\":%llu,\"duration_usec\":%llu}",
+                                 (unsigned long long) step->start,
+                                 (unsigned long long) step->duration);
+                first_step = false;
+            }
+
+            pa_strbuf_puts(buf, "]}");
+            first = false;
+        }
+    }
+
+    pa_strbuf_putc(buf, ']');
+
+    return pa_strbuf_to_string_free(buf);
+}
+
 static void park_profile(pa_droid_profile *dp) {
     pa_droid_mapping *am;
     uint32_t idx;
@@ -525,17 +865,112 @@ static bool in_communication_profile_event_cb(struct userdata *u, pa_droid_profi
     return true;
 }
 
+static dm_config_port *find_input_device_port(struct userdata *u, audio_devices_t device) {
+    dm_config_port *device_port;
+    void *state;
+
+    DM_LIST_FOREACH_DATA(device_port, u->hw_module->enabled_module->device_ports, state) {
+        if (device_port->role == DM_CONFIG_ROLE_SOURCE && device_port->type == device)
+            return device_port;
+    }
+
+    return NULL;
+}
+
+static void loopback_patch_release(struct userdata *u) {
+    pa_droid_hw_release_device_patch(u->hw_module, u->loopback_patch);
+    u->loopback_patch = AUDIO_PATCH_HANDLE_NONE;
+}
+
+/* Patch loopback device directly to the device primary sink is routed to. */
+static bool loopback_patch_update(struct userdata *u) {
+    pa_droid_profile *dp;
+    pa_droid_mapping *am_output;
+    pa_droid_port_data *data;
+    const dm_config_port *sink_port;
+    dm_config_port *source_port;
+
+    pa_assert(u);
+    pa_assert(u->real_profile);
+
+    loopback_patch_release(u);
+
+    dp = card_get_droid_profile(u->real_profile);
+    if (!(am_output = pa_droid_idxset_get_primary(dp->output_mappings)) || !am_output->sink) {
+        pa_log("Active profile doesn't have primary output device.");
+        return false;
+    }
+
+    if (!am_output->sink->active_port ||
+        !(data = PA_DEVICE_PORT_DATA(am_output->sink->active_port)) ||
+        !data->device_port) {
+        pa_log_debug("Primary sink is parked, no loopback patch.");
+        return true;
+    }
+
+    if (!(source_port = find_input_device_port(u, u->loopback_device))) {
+        pa_log("No device port for loopback device %#010x.", u->loopback_device);
+        return false;
+    }
+
+    sink_port = data->device_port;
+
+    return pa_droid_hw_create_device_patch(u->hw_module, source_port, &sink_port, 1, &u->loopback_patch) >= 0;
+}
+
+static bool loopback_profile_event(struct userdata *u, audio_devices_t device, bool enabling) {
+    pa_assert(u);
+
+    if (enabling) {
+        u->loopback_device = device;
+        return loopback_patch_update(u);
+    } else {
+        loopback_patch_release(u);
+        u->loopback_device = AUDIO_DEVICE_NONE;
+        return true;
+    }
+}
+
+static bool fmradio_profile_event_cb(struct userdata *u, pa_droid_profile *p, bool enabling) {
+    return loopback_profile_event(u, AUDIO_DEVICE_IN_FM_TUNER, enabling);
+}
+
+static bool line_in_profile_event_cb(struct userdata *u, pa_droid_profile *p, bool enabling) {
+    return loopback_profile_event(u, AUDIO_DEVICE_IN_LINE, enabling);
+}
+
+/* Loopback patch follows the primary sink port. */
+static pa_hook_result_t sink_port_changed_hook_callback(void *hook_data,
+                                                        void *call_data,
+                                                        void *slot_data) {
+    pa_sink *sink = call_data;
+    struct userdata *u = slot_data;
+    pa_droid_mapping *am_output;
+
+    if (u->loopback_device == AUDIO_DEVICE_NONE || sink->card != u->card || !u->real_profile)
+        return PA_HOOK_OK;
+
+    am_output = pa_droid_idxset_get_primary(card_get_droid_profile(u->real_profile)->output_mappings);
+    if (!am_output || am_output->sink != sink)
+        return PA_HOOK_OK;
+
+    loopback_patch_update(u);
+
+    return PA_HOOK_OK;
+}
+
 #ifdef DROID_AUDIO_HAL_DEBUG_VSID
 static bool voicecall_vsid(struct userdata *u, pa_droid_profile *p, uint32_t vsid, bool enabling)
 {
-    char *setparam;
+    pa_droid_parameters *parameters;
 
-    setparam = pa_sprintf_malloc("%s=%u;%s=%d", AUDIO_PARAMETER_KEY_VSID, vsid,
-                                                AUDIO_PARAMETER_KEY_CALL_STATE,
-                                                enabling ? CALL_ACTIVE : CALL_INACTIVE);
+    parameters = pa_droid_parameters_new();
+    pa_droid_parameters_set_uint(parameters, AUDIO_PARAMETER_KEY_VSID, vsid);
+    pa_droid_parameters_set_int(parameters, AUDIO_PARAMETER_KEY_CALL_STATE,
+                                enabling ? CALL_ACTIVE : CALL_INACTIVE);
 
-    pa_droid_set_parameters(u->hw_module, setparam);
-    pa_xfree(setparam);
+    pa_droid_hw_set_parameters(u->hw_module, parameters);
+    pa_droid_parameters_free(parameters);
 
     return true;
 }
@@ -588,12 +1023,28 @@ static void virtual_event(struct userdata *u, struct profile_data *profile, bool
                                                       enabling ? "enabled" : "disabled",
                                                       profile->virtual.event_cb ? " (calling event callback)" : "");
 
-    if (profile->virtual.event_cb)
+    if (profile->virtual.event_cb) {
+        pa_usec_t begin = pa_rtclock_now();
+
         profile->virtual.event_cb(u, profile->droid_profile, enabling);
+        profile_switch_step(u, begin, "%s %s", enabling ? "enable" : "disable", profile->droid_profile->name);
+    }
 
     profile->virtual.enabled = enabling;
 }
 
+static void set_mode(struct userdata *u, audio_mode_t mode) {
+    pa_usec_t begin;
+
+    begin = pa_rtclock_now();
+    park_profile(card_get_droid_profile(u->real_profile));
+    profile_switch_step(u, begin, "park");
+
+    begin = pa_rtclock_now();
+    pa_droid_hw_set_mode(u->hw_module, mode);
+    profile_switch_step(u, begin, "set_mode %d", (int) mode);
+}
+
 static pa_card_profile *leave_virtual_profile(struct userdata *u, pa_card *c,
                                               struct profile_data *current, struct profile_data *next) {
     pa_card_profile *real = NULL;
@@ -606,10 +1057,8 @@ static pa_card_profile *leave_virtual_profile(struct userdata *u, pa_card *c,
 
     pa_log_debug("Leave virtual profile %s", current->droid_profile->name);
 
-    if (next->mode != current->mode) {
-        park_profile(card_get_droid_profile(u->real_profile));
-        pa_droid_hw_set_mode(u->hw_module, next->mode);
-    }
+    if (next->mode != current->mode)
+        set_mode(u, next->mode);
 
     virtual_event(u, current, false);
 
@@ -659,10 +1108,8 @@ static void enter_virtual_profile(struct userdata *u, pa_card *c,
         }
     }
 
-    if (next->mode != current->mode) {
-        park_profile(card_get_droid_profile(u->real_profile));
-        pa_droid_hw_set_mode(u->hw_module, next->mode);
-    }
+    if (next->mode != current->mode)
+        set_mode(u, next->mode);
 
     if (next->virtual.parent) {
         if (next->virtual.parent != current->card_profile) {
@@ -676,23 +1123,18 @@ static void enter_virtual_profile(struct userdata *u, pa_card *c,
     pa_log_debug("Entered virtual profile %s", next->droid_profile->name);
 }
 
-static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
-    struct userdata *u;
+static int switch_profile(struct userdata *u, pa_card *c, pa_card_profile *new_profile) {
     pa_card_profile *real_profile;
     pa_droid_mapping *am;
     struct profile_data *next, *curr;
     pa_queue *sink_inputs = NULL, *source_outputs = NULL;
     pa_sink *primary_sink = NULL;
+    pa_usec_t begin;
     uint32_t idx;
 
+    pa_assert(u);
     pa_assert(c);
     pa_assert(new_profile);
-    pa_assert_se(u = c->userdata);
-
-    if (new_profile->available != PA_AVAILABLE_YES) {
-        pa_log("Profile %s is not available.", new_profile->name);
-        return -1;
-    }
 
     next = PA_CARD_PROFILE_DATA(new_profile);
     curr = PA_CARD_PROFILE_DATA(c->active_profile);
@@ -711,6 +1153,9 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
         /* Continue to sink-input/source-output transfer below. */
     }
 
+    /* Sinks of the new profile are created below. */
+    pending_sinks_clear(u);
+
     /* If there are connected sink inputs/source outputs in old profile's sinks/sources move
      * them all to new sinks/sources. */
     pa_log_debug("Update sinks and sources for profile %s", new_profile->name);
@@ -728,17 +1173,21 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
                 continue;
             }
 
+            begin = pa_rtclock_now();
             sink_inputs = pa_sink_move_all_start(am->sink, sink_inputs);
             pa_droid_sink_free(am->sink);
             am->sink = NULL;
+            profile_switch_step(u, begin, "remove sink %s", am->name);
         }
     }
 
     if (curr->droid_profile && (am = curr->droid_profile->input_mapping)) {
         if (am->source && next->droid_profile && next->droid_profile->input_mapping) {
+            begin = pa_rtclock_now();
             source_outputs = pa_source_move_all_start(am->source, source_outputs);
             pa_droid_source_free(am->source);
             am->source = NULL;
+            profile_switch_step(u, begin, "remove source %s", am->name);
         }
     }
 
@@ -747,12 +1196,17 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
             if (!output_enabled(u, am))
                 continue;
 
-            if (!am->sink)
+            if (!am->sink) {
+                begin = pa_rtclock_now();
                 am->sink = pa_droid_sink_new(u->module, u->modargs, __FILE__, &u->card_data, 0, am, u->card);
+                profile_switch_step(u, begin, "create sink %s", am->name);
+            }
 
             if (sink_inputs && am->sink) {
+                begin = pa_rtclock_now();
                 pa_sink_move_all_finish(am->sink, sink_inputs, false);
                 sink_inputs = NULL;
+                profile_switch_step(u, begin, "move sink inputs to %s", am->name);
             }
         }
     }
@@ -762,12 +1216,17 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
             if (!input_enabled(u, am))
                 continue;
 
-            if (!am->source)
+            if (!am->source) {
+                begin = pa_rtclock_now();
                 am->source = pa_droid_source_new(u->module, u->modargs, __FILE__, &u->card_data, am, u->card);
+                profile_switch_step(u, begin, "create source %s", am->name);
+            }
 
             if (source_outputs && am->source) {
+                begin = pa_rtclock_now();
                 pa_source_move_all_finish(am->source, source_outputs, false);
                 source_outputs = NULL;
+                profile_switch_step(u, begin, "move source outputs to %s", am->name);
             }
         }
     }
@@ -775,8 +1234,10 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
     /* if only primary sink is left after profile change and we have detached sink-inputs attach
      * them to primary sink. */
     if (sink_inputs && primary_sink) {
+        begin = pa_rtclock_now();
         pa_sink_move_all_finish(primary_sink, sink_inputs, false);
         sink_inputs = NULL;
+        profile_switch_step(u, begin, "move sink inputs to %s", primary_sink->name);
     }
 
     if (sink_inputs)
@@ -788,6 +1249,26 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
     return 0;
 }
 
+static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
+    struct userdata *u;
+    int ret;
+
+    pa_assert(c);
+    pa_assert(new_profile);
+    pa_assert_se(u = c->userdata);
+
+    if (new_profile->available != PA_AVAILABLE_YES) {
+        pa_log("Profile %s is not available.", new_profile->name);
+        return -1;
+    }
+
+    profile_switch_begin(u, c->active_profile, new_profile);
+    ret = switch_profile(u, c, new_profile);
+    profile_switch_end(u, ret);
+
+    return ret;
+}
+
 static pa_hook_result_t port_availability_changed_hook_callback(void *hook_data,
                                                                 void *call_data,
                                                                 void *slot_data) {
@@ -827,27 +1308,120 @@ static pa_hook_result_t port_availability_changed_hook_callback(void *hook_data,
 
 
     pa_droid_port_data *data = PA_DEVICE_PORT_DATA(port);
-    #define PARAM_LEN (128)
-    char setparam[PARAM_LEN];
-    snprintf(setparam, PARAM_LEN, "%s=%" PRIu32, verb, device);
+    pa_droid_parameters *parameters = pa_droid_parameters_new();
+
+    pa_droid_parameters_set_uint(parameters, verb, device);
 
     if (data->usb.card >= 0) {
-        size_t len = strlen(setparam);
-        char *w = setparam;
-        w += len;
-        snprintf(w, PARAM_LEN - len, ";card=%d", data->usb.card);
-        if (data->usb.device >= 0) {
-            size_t len2 = strlen(w);
-            w += len2;
-            snprintf(w, PARAM_LEN - len - len2, ";device=%d", data->usb.device);
-        }
+        pa_droid_parameters_set_int(parameters, "card", data->usb.card);
+        if (data->usb.device >= 0)
+            pa_droid_parameters_set_int(parameters, "device", data->usb.device);
     }
-    pa_droid_set_parameters(u->hw_module, setparam);
+
+    /* Plug events often come in bursts, queue the notification so that
+     * redundant connect and disconnect pairs are dropped and the rest are
+     * set with as few calls as possible. */
+    pa_droid_hw_queue_parameters(u->hw_module, parameters);
 
     return PA_HOOK_OK;
 }
 
 
+#if PA_CHECK_VERSION(15,0,0)
+/* {"<sink name>":{<route switch stats>},...} */
+static char *route_switches_to_string(struct userdata *u) {
+    pa_sink *sink;
+    pa_strbuf *buf;
+    char *stats;
+    uint32_t idx;
+    bool first = true;
+
+    pa_assert(u);
+
+    buf = pa_strbuf_new();
+    pa_strbuf_putc(buf, '{');
+
+    PA_IDXSET_FOREACH(sink, u->card->sinks, idx) {
+        if (!first)
+            pa_strbuf_putc(buf, ',');
+        dm_json_append_string(buf, sink->name);
+        pa_strbuf_putc(buf, ':');
+        stats = pa_droid_sink_route_switch_stats(sink);
+        pa_strbuf_puts(buf, stats);
+        pa_xfree(stats);
+        first = false;
+    }
+
+    pa_strbuf_putc(buf, '}');
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+static int card_message_handler(const char *object_path, const char *message, const pa_json_object *parameters,
+                                char **response, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+    pa_assert(message);
+    pa_assert(response);
+
+    if (pa_streq(message, "startup")) {
+        if (!(*response = pa_droid_hw_startup_report(u->hw_module)))
+            return -PA_ERR_NOENTITY;
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "stats")) {
+        *response = pa_droid_hw_stream_stats_report(u->hw_module);
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "stats-reset")) {
+        pa_droid_hw_stream_stats_reset(u->hw_module);
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "hal-stats")) {
+        if (!(*response = pa_droid_hw_hal_stats_report(u->hw_module)))
+            return -PA_ERR_NOENTITY;
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "hal-stats-reset")) {
+        pa_droid_hw_hal_stats_reset(u->hw_module);
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "profile-switches")) {
+        *response = profile_switches_to_string(u);
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "profile-switches-reset")) {
+        if (u->profile_switches) {
+            dm_list_free(u->profile_switches, (pa_free_cb_t) profile_switch_free);
+            u->profile_switches = NULL;
+        }
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "route-switches")) {
+        *response = route_switches_to_string(u);
+        return PA_OK;
+    }
+
+    if (pa_streq(message, "trace-start"))
+        return pa_droid_trace_set_enabled(true) ? PA_OK : -PA_ERR_NOTSUPPORTED;
+
+    if (pa_streq(message, "trace-stop")) {
+        pa_droid_trace_set_enabled(false);
+        return PA_OK;
+    }
+
+    return -PA_ERR_NOTIMPLEMENTED;
+}
+#endif
+
 int pa__init(pa_module *m) {
     struct userdata *u = NULL;
     pa_modargs *ma = NULL;
@@ -855,6 +1429,7 @@ int pa__init(pa_module *m) {
     const char *module_id;
     bool namereg_fail = false;
     pa_card_profile *voicecall = NULL;
+    pa_usec_t begin;
 
     pa_assert(m);
 
@@ -879,7 +1454,9 @@ int pa__init(pa_module *m) {
     u->card_data.module_id = pa_xstrdup(module_id);
     u->card_data.userdata = u;
 
+    begin = pa_rtclock_now();
     u->profile_set = pa_droid_profile_set_default_new(u->hw_module->enabled_module);
+    pa_droid_hw_startup_phase(u->hw_module, "profile_set", begin);
 
     pa_card_new_data_init(&data);
     data.driver = __FILE__;
@@ -920,6 +1497,18 @@ int pa__init(pa_module *m) {
     add_virtual_profile(u, RINGTONE_PROFILE_NAME, RINGTONE_PROFILE_DESC,
                         AUDIO_MODE_RINGTONE, NULL,
                         PA_AVAILABLE_YES, NULL, data.profiles);
+    /* Loopback profiles only with audio patch capable HAL. */
+    if (u->hw_module->device->create_audio_patch &&
+        !pa_droid_option(u->hw_module, DM_OPTION_USE_LEGACY_STREAM_SET_PARAMETERS)) {
+        if (find_input_device_port(u, AUDIO_DEVICE_IN_FM_TUNER))
+            add_virtual_profile(u, FMRADIO_PROFILE_NAME, FMRADIO_PROFILE_DESC,
+                                AUDIO_MODE_NORMAL, fmradio_profile_event_cb,
+                                PA_AVAILABLE_YES, NULL, data.profiles);
+        if (find_input_device_port(u, AUDIO_DEVICE_IN_LINE))
+            add_virtual_profile(u, LINE_IN_PROFILE_NAME, LINE_IN_PROFILE_DESC,
+                                AUDIO_MODE_NORMAL, line_in_profile_event_cb,
+                                PA_AVAILABLE_YES, NULL, data.profiles);
+    }
 #ifdef DROID_AUDIO_HAL_DEBUG_VSID
     add_virtual_profile(u, VOICE_SESSION_VOICE1_PROFILE_NAME, VOICE_SESSION_VOICE1_PROFILE_DESC,
                         AUDIO_MODE_IN_CALL, voicecall_voice1_vsid_profile_event_cb,
@@ -963,22 +1552,52 @@ int pa__init(pa_module *m) {
     u->module = m;
 
     pa_card_choose_initial_profile(u->card);
+    begin = pa_rtclock_now();
     init_profile(u);
+    pa_droid_hw_startup_phase(u->hw_module, "init_profile", begin);
 
     pa_module_hook_connect(u->module,
                            &u->module->core->hooks[PA_CORE_HOOK_PORT_AVAILABLE_CHANGED],
                            PA_HOOK_NORMAL,
                            port_availability_changed_hook_callback, u);
 
+    pa_module_hook_connect(u->module,
+                           &u->module->core->hooks[PA_CORE_HOOK_SINK_PORT_CHANGED],
+                           PA_HOOK_NORMAL,
+                           sink_port_changed_hook_callback, u);
+
+    pa_module_hook_connect(u->module,
+                           &u->hw_module->config_changed_hook,
+                           PA_HOOK_NORMAL,
+                           (pa_hook_cb_t) config_changed_hook_cb, u);
+
     pa_card_put(u->card);
 
+    begin = pa_rtclock_now();
     u->extcon = pa_droid_extcon_new(m->core, u->card);
+    pa_droid_hw_startup_phase(u->hw_module, "extcon", begin);
 
-    if (!u->extcon)
+    if (!u->extcon) {
+        begin = pa_rtclock_now();
         u->extevdev = pa_droid_extevdev_new(u->card);
+        pa_droid_hw_startup_phase(u->hw_module, "extevdev", begin);
+    }
 
-    if (pa_droid_option(u->hw_module, DM_OPTION_USB_DEVICES))
+    if (pa_droid_option(u->hw_module, DM_OPTION_USB_DEVICES)) {
+        begin = pa_rtclock_now();
         u->extusbdev = pa_droid_extusbdev_new(u->hw_module, u->card);
+        pa_droid_hw_startup_phase(u->hw_module, "extusbdev", begin);
+    }
+
+#if PA_CHECK_VERSION(15,0,0)
+    u->message_handler_path = pa_sprintf_malloc("/card/%s/droid", u->card->name);
+    pa_message_handler_register(m->core, u->message_handler_path, "Droid card message handler",
+                                card_message_handler, u);
+#endif
+
+    /* With deferred sinks startup is finished once they are all created. */
+    if (!u->pending_sinks || pa_idxset_isempty(u->pending_sinks))
+        pa_droid_hw_startup_finish(u->hw_module);
 
     return 0;
 
@@ -998,6 +1617,22 @@ void pa__done(pa_module *m) {
 
     if ((u = m->userdata)) {
 
+#if PA_CHECK_VERSION(15,0,0)
+        if (u->message_handler_path) {
+            pa_message_handler_unregister(u->core, u->message_handler_path);
+            pa_xfree(u->message_handler_path);
+        }
+#endif
+
+        if (u->pending_sinks_event)
+            u->core->mainloop->defer_free(u->pending_sinks_event);
+
+        if (u->profile_switches)
+            dm_list_free(u->profile_switches, (pa_free_cb_t) profile_switch_free);
+
+        if (u->pending_sinks)
+            pa_idxset_free(u->pending_sinks, NULL);
+
         if (u->card && u->card->sinks)
             pa_idxset_remove_all(u->card->sinks, (pa_free_cb_t) pa_droid_sink_free);
 
@@ -1025,8 +1660,10 @@ void pa__done(pa_module *m) {
         if (u->card_data.module_id)
             pa_xfree(u->card_data.module_id);
 
-        if (u->hw_module)
+        if (u->hw_module) {
+            loopback_patch_release(u);
             pa_droid_hw_module_unref(u->hw_module);
+        }
 
         pa_xfree(u);
     }